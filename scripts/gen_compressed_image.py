@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Compress a firmware image or delta patch for download.
+
+The output is in the format decompressed by src/fota_decompress.c;
+see src/fota_decompress.h for its description. The window must not
+be bigger than the device's CONFIG_FOTA_DECOMPRESS_WINDOW_BITS."""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b'FHS1'
+
+# Length of the prefixes used to find match candidates.
+KEY_LEN = 2
+# Match candidates remembered for each prefix, most recent first.
+MAX_CANDIDATES = 64
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def write(self, value, count):
+        self.bits = (self.bits << count) | value
+        self.count += count
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.bits >> self.count) & 0xff)
+        self.bits &= (1 << self.count) - 1
+
+    def finish(self):
+        if self.count:
+            self.out.append((self.bits << (8 - self.count)) & 0xff)
+        return bytes(self.out)
+
+
+def compress(data, window_bits, lookahead_bits):
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    # A back-reference costs this many bits; a literal costs 9.
+    ref_bits = 1 + window_bits + lookahead_bits
+
+    candidates = {}
+    bits = BitWriter()
+
+    def remember(pos):
+        positions = candidates.setdefault(data[pos:pos + KEY_LEN], [])
+        positions.insert(0, pos)
+        del positions[MAX_CANDIDATES:]
+
+    pos = 0
+    while pos < len(data):
+        best_len = best_dist = 0
+        limit = min(max_len, len(data) - pos)
+        for old in candidates.get(data[pos:pos + KEY_LEN], ()):
+            dist = pos - old
+            if dist > window:
+                break
+            length = 0
+            while length < limit and data[old + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_dist = length, dist
+                if length == limit:
+                    break
+
+        if best_len * 9 > ref_bits:
+            bits.write(0, 1)
+            bits.write(best_dist - 1, window_bits)
+            bits.write(best_len - 1, lookahead_bits)
+        else:
+            best_len = 1
+            bits.write(1, 1)
+            bits.write(data[pos], 8)
+
+        for i in range(pos, pos + best_len):
+            remember(i)
+        pos += best_len
+
+    header = MAGIC + struct.pack('<BBHI', window_bits, lookahead_bits, 0,
+                                 len(data))
+    return header + bits.finish()
+
+
+def decompress(compressed):
+    """Reference implementation of the device side, for checking."""
+    magic, window_bits, lookahead_bits, _, size = struct.unpack_from(
+        '<4sBBHI', compressed)
+    assert magic == MAGIC
+    pos = 12 * 8
+
+    def read(count):
+        nonlocal pos
+        value = 0
+        for _ in range(count):
+            byte = compressed[pos // 8]
+            value = (value << 1) | ((byte >> (7 - pos % 8)) & 1)
+            pos += 1
+        return value
+
+    out = bytearray()
+    while len(out) < size:
+        if read(1):
+            out.append(read(8))
+        else:
+            dist = read(window_bits) + 1
+            length = read(lookahead_bits) + 1
+            for _ in range(length):
+                out.append(out[-dist])
+    assert len(compressed) * 8 - pos < 8
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Compress a firmware image or delta patch.')
+    parser.add_argument('input', help='signed image or delta patch')
+    parser.add_argument('-o', '--output', required=True,
+                        help='output file')
+    parser.add_argument('-w', '--window-bits', type=int, default=10,
+                        help='log2 of the window size (default: 10)')
+    parser.add_argument('-l', '--lookahead-bits', type=int, default=4,
+                        help='log2 of the longest match (default: 4)')
+    parser.add_argument('-f', '--force', action='store_true',
+                        help='write the output even if it is not smaller '
+                        'than the input')
+    args = parser.parse_args()
+
+    if not 4 <= args.window_bits <= 14:
+        sys.exit('window bits must be between 4 and 14')
+    if not 3 <= args.lookahead_bits < args.window_bits:
+        sys.exit('lookahead bits must be at least 3, and less than '
+                 'window bits')
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    if not data:
+        sys.exit('%s is empty' % args.input)
+
+    compressed = compress(data, args.window_bits, args.lookahead_bits)
+    if decompress(compressed) != data:
+        sys.exit('internal error: output does not decompress to the input')
+    if len(compressed) >= len(data) and not args.force:
+        sys.exit('%s does not compress (%d bytes, %d compressed); '
+                 'download it as is, or use --force' %
+                 (args.input, len(data), len(compressed)))
+
+    with open(args.output, 'wb') as f:
+        f.write(compressed)
+
+    print('%s: %d bytes (%d bytes uncompressed, %.0f%%)' %
+          (args.output, len(compressed), len(data),
+           100.0 * len(compressed) / len(data)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Generate a delta firmware update patch.
+
+The patch rebuilds NEW from OLD, the signed image currently running
+on the device (slot 0). It is in the format applied by
+src/fota_delta.c; see src/fota_delta.h for its description.
+
+Like bsdiff, the patch is made of approximate matches against the old
+image, stored as bytewise differences which are mostly zero, and
+literal data for what couldn't be matched. The differences compress
+very well, so the patch is meant to be compressed before it is sent
+to the device, with gen_compressed_image.py. Long runs of zeros favour
+long matches, so use --lookahead-bits 8 or so."""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'FDP1'
+
+# Length of the exact matches used to find candidate old positions.
+SEED_LEN = 16
+# Candidate old positions remembered for each seed.
+MAX_CANDIDATES = 8
+# Give up extending a match once it scores this much below its best.
+MAX_SCORE_DROP = 32
+
+
+def index_old(old):
+    index = {}
+    for pos in range(len(old) - SEED_LEN + 1):
+        positions = index.setdefault(old[pos:pos + SEED_LEN], [])
+        if len(positions) < MAX_CANDIDATES:
+            positions.append(pos)
+    return index
+
+
+def extend(old, old_pos, new, new_pos):
+    """Length of the best approximate match, scoring +1 for equal
+    bytes and -1 for different ones."""
+    score = best_score = best_len = 0
+    length = 0
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    while length < limit:
+        if old[old_pos + length] == new[new_pos + length]:
+            score += 1
+        else:
+            score -= 1
+        length += 1
+        if score > best_score:
+            best_score, best_len = score, length
+        elif score < best_score - MAX_SCORE_DROP:
+            break
+    return best_len
+
+
+def find_matches(old, new):
+    """Yield (new_pos, old_pos, length) approximate matches, in order
+    and not overlapping in new."""
+    index = index_old(old)
+    expected = 0
+    new_pos = 0
+    while new_pos < len(new) - SEED_LEN + 1:
+        candidates = index.get(new[new_pos:new_pos + SEED_LEN])
+        if not candidates:
+            new_pos += 1
+            expected += 1
+            continue
+        # Prefer the candidate closest to where the old data would be
+        # if nothing moved since the last match.
+        old_pos = min(candidates, key=lambda pos: abs(pos - expected))
+        length = extend(old, old_pos, new, new_pos)
+        yield new_pos, old_pos, length
+        new_pos += length
+        expected = old_pos + length
+
+
+def make_patch(old, new):
+    records = []
+    # The current record's diff run: new[diff_new:diff_new + diff_len]
+    # from old[diff_old:...]. The first record starts with an empty one.
+    diff_new = diff_old = diff_len = 0
+
+    for new_pos, old_pos, length in find_matches(old, new):
+        extra = new[diff_new + diff_len:new_pos]
+        seek = old_pos - (diff_old + diff_len)
+        records.append((diff_new, diff_old, diff_len, extra, seek))
+        diff_new, diff_old, diff_len = new_pos, old_pos, length
+
+    records.append((diff_new, diff_old, diff_len,
+                    new[diff_new + diff_len:], 0))
+
+    out = bytearray()
+    out += MAGIC
+    out += struct.pack('<III', len(new), len(old), zlib.crc32(old))
+    for diff_new, diff_old, diff_len, extra, seek in records:
+        if not diff_len and not extra and not seek:
+            continue
+        out += struct.pack('<IIi', diff_len, len(extra), seek)
+        out += bytes((new[diff_new + i] - old[diff_old + i]) & 0xff
+                     for i in range(diff_len))
+        out += extra
+    return bytes(out)
+
+
+def apply_patch(old, patch):
+    """Reference implementation of the device side, for checking."""
+    magic, new_size, old_size, old_crc = struct.unpack_from('<4sIII',
+                                                            patch)
+    assert magic == MAGIC and old_size == len(old)
+    assert old_crc == zlib.crc32(old)
+    new = bytearray()
+    pos, old_pos = 16, 0
+    while len(new) < new_size:
+        diff_len, extra_len, seek = struct.unpack_from('<IIi', patch, pos)
+        pos += 12
+        for i in range(diff_len):
+            new.append((old[old_pos + i] + patch[pos + i]) & 0xff)
+        pos += diff_len
+        old_pos += diff_len
+        new += patch[pos:pos + extra_len]
+        pos += extra_len
+        old_pos += seek
+    assert pos == len(patch)
+    return bytes(new)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Generate a delta firmware update patch.')
+    parser.add_argument('old', help='signed image running on the device')
+    parser.add_argument('new', help='signed image to update to')
+    parser.add_argument('-o', '--output', required=True,
+                        help='output patch file')
+    args = parser.parse_args()
+
+    with open(args.old, 'rb') as f:
+        old = f.read()
+    with open(args.new, 'rb') as f:
+        new = f.read()
+
+    patch = make_patch(old, new)
+    if apply_patch(old, patch) != new:
+        sys.exit('internal error: patch does not reproduce the new image')
+
+    with open(args.output, 'wb') as f:
+        f.write(patch)
+
+    print('%s: %d bytes (new image %d bytes, %d bytes compressed)' %
+          (args.output, len(patch), len(new),
+           len(zlib.compress(patch, 9))))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
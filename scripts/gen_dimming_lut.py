@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+
+"""Generate the light dimming lookup tables.
+
+The light backends map a (channel level, dimmer) pair to an output
+level as:
+
+    output = curve[(level * scale[dimmer]) >> SCALE_SHIFT]
+
+where scale[] turns the dimmer percentage into a fixed-point factor,
+and curve[] maps relative brightness to output level according to the
+selected dimming curve. Both tables are generated here, at build
+time, so the backends do no divisions and no floating point math.
+
+Output levels have --bits of resolution (8 by default). Backends
+which can use more than 8 bits, like PWM, get the full-resolution
+value; the others use the top 8 bits.
+
+The output is a C header which defines the tables; it must only be
+included by light_dimming.c."""
+
+
+import argparse
+import sys
+
+# Dimmer percentages run from 0 to 100 inclusive.
+DIMMER_LEVELS = 101
+
+# scale[100] == 1 << SCALE_BITS, so the curve index for full brightness
+# is 255 << (SCALE_BITS - SCALE_SHIFT).
+SCALE_BITS = 10
+SCALE_SHIFT = 8
+CURVE_MAX_INDEX = 255 << (SCALE_BITS - SCALE_SHIFT)
+
+
+def linear(x):
+    return x
+
+
+def gamma22(x):
+    return x ** 2.2
+
+
+def cie1931(x):
+    # CIE 1931 lightness: perceived lightness L* (0-100) to luminance.
+    lightness = x * 100.0
+    if lightness <= 8.0:
+        return lightness / 903.3
+    return ((lightness + 16.0) / 116.0) ** 3
+
+
+CURVES = {
+    'linear': linear,
+    'gamma22': gamma22,
+    'cie1931': cie1931,
+}
+
+
+def c_array(ctype, name, values, per_line=12):
+    lines = []
+    for i in range(0, len(values), per_line):
+        chunk = values[i:i + per_line]
+        lines.append('\t' + ', '.join('%d' % v for v in chunk) + ',')
+    return ('const %s %s[%d] = {\n%s\n};\n' %
+            (ctype, name, len(values), '\n'.join(lines)))
+
+
+def generate(curve_name, bits, out):
+    curve = CURVES[curve_name]
+    max_level = (1 << bits) - 1
+    scale = [round(d * (1 << SCALE_BITS) / 100)
+             for d in range(DIMMER_LEVELS)]
+    table = [round(max_level * curve(i / CURVE_MAX_INDEX))
+             for i in range(CURVE_MAX_INDEX + 1)]
+
+    out.write('/* Generated by %s --curve %s --bits %d; do not edit. */\n\n'
+              % ('gen_dimming_lut.py', curve_name, bits))
+    out.write('BUILD_ASSERT(LIGHT_DIM_SCALE_SHIFT == %d);\n' %
+              SCALE_SHIFT)
+    out.write('BUILD_ASSERT(LIGHT_DIM_BITS == %d);\n\n' % bits)
+    out.write(c_array('u16_t', 'light_dim_scale', scale))
+    out.write('\n')
+    out.write(c_array('u8_t' if bits <= 8 else 'u16_t',
+                      'light_dim_curve', table))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Generate light dimming lookup tables.')
+    parser.add_argument('--curve', choices=sorted(CURVES), required=True,
+                        help='dimming curve')
+    parser.add_argument('--bits', type=int, default=8,
+                        choices=range(8, 17), metavar='{8..16}',
+                        help='output level resolution (default: 8)')
+    parser.add_argument('-o', '--output', required=True,
+                        help='output header file')
+    args = parser.parse_args()
+
+    with open(args.output, 'w') as out:
+        generate(args.curve, args.bits, out)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,257 +1,507 @@
-# Copyright (c) 2018 Foundries.io
+#!/usr/bin/env python3
+#
+# Copyright (c) 2018-2019 Foundries.io
 #
 # SPDX-License-Identifier: Apache-2.0
 
-import signal
+"""Roll out a firmware update to LwM2M devices through a Leshan server.
+
+Devices aren't polled: their firmware update State (5/0/3) and Update
+Result (5/0/5) are observed, and the notifications, read from the
+server's event stream, move each device through download and update.
+A device only costs a coroutine, so a whole fleet can be in flight at
+once; the number of simultaneous downloads, overall and per network
+segment, is what bounds the time a rollout takes.
+
+Devices are updated in waves of increasing size, and the rollout
+stops after a wave in which too many devices failed. The state of each
+device is kept in a JSON file, so an interrupted rollout can be run
+again without updating devices twice.
+
+leshan_sim.py is a stand-in server with simulated devices, to try
+rollouts against."""
+
 import argparse
-import requests
+import asyncio
+import concurrent.futures
+import datetime
+import functools
+import ipaddress
 import json
-import time
 import logging
-import threading
-import datetime
+import os
+import signal
 import sys
+import threading
+import urllib.error
+import urllib.request
+
+# Script Version 2.0
+
+HEADERS = {'Content-Type': 'application/json'}
+# Timeout of a single REST request. Requests to devices go through the
+# server, which waits for the device's CoAP response.
+REQUEST_TIMEOUT = 60
+# Delay before reconnecting to the event stream.
+EVENTS_RETRY_WAIT = 5
 
-# Script Version 1.1
+# Firmware update object (5) State and Update Result values.
+STATE_IDLE = 0
+STATE_DOWNLOADING = 1
+STATE_DOWNLOADED = 2
+STATE_UPDATING = 3
+RESULT_INITIAL = 0
+RESULT_SUCCESS = 1
 
-headers = { 'Content-Type': 'application/json'}
-loop_thread_wait     = 1
-download_thread_wait = 5
-update_thread_wait   = 10
+FW_STATE = '5/0/3'
+FW_RESULT = '5/0/5'
 
 logging.basicConfig(level=logging.INFO,
-                    format='[%(levelname)s] (%(threadName)-10s) %(message)s',
-                    )
-
-class UpdateAction:
-    # url must always be set by caller
-    def __init__(self, client=None, url='url',
-                 hostname='http://mgmt.foundries.io/leshan'):
-        self.client = client;
-        self.url = url;
-        self.hostname = hostname;
-        self.download_status = 0;
-        self.update_result = 0;
-        self.download_time_start = datetime.datetime.now();
-        self.download_time_end = datetime.datetime.now();
-        self.update_time_start = datetime.datetime.now();
-        self.update_time_end = datetime.datetime.now();
-        self.result = False;
-        self.requested = False;
-        self.abort_thread = False;
-
-update_list = []
-aborted = False
-
-def signal_handler(signal, frame):
-    global aborted
-
-    print('Script aborting ...')
-    aborted = True
-    for ua in update_list:
-        ua.abort_thread = True
-
-class AtomicCounter:
-    def __init__(self, initial=0):
-        self.value = initial
-        self._lock = threading.Lock()
-
-    def inc(self, num=1):
-        self._lock.acquire()
-        self.value += num
-        self._lock.release()
-
-    def dec(self, num=1):
-        self._lock.acquire()
-        self.value -= num
-        self._lock.release()
-
-def post(url):
-    response = requests.post(url, headers=headers)
-    if response.status_code in (200, 201):
-        return True
-    else:
-        logging.error(response)
-        return False
+                    format='[%(levelname)s] %(message)s')
+
+
+class LeshanError(Exception):
+    pass
+
+
+class Leshan:
+    """Leshan REST API. Requests run on a fixed pool of threads, so
+    they don't hold up the event loop; their number doesn't depend on
+    the number of devices."""
+
+    def __init__(self, hostname, workers):
+        self.hostname = hostname.rstrip('/')
+        self.executor = concurrent.futures.ThreadPoolExecutor(workers)
 
-def get(url, raw=False):
-    response = requests.get(url, headers=headers)
-    if response.status_code in (200, 201):
+    def _request(self, method, path, data=None):
+        body = json.dumps(data).encode() if data is not None else None
+        request = urllib.request.Request(self.hostname + path, data=body,
+                                         headers=HEADERS, method=method)
         try:
-            payload = response.json()
-        except:
-            return -1
-        if raw:
-            return payload
-        else:
-            if 'content' in payload:
-                if 'value' in payload['content']:
-                    return payload['content']['value']
-    else:
-        logging.error(response)
-        return -1
-
-def put(url, data):
-    response = requests.put(url, json=data, headers=headers)
-    if response.status_code in (200, 201):
+            with urllib.request.urlopen(request,
+                                        timeout=REQUEST_TIMEOUT) as response:
+                content = response.read()
+        except (urllib.error.URLError, OSError) as e:
+            raise LeshanError('%s %s: %s' % (method, path, e))
+
+        payload = json.loads(content.decode()) if content else None
+        # Device errors are reported with a 200 and a failure status.
+        if isinstance(payload, dict) and not payload.get('success', True):
+            raise LeshanError('%s %s: %s' % (method, path,
+                                             payload.get('status')))
+        return payload
+
+    async def request(self, method, path, data=None):
+        loop = asyncio.get_event_loop()
+        return await loop.run_in_executor(
+            self.executor,
+            functools.partial(self._request, method, path, data))
+
+    @staticmethod
+    def _value(payload):
+        try:
+            return payload['content']['value']
+        except (KeyError, TypeError):
+            raise LeshanError('unexpected response: %s' % payload)
+
+    async def clients(self):
+        return await self.request('GET', '/api/clients')
+
+    async def read(self, endpoint, path):
+        payload = await self.request('GET', '/api/clients/%s/%s' %
+                                     (endpoint, path))
+        return self._value(payload)
+
+    async def observe(self, endpoint, path):
+        payload = await self.request('POST', '/api/clients/%s/%s/observe' %
+                                     (endpoint, path))
+        return self._value(payload)
+
+    async def write(self, endpoint, path, value):
+        resource = int(path.split('/')[-1])
+        await self.request('PUT', '/api/clients/%s/%s' % (endpoint, path),
+                           {'id': resource, 'value': value})
+
+    async def execute(self, endpoint, path):
+        await self.request('POST', '/api/clients/%s/%s' % (endpoint, path))
+
+    def stream_events(self, handler, stop):
+        """Read the server's event stream until stop is set, passing
+        each event's type and data to handler. Runs in its own thread,
+        and reconnects when the stream breaks."""
+        while not stop.is_set():
+            try:
+                request = urllib.request.Request(
+                    self.hostname + '/event',
+                    headers={'Accept': 'text/event-stream'})
+                with urllib.request.urlopen(request) as stream:
+                    logging.info('connected to the event stream')
+                    event, data = None, []
+                    for line in stream:
+                        if stop.is_set():
+                            return
+                        line = line.decode().rstrip('\r\n')
+                        if line.startswith('event:'):
+                            event = line[6:].strip()
+                        elif line.startswith('data:'):
+                            data.append(line[5:].strip())
+                        elif not line:
+                            if event and data:
+                                handler(event, '\n'.join(data))
+                            event, data = None, []
+            except (urllib.error.URLError, OSError) as e:
+                logging.error('event stream: %s', e)
+            stop.wait(EVENTS_RETRY_WAIT)
+
+
+class Device:
+    def __init__(self, endpoint, segment, record):
+        self.endpoint = endpoint
+        self.segment = segment
+        self.record = record
+        self.fw_state = None
+        self.fw_result = None
+        # Bumped by every registration, after which the device must
+        # be observed again.
+        self.registrations = 0
+        # Set when anything above changes.
+        self.changed = asyncio.Event()
+
+
+def segment_of(address, prefix_v6, prefix_v4):
+    """Network segment of a registration address like 1.2.3.4:5683 or
+    [fd00::1]:5683: its IPv6 or IPv4 prefix."""
+    host = address.lstrip('/')
+    if host.startswith('['):
+        host = host[1:host.index(']')]
+    elif host.count(':') == 1:
+        host = host.split(':')[0]
+    try:
+        ip = ipaddress.ip_address(host)
+    except ValueError:
+        return 'default'
+    prefix = prefix_v6 if ip.version == 6 else prefix_v4
+    return str(ipaddress.ip_network('%s/%d' % (ip, prefix), strict=False))
+
+
+class Rollout:
+    def __init__(self, leshan, args):
+        self.leshan = leshan
+        self.args = args
+        self.devices = {}
+        self.records = {}
+        self.dirty = False
+        self.global_limit = asyncio.Semaphore(args.max_downloads)
+        self.segment_limits = {}
+        self.segment_map = {}
+        if args.segments:
+            with open(args.segments) as f:
+                self.segment_map = json.load(f)
+        if args.state and os.path.exists(args.state):
+            with open(args.state) as f:
+                self.records = json.load(f)
+
+    # Device state, kept across runs.
+
+    def set_state(self, dev, state, **fields):
+        dev.record.update(fields, state=state, url=self.args.url,
+                          time=datetime.datetime.now().isoformat())
+        self.records[dev.endpoint] = dev.record
+        self.dirty = True
+        logging.info('[%s] %s', dev.endpoint, state)
+
+    def save(self):
+        if not self.args.state or not self.dirty:
+            return
+        tmp = self.args.state + '.tmp'
+        with open(tmp, 'w') as f:
+            json.dump(self.records, f, indent=1, sort_keys=True)
+        os.replace(tmp, self.args.state)
+        self.dirty = False
+
+    async def save_periodically(self):
+        while True:
+            await asyncio.sleep(2)
+            self.save()
+
+    # Events.
+
+    def on_event(self, event, data):
+        try:
+            data = json.loads(data)
+        except ValueError:
+            return
+        if event == 'NOTIFICATION':
+            dev = self.devices.get(data.get('ep'))
+            value = data.get('val', {}).get('value')
+            if not dev or value is None:
+                return
+            if data.get('res', '').strip('/') == FW_STATE:
+                dev.fw_state = value
+            elif data.get('res', '').strip('/') == FW_RESULT:
+                dev.fw_result = value
+            dev.changed.set()
+        elif event in ('REGISTRATION', 'UPDATED'):
+            registration = data.get('registration', data)
+            dev = self.devices.get(registration.get('endpoint'))
+            if dev and event == 'REGISTRATION':
+                dev.registrations += 1
+                dev.changed.set()
+
+    async def observe_firmware(self, dev):
+        dev.fw_state = await self.leshan.observe(dev.endpoint, FW_STATE)
+        dev.fw_result = await self.leshan.observe(dev.endpoint, FW_RESULT)
+
+    async def wait_for(self, dev, done, timeout):
+        """Wait until done() is true, or the timeout expires. Without
+        news from the device for a while, read its state, in case a
+        notification was lost; after it registers again, observe it
+        again."""
+        loop = asyncio.get_event_loop()
+        deadline = loop.time() + timeout
+        registrations = dev.registrations
+        while not done():
+            left = deadline - loop.time()
+            if left <= 0:
+                return False
+            dev.changed.clear()
+            try:
+                await asyncio.wait_for(dev.changed.wait(),
+                                       min(left, self.args.poll_interval))
+                if dev.registrations == registrations:
+                    continue
+                registrations = dev.registrations
+            except asyncio.TimeoutError:
+                pass
+            try:
+                await self.observe_firmware(dev)
+            except LeshanError as e:
+                # Likely rebooting; keep waiting.
+                logging.debug('[%s] %s', dev.endpoint, e)
         return True
-    else:
-        logging.error(response)
-        return False
-
-def download(ua, thread_count):
-    ua.download_time_start = datetime.datetime.now()
-    download_status_url = '%s/api/clients/%s/5/0/3' % (ua.hostname, ua.client)
-    update_result_url = '%s/api/clients/%s/5/0/5' % (ua.hostname, ua.client)
-    while not ua.abort_thread:
-        ua.download_status = get(download_status_url)
-        if ua.download_status == 0:
-            if not ua.requested:
-                logging.info('ready for firmware update')
-                firmware = {'id': 1, 'value': ua.url}
-                firmware_url = '%s/api/clients/%s/5/0/1' % (ua.hostname, ua.client)
-                if (put(firmware_url, firmware)):
-                    logging.info('requested firmware download from %s', ua.url)
-                else:
-                    logging.error('failed to request firmware download')
-                    ua.result = False
-                    break
-                ua.requested = True
-            else:
-                ua.update_result = get(update_result_url)
-                logging.error('failed to start firmware download (%d)', ua.update_result)
-                ua.result = False
-                break
-        if ua.download_status == 1:
-            logging.info('downloading firmware')
-        if ua.download_status == 2:
-            logging.info('ready to apply update')
-            ua.result = True
-            break
-        if ua.download_status == 3:
-            logging.info('untriggered: executing the firmware update')
-            ua.result = False
-            break
-        if ua.download_status == 4:
-            logging.error('unknown status')
-        if ua.download_status < 0:
-            logging.error('no longer found')
-        # TODO check timeout?
-        time.sleep(download_thread_wait)
-    ua.download_time_end = datetime.datetime.now()
-    thread_count.dec()
-
-def update(ua, thread_count):
-    ua.update_time_start = datetime.datetime.now()
-    exec_update_url = '%s/api/clients/%s/5/0/2' % (ua.hostname, ua.client)
-    if (post(exec_update_url)):
-        logging.info('requested firmware update execution')
-        check = True
-        while (not ua.abort_thread and check):
-            update_result_url = '%s/api/clients/%s/5/0/5' % (ua.hostname, ua.client)
-            ua.update_result = get(update_result_url)
-            if ua.update_result == 1:
-                logging.info('firmware update successful')
-                check = False
-            elif ua.update_result > 1:
-                logging.error('firmware update failed (%d)', ua.update_result)
-                result = False
-                check = False
-            else:
-                # TODO check timeout / bad update status
-                time.sleep(update_thread_wait)
-    else:
-        logging.error('failed to request firmware update execution')
-        result = False
-    ua.update_time_end = datetime.datetime.now()
-    thread_count.dec()
-
-def run(client, url, hostname, device, max_threads):
-    global aborted
-
-    start_time = datetime.datetime.now()
-    thread_count = AtomicCounter()
-    client_list_url = '%s/api/clients'  % (hostname)
-    response = get(client_list_url, raw=True)
-    if response:
-        for target in response:
-            start_download = True
-            if 'endpoint' in target:
-                if client:
-                    # check for a partial match of the endpoint
-                    if not client in target['endpoint']:
-                        start_download = False
-                if start_download and device:
-                    endpoint_url = '%s/api/clients/%s/3/0/1'  % (hostname, target['endpoint'])
-                    endpoint_device = get(endpoint_url)
-                    if (endpoint_device != device):
-                        start_download = False
-                if start_download:
-                    # check for max threads and wait if needed
-                    while (not aborted and thread_count.value >= max_threads):
-                        time.sleep(loop_thread_wait)
-                    if (not aborted):
-                        # bump thread count
-                        thread_count.inc()
-                        # append a new update action
-                        ua = UpdateAction(target['endpoint'], url, hostname)
-                        update_list.append(ua)
-                        # create a new thread
-                        t = threading.Thread(name=ua.client, target=download,
-                                             args=(ua, thread_count,))
-                        t.start()
-        while (thread_count.value > 0):
-            # TODO check timeout?
-            time.sleep(loop_thread_wait)
-
-    # We haven't triggered the updates yet:
-    # loop through update_list and trigger successful downloads
-    if (not aborted):
-        for ua in update_list:
-            if not ua.abort_thread and ua.result:
-                # bump thread count
-                thread_count.inc()
-                # create a new thread
-                t = threading.Thread(name=ua.client, target=update,
-                                     args=(ua, thread_count,))
-                t.start()
-
-        while (thread_count.value > 0):
-            # TODO check timeout?
-            time.sleep(loop_thread_wait)
-
-    # dump update info
+
+    # Device update.
+
+    def segment_limit(self, dev):
+        if dev.segment not in self.segment_limits:
+            self.segment_limits[dev.segment] = \
+                asyncio.Semaphore(self.args.per_segment)
+        return self.segment_limits[dev.segment]
+
+    async def download(self, dev):
+        if self.args.device:
+            device_type = await self.leshan.read(dev.endpoint, '3/0/1')
+            if device_type != self.args.device:
+                self.set_state(dev, 'skipped')
+                return False
+
+        await self.observe_firmware(dev)
+        if dev.fw_state == STATE_DOWNLOADED and \
+           dev.record.get('state') == 'downloaded':
+            # Downloaded by an earlier run.
+            return True
+        if dev.fw_state != STATE_IDLE:
+            self.set_state(dev, 'failed', reason='busy (%s)' % dev.fw_state)
+            return False
+
+        self.set_state(dev, 'downloading')
+        dev.fw_result = RESULT_INITIAL
+        await self.leshan.write(dev.endpoint, '5/0/1', self.args.url)
+        if not await self.wait_for(
+                dev, lambda: (dev.fw_state == STATE_DOWNLOADED or
+                              (dev.fw_result or 0) > RESULT_SUCCESS),
+                self.args.download_timeout):
+            self.set_state(dev, 'failed', reason='download timeout')
+            return False
+        if dev.fw_state != STATE_DOWNLOADED:
+            self.set_state(dev, 'failed', result=dev.fw_result,
+                           reason='download failed')
+            return False
+
+        self.set_state(dev, 'downloaded')
+        return True
+
+    async def apply(self, dev):
+        self.set_state(dev, 'updating')
+        dev.fw_result = RESULT_INITIAL
+        await self.leshan.execute(dev.endpoint, '5/0/2')
+        if not await self.wait_for(
+                dev, lambda: (dev.fw_result or 0) >= RESULT_SUCCESS,
+                self.args.update_timeout):
+            self.set_state(dev, 'failed', reason='update timeout')
+            return False
+        if dev.fw_result != RESULT_SUCCESS:
+            self.set_state(dev, 'failed', result=dev.fw_result,
+                           reason='update failed')
+            return False
+
+        self.set_state(dev, 'done', result=dev.fw_result)
+        return True
+
+    async def update(self, dev):
+        start = datetime.datetime.now()
+        dev.record['attempts'] = dev.record.get('attempts', 0) + 1
+        try:
+            # Only the download uses the network.
+            async with self.global_limit:
+                async with self.segment_limit(dev):
+                    ok = await self.download(dev)
+            if ok:
+                ok = await self.apply(dev)
+        except LeshanError as e:
+            self.set_state(dev, 'failed', reason=str(e))
+            ok = False
+        dev.record['seconds'] = (datetime.datetime.now() - start).seconds
+        return ok
+
+    # Rollout.
+
+    async def find_devices(self):
+        for target in await self.leshan.clients():
+            endpoint = target.get('endpoint')
+            if not endpoint:
+                continue
+            if self.args.client and self.args.client not in endpoint:
+                continue
+            record = dict(self.records.get(endpoint, {}))
+            if record.get('state') in ('done', 'skipped') and \
+               record.get('url') == self.args.url:
+                continue
+            segment = self.segment_map.get(endpoint) or \
+                segment_of(target.get('address', ''),
+                           self.args.segment_prefix_v6,
+                           self.args.segment_prefix_v4)
+            self.devices[endpoint] = Device(endpoint, segment, record)
+
+    async def run(self):
+        await self.find_devices()
+        devices = sorted(self.devices.values(), key=lambda d: d.endpoint)
+        logging.info('%d device(s) to update, in %d segment(s)',
+                     len(devices), len({d.segment for d in devices}))
+
+        saver = asyncio.ensure_future(self.save_periodically())
+        sizes = [max(1, int(size)) for size in self.args.waves.split(',')]
+        start = wave = 0
+        failed = False
+        try:
+            while start < len(devices) and not failed:
+                size = sizes[min(wave, len(sizes) - 1)]
+                batch = devices[start:start + size]
+                logging.info('wave %d: %d device(s)', wave + 1, len(batch))
+                results = await asyncio.gather(
+                    *[self.update(dev) for dev in batch])
+                failures = results.count(False)
+                if failures > self.args.max_failures * len(batch):
+                    logging.error('wave %d: %d of %d device(s) failed, '
+                                  'stopping', wave + 1, failures, len(batch))
+                    failed = True
+                start += size
+                wave += 1
+        finally:
+            saver.cancel()
+            self.save()
+
+        return devices, failed
+
+
+def summary(devices, start):
     logging.info('UPDATE SUMMARY:')
     result = 0
-    count = 0
-    for ua in update_list:
-        count += 1
-        timediff = ua.download_time_end - ua.download_time_start
-        timediff += ua.update_time_end - ua.update_time_start
-        if ua.abort_thread == True:
-            logging.info('[%s] update ABORTED', ua.client)
-        elif ua.result:
-            logging.info('[%s] update SUCCESS (%d seconds)', ua.client, timediff.seconds)
-        else:
-            logging.info('[%s] update FAILED(%d) (%d seconds)', ua.client, ua.update_result, timediff.seconds)
+    for dev in devices:
+        record = dev.record
+        state = record.get('state', 'not attempted')
+        if state == 'done':
+            logging.info('[%s] update SUCCESS (%d seconds)', dev.endpoint,
+                         record.get('seconds', 0))
+        elif state in ('failed', 'downloading', 'downloaded', 'updating'):
+            logging.info('[%s] update FAILED: %s (%d seconds)', dev.endpoint,
+                         record.get('reason', state),
+                         record.get('seconds', 0))
             result = 1
-    timediff = datetime.datetime.now() - start_time
-    logging.info('%d update(s) attempted which took %d seconds total', count, timediff.seconds)
-    sys.exit(result)
+        else:
+            logging.info('[%s] update %s', dev.endpoint, state.upper())
+    timediff = datetime.datetime.now() - start
+    logging.info('%d device(s) which took %d seconds total', len(devices),
+                 timediff.seconds)
+    return result
 
-def main():
-    # add process interrupt handler
-    signal.signal(signal.SIGINT, signal_handler)
 
-    description = 'Simple Leshan API wrapper for firmware updates'
+def main():
+    description = 'Roll out firmware updates through a Leshan server'
     parser = argparse.ArgumentParser(description=description)
-    parser.add_argument('-c', '--client', help='Leshan Client ID, if not specified all targets will be updated', default=None)
-    parser.add_argument('-u', '--url', help='URL for client firmware (http:// or coap://)', required=True)
-    parser.add_argument('-host', '--hostname', help='Leshan server URL', default='https://mgmt.foundries.io/leshan')
-    parser.add_argument('-d', '--device', help='Device type filter', default=None)
-    parser.add_argument('-t', '--threads', help='Maximum download threads', default=1)
+    parser.add_argument('-c', '--client', default=None,
+                        help='Leshan client ID (partial match); if not '
+                        'specified, all clients are updated')
+    parser.add_argument('-u', '--url', required=True,
+                        help='URL for client firmware (http:// or coap://)')
+    parser.add_argument('-host', '--hostname',
+                        default='https://mgmt.foundries.io/leshan',
+                        help='Leshan server URL')
+    parser.add_argument('-d', '--device', default=None,
+                        help='Device type filter')
+    parser.add_argument('-t', '--threads', '--max-downloads', type=int,
+                        dest='max_downloads', default=16,
+                        help='Maximum simultaneous downloads (default: 16)')
+    parser.add_argument('--per-segment', type=int, default=4,
+                        help='Maximum simultaneous downloads per network '
+                        'segment (default: 4)')
+    parser.add_argument('--segment-prefix-v6', type=int, default=64,
+                        help='IPv6 prefix length of a network segment '
+                        '(default: 64)')
+    parser.add_argument('--segment-prefix-v4', type=int, default=24,
+                        help='IPv4 prefix length of a network segment '
+                        '(default: 24)')
+    parser.add_argument('--segments', default=None,
+                        help='JSON file mapping client IDs to segment names, '
+                        'overriding the address prefixes')
+    parser.add_argument('--waves', default='1,10,100',
+                        help='Sizes of the successive waves of updates; '
+                        'the last one is repeated (default: 1,10,100)')
+    parser.add_argument('--max-failures', type=float, default=0.1,
+                        help='Stop after a wave in which more than this '
+                        'fraction of devices failed (default: 0.1)')
+    parser.add_argument('--state', default='leshan-rollout.json',
+                        help='File keeping the state of each device '
+                        '(default: leshan-rollout.json)')
+    parser.add_argument('--download-timeout', type=int, default=3600,
+                        help='Seconds a download may take (default: 3600)')
+    parser.add_argument('--update-timeout', type=int, default=600,
+                        help='Seconds an update may take (default: 600)')
+    parser.add_argument('--poll-interval', type=int, default=120,
+                        help='Read the state of a device which sent no '
+                        'notification for this many seconds (default: 120)')
+    parser.add_argument('--http-workers', type=int, default=16,
+                        help='Simultaneous REST requests (default: 16)')
     args = parser.parse_args()
-    run(args.client, args.url, args.hostname, args.device, int(args.threads))
+
+    start = datetime.datetime.now()
+    loop = asyncio.get_event_loop()
+    leshan = Leshan(args.hostname, args.http_workers)
+    rollout = Rollout(leshan, args)
+
+    stop = threading.Event()
+    # The stream blocks while waiting for events, so it doesn't hold
+    # up exiting.
+    threading.Thread(target=leshan.stream_events, daemon=True,
+                     args=(lambda event, data:
+                           loop.call_soon_threadsafe(rollout.on_event,
+                                                     event, data),
+                           stop)).start()
+
+    task = asyncio.ensure_future(rollout.run())
+    loop.add_signal_handler(signal.SIGINT, task.cancel)
+    try:
+        devices, failed = loop.run_until_complete(task)
+    except asyncio.CancelledError:
+        print('Script aborting ...')
+        devices, failed = sorted(rollout.devices.values(),
+                                 key=lambda d: d.endpoint), True
+    finally:
+        stop.set()
+
+    result = summary(devices, start)
+    sys.exit(result or int(failed))
+
 
 if __name__ == '__main__':
     main()
@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Stand-in Leshan server with simulated devices, to try leshan.py on.
+
+It serves the parts of Leshan's REST API and event stream leshan.py
+uses. Its devices download firmware when 5/0/1 is written, sharing
+the bandwidth of their network segment, and reboot into the new
+firmware when 5/0/2 is executed, registering again. Some of them can
+be made to fail. For example:
+
+    leshan_sim.py -n 1000 --segments 20 &
+    leshan.py -host http://localhost:8080 -u coap://fw/zmp.bin
+
+tests/scripts/test_leshan.py runs rollouts against it."""
+
+import argparse
+import json
+import queue
+import random
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+STATE_IDLE = 0
+STATE_DOWNLOADING = 1
+STATE_DOWNLOADED = 2
+STATE_UPDATING = 3
+RESULT_INITIAL = 0
+RESULT_SUCCESS = 1
+RESULT_CONNECTION_LOST = 4
+RESULT_INTEGRITY_FAILURE = 5
+RESULT_UPDATE_FAILED = 8
+
+TICK = 0.1
+
+
+class Device:
+    def __init__(self, endpoint, address, segment):
+        self.endpoint = endpoint
+        self.address = address
+        self.segment = segment
+        self.registered = True
+        self.resources = {'3/0/1': 'sim', '5/0/1': '',
+                          '5/0/3': STATE_IDLE, '5/0/5': RESULT_INITIAL}
+        self.observed = set()
+        self.received = 0
+        self.reboot_at = None
+
+
+class Simulator:
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.listeners = []
+        self.devices = {}
+        self.requests = 0
+        for i in range(args.devices):
+            segment = i % args.segments
+            endpoint = 'sim-%05d' % i
+            address = '[fd00:%x::%x]:5683' % (segment + 1, i + 1)
+            self.devices[endpoint] = Device(endpoint, address, segment)
+
+    # Event stream.
+
+    def listen(self):
+        events = queue.Queue()
+        with self.lock:
+            self.listeners.append(events)
+        return events
+
+    def unlisten(self, events):
+        with self.lock:
+            self.listeners.remove(events)
+
+    def emit(self, event, data):
+        message = 'event: %s\ndata: %s\n\n' % (event, json.dumps(data))
+        for events in self.listeners:
+            events.put(message)
+
+    def set(self, dev, path, value):
+        dev.resources[path] = value
+        if path in dev.observed:
+            self.emit('NOTIFICATION', {
+                'ep': dev.endpoint, 'res': '/' + path,
+                'val': {'id': int(path.split('/')[-1]), 'value': value}})
+
+    # Device behaviour, called with the lock held.
+
+    def write(self, dev, path, value):
+        if path != '5/0/1':
+            return
+        if dev.resources['5/0/3'] != STATE_IDLE:
+            return
+        dev.resources[path] = value
+        dev.received = 0
+        self.set(dev, '5/0/5', RESULT_INITIAL)
+        self.set(dev, '5/0/3', STATE_DOWNLOADING)
+
+    def execute(self, dev, path):
+        if path != '5/0/2' or dev.resources['5/0/3'] != STATE_DOWNLOADED:
+            return False
+        self.set(dev, '5/0/3', STATE_UPDATING)
+        dev.reboot_at = time.time() + self.args.reboot_time
+        return True
+
+    def tick(self):
+        now = time.time()
+        downloading = {}
+        for dev in self.devices.values():
+            if dev.resources['5/0/3'] == STATE_DOWNLOADING:
+                downloading.setdefault(dev.segment, []).append(dev)
+            if dev.reboot_at and now >= dev.reboot_at:
+                self.reboot(dev)
+
+        for devs in downloading.values():
+            # The segment's bandwidth is shared by its downloads.
+            share = self.args.segment_rate * TICK / len(devs)
+            for dev in devs:
+                dev.received += share
+                if random.random() < self.args.failure_rate * share / \
+                   self.args.image_size:
+                    self.set(dev, '5/0/5', RESULT_CONNECTION_LOST)
+                    self.set(dev, '5/0/3', STATE_IDLE)
+                elif dev.received >= self.args.image_size:
+                    self.set(dev, '5/0/3', STATE_DOWNLOADED)
+
+    def reboot(self, dev):
+        dev.reboot_at = None
+        dev.observed.clear()
+        self.emit('DEREGISTRATION', {'endpoint': dev.endpoint})
+        ok = random.random() >= self.args.failure_rate
+        dev.resources['5/0/3'] = STATE_IDLE
+        dev.resources['5/0/5'] = RESULT_SUCCESS if ok else RESULT_UPDATE_FAILED
+        self.emit('REGISTRATION', {'endpoint': dev.endpoint,
+                                   'address': dev.address})
+
+    def run(self):
+        while True:
+            time.sleep(TICK)
+            with self.lock:
+                self.tick()
+
+
+class Handler(BaseHTTPRequestHandler):
+    sim = None
+
+    def log_message(self, format, *args):
+        pass
+
+    def reply(self, code, payload=None):
+        body = json.dumps(payload).encode() if payload is not None else b''
+        self.send_response(code)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def route(self):
+        """Device and resource path of a /api/clients/... request."""
+        parts = self.path.strip('/').split('/')
+        if parts[:2] != ['api', 'clients'] or len(parts) < 3:
+            return None, None, False
+        observe = parts[-1] == 'observe'
+        if observe:
+            parts = parts[:-1]
+        return self.sim.devices.get(parts[2]), '/'.join(parts[3:]), observe
+
+    def content(self, dev, path):
+        if path not in dev.resources:
+            return {'status': 'NOT_FOUND', 'success': False}
+        return {'status': 'CONTENT', 'valid': True, 'success': True,
+                'content': {'id': int(path.split('/')[-1]),
+                            'value': dev.resources[path]}}
+
+    def do_GET(self):
+        sim = self.sim
+        if self.path == '/event':
+            return self.stream()
+        with sim.lock:
+            sim.requests += 1
+            if self.path.rstrip('/') == '/api/clients':
+                return self.reply(200, [
+                    {'endpoint': dev.endpoint, 'address': dev.address}
+                    for dev in sim.devices.values() if dev.registered])
+            dev, path, _ = self.route()
+            if not dev:
+                return self.reply(404)
+            self.reply(200, self.content(dev, path))
+
+    def do_PUT(self):
+        sim = self.sim
+        length = int(self.headers.get('Content-Length', 0))
+        data = json.loads(self.rfile.read(length) or b'{}')
+        with sim.lock:
+            sim.requests += 1
+            dev, path, _ = self.route()
+            if not dev:
+                return self.reply(404)
+            sim.write(dev, path, data.get('value'))
+            self.reply(200, {'status': 'CHANGED', 'success': True})
+
+    def do_POST(self):
+        sim = self.sim
+        self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        with sim.lock:
+            sim.requests += 1
+            dev, path, observe = self.route()
+            if not dev:
+                return self.reply(404)
+            if observe:
+                dev.observed.add(path)
+                return self.reply(200, self.content(dev, path))
+            if sim.execute(dev, path):
+                return self.reply(200, {'status': 'CHANGED',
+                                        'success': True})
+            self.reply(200, {'status': 'METHOD_NOT_ALLOWED',
+                             'success': False})
+
+    def stream(self):
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/event-stream')
+        self.end_headers()
+        events = self.sim.listen()
+        try:
+            while True:
+                self.wfile.write(events.get().encode())
+                self.wfile.flush()
+        except OSError:
+            pass
+        finally:
+            self.sim.unlisten(events)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Stand-in Leshan server with simulated devices')
+    parser.add_argument('-p', '--port', type=int, default=8080,
+                        help='HTTP port, or 0 for any free port '
+                        '(default: 8080)')
+    parser.add_argument('-n', '--devices', type=int, default=100,
+                        help='Number of devices (default: 100)')
+    parser.add_argument('--segments', type=int, default=4,
+                        help='Number of network segments, each an IPv6 '
+                        '/64 (default: 4)')
+    parser.add_argument('--image-size', type=int, default=256 * 1024,
+                        help='Firmware size in bytes (default: 262144)')
+    parser.add_argument('--segment-rate', type=int, default=64 * 1024,
+                        help='Bandwidth of a segment in bytes per second '
+                        '(default: 65536)')
+    parser.add_argument('--reboot-time', type=float, default=5,
+                        help='Seconds an update takes (default: 5)')
+    parser.add_argument('--failure-rate', type=float, default=0,
+                        help='Probability that a download or an update '
+                        'fails (default: 0)')
+    args = parser.parse_args()
+
+    sim = Simulator(args)
+    Handler.sim = sim
+    server = ThreadingHTTPServer(('', args.port), Handler)
+    server.daemon_threads = True
+    threading.Thread(target=sim.run, daemon=True).start()
+    print('%d devices in %d segments on port %d' %
+          (args.devices, args.segments, server.server_address[1]),
+          flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        print('%d REST requests served' % sim.requests)
+
+
+if __name__ == '__main__':
+    main()
@@ -7,47 +7,442 @@
  */
 
 /*
- * This file copies the work queue implementation from Zephyr, but
- * allows users to just start running the work queue on a desired
+ * This file is based on the work queue implementation from Zephyr,
+ * but allows users to just start running the work queue on a desired
  * thread.
  *
  * This is useful to avoid allocating two thread stacks if one thread
  * (in our case, the main thread) isn't using its stack for the
  * application's lifetime, and could be doing useful work instead.
  *
+ * Each lane is a k_work_q, so delayed work and other APIs taking a
+ * work queue keep working, but a thread handling several lanes waits
+ * on all of them with k_poll(), and always picks from the most
+ * urgent one first.
+ *
  * TODO: propose a more upstream-friendly way to support this.
  */
 
+#define LOG_MODULE_NAME fota_app_wq
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <string.h>
+#if defined(CONFIG_APP_WQ_STATS) && defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+#if defined(CONFIG_APP_WQ_STATS) && defined(CONFIG_INIT_STACKS)
+#include <misc/stack.h>
+#endif
+
 #include "app_work_queue.h"
 
-static struct k_work_q app_queue;
+struct k_work_q app_wq_lanes[APP_WQ_LANES];
 
-struct k_work_q *app_work_q = &app_queue;
+struct k_work_q *app_work_q = &app_wq_lanes[APP_WQ_BULK];
 
-void app_wq_init(void)
+#if defined(CONFIG_APP_WQ_BULK_THREAD)
+static K_THREAD_STACK_DEFINE(bulk_stack, CONFIG_APP_WQ_BULK_STACK_SIZE);
+static struct k_thread bulk_thread;
+#endif
+
+#if defined(CONFIG_APP_WQ_STATS)
+/*
+ * Longer delays aren't timed, as the cycle counter may wrap around
+ * before they expire.
+ */
+#define STAMP_DELAY_MAX_MS	10000
+
+/*
+ * Stamps are found by hashing the work item's address into a table
+ * with twice as many slots as there may be stamps, so a lookup takes
+ * one or two probes however many items are timed.
+ */
+#define STAMP_SLOTS	(2 * CONFIG_APP_WQ_STATS_ITEMS)
+
+/* When a work item was submitted, or is due. */
+struct wq_stamp {
+	struct k_work *work;
+	bool stamped;
+	u32_t due;
+};
+
+/* Statistics of a work handler or lane, in hardware cycles. */
+struct wq_stats {
+	k_work_handler_t handler;
+	u8_t lane;
+	u32_t runs;
+	/* Runs with a known wait. */
+	u32_t waits;
+	u64_t wait_sum;
+	u32_t wait_max;
+	u64_t run_sum;
+	u32_t run_max;
+	u32_t wait_hist[APP_WQ_HIST_BUCKETS];
+	u32_t run_hist[APP_WQ_HIST_BUCKETS];
+};
+
+static const char * const lane_names[] = {
+	[APP_WQ_URGENT] = "urgent",
+	[APP_WQ_BULK] = "bulk",
+};
+
+/* All of these are protected by irq_lock(). */
+static struct wq_stamp stamps[STAMP_SLOTS];
+static int stamp_count;
+static struct wq_stats handlers[CONFIG_APP_WQ_STATS_HANDLERS];
+static int handler_count;
+static struct wq_stats lanes[APP_WQ_LANES];
+
+/* Histogram bucket bounds, in hardware cycles. */
+static u32_t hist_bounds[APP_WQ_HIST_BUCKETS - 1];
+
+/* Must be called with interrupts locked. */
+static struct wq_stamp *stamp_get(struct k_work *work)
 {
-	k_queue_init(&app_work_q->queue);
+	/* Multiplicative hashing; the high bits are the well mixed ones. */
+	u32_t i = (((u32_t)(uintptr_t)work * 2654435761U) >> 16) %
+		STAMP_SLOTS;
+
+	/* Stamps are never removed, so the first free slot ends the probe. */
+	while (stamps[i].work) {
+		if (stamps[i].work == work) {
+			return &stamps[i];
+		}
+
+		i = (i + 1) % STAMP_SLOTS;
+	}
+
+	/* Keep the table at most half full. */
+	if (stamp_count == CONFIG_APP_WQ_STATS_ITEMS) {
+		return NULL;
+	}
+
+	stamp_count++;
+	stamps[i].work = work;
+	return &stamps[i];
 }
 
-void app_wq_run(void)
+/* Must be called with interrupts locked. */
+static struct wq_stats *handler_get(k_work_handler_t handler)
+{
+	int i;
+
+	for (i = 0; i < handler_count; i++) {
+		if (handlers[i].handler == handler) {
+			return &handlers[i];
+		}
+	}
+
+	if (handler_count == ARRAY_SIZE(handlers)) {
+		return NULL;
+	}
+
+	handlers[handler_count].handler = handler;
+	return &handlers[handler_count++];
+}
+
+void app_wq_stamp(struct k_work *work, s32_t delay_ms)
+{
+	u32_t now = k_cycle_get_32();
+	struct wq_stamp *stamp;
+	unsigned int key;
+
+	key = irq_lock();
+	stamp = stamp_get(work);
+	/* Work already pending keeps waiting since it was submitted. */
+	if (stamp && (delay_ms || !k_work_pending(work))) {
+		stamp->stamped = delay_ms <= STAMP_DELAY_MAX_MS;
+		stamp->due = now + (u64_t)delay_ms *
+			sys_clock_hw_cycles_per_sec() / MSEC_PER_SEC;
+	}
+	irq_unlock(key);
+}
+
+static void hist_add(u32_t *hist, u32_t cycles)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hist_bounds); i++) {
+		if (cycles < hist_bounds[i]) {
+			break;
+		}
+	}
+
+	hist[i]++;
+}
+
+/* Must be called with interrupts locked. */
+static void stats_add(struct wq_stats *stats, bool waited, u32_t wait,
+		      u32_t run)
 {
+	stats->runs++;
+	stats->run_sum += run;
+	stats->run_max = MAX(stats->run_max, run);
+	hist_add(stats->run_hist, run);
+	if (waited) {
+		stats->waits++;
+		stats->wait_sum += wait;
+		stats->wait_max = MAX(stats->wait_max, wait);
+		hist_add(stats->wait_hist, wait);
+	}
+}
+
+static void work_run(enum app_wq_lane lane, struct k_work *work)
+{
+	k_work_handler_t handler = work->handler;
+	struct wq_stamp *stamp;
+	struct wq_stats *stats;
+	bool waited = false;
+	u32_t start, run, wait = 0U;
+	unsigned int key;
+
+	key = irq_lock();
+	start = k_cycle_get_32();
+	stamp = stamp_get(work);
+	if (stamp && stamp->stamped) {
+		/* Expiring timers may be a tick early. */
+		wait = MAX(0, (s32_t)(start - stamp->due));
+		waited = true;
+		stamp->stamped = false;
+	}
+	irq_unlock(key);
+
+	/* Reset pending state so it can be resubmitted by handler */
+	if (!atomic_test_and_clear_bit(work->flags, K_WORK_STATE_PENDING)) {
+		return;
+	}
+
+	handler(work);
+	run = k_cycle_get_32() - start;
+
+	key = irq_lock();
+	stats = handler_get(handler);
+	if (stats) {
+		stats->lane = lane;
+		stats_add(stats, waited, wait, run);
+	}
+	stats_add(&lanes[lane], waited, wait, run);
+	irq_unlock(key);
+}
+
+static u32_t cycles_to_us(u64_t cycles)
+{
+	return cycles * USEC_PER_SEC / sys_clock_hw_cycles_per_sec();
+}
+
+static void stats_get(const struct wq_stats *stats, struct app_wq_stats *out)
+{
+	struct wq_stats copy;
+	unsigned int key;
+
+	key = irq_lock();
+	copy = *stats;
+	irq_unlock(key);
+
+	out->handler = copy.handler;
+	out->lane = copy.lane;
+	out->runs = copy.runs;
+	out->wait_avg_us = copy.waits ?
+		cycles_to_us(copy.wait_sum / copy.waits) : 0U;
+	out->wait_max_us = cycles_to_us(copy.wait_max);
+	out->run_avg_us = copy.runs ?
+		cycles_to_us(copy.run_sum / copy.runs) : 0U;
+	out->run_max_us = cycles_to_us(copy.run_max);
+	memcpy(out->wait_hist, copy.wait_hist, sizeof(out->wait_hist));
+	memcpy(out->run_hist, copy.run_hist, sizeof(out->run_hist));
+}
+
+void app_wq_lane_stats_get(enum app_wq_lane lane,
+			   struct app_wq_stats *stats)
+{
+	stats_get(&lanes[lane], stats);
+	stats->handler = NULL;
+	stats->lane = lane;
+}
+
+int app_wq_handler_stats_get(int index, struct app_wq_stats *stats)
+{
+	if (index < 0 || index >= handler_count) {
+		return -ENOENT;
+	}
+
+	stats_get(&handlers[index], stats);
+
+	return 0;
+}
+
+void app_wq_stats_reset(void)
+{
+	unsigned int key;
+	int i;
+
+	key = irq_lock();
+	for (i = 0; i < handler_count; i++) {
+		memset(&handlers[i].runs, 0,
+		       sizeof(handlers[i]) -
+		       offsetof(struct wq_stats, runs));
+	}
+	memset(lanes, 0, sizeof(lanes));
+	irq_unlock(key);
+}
+
+void app_wq_stats_log(void)
+{
+	struct app_wq_stats stats;
+	int i;
+
+	for (i = 0; i < APP_WQ_LANES; i++) {
+		app_wq_lane_stats_get(i, &stats);
+		LOG_INF("%s lane: %u runs, wait avg %u max %u us, "
+			"run avg %u max %u us", lane_names[i], stats.runs,
+			stats.wait_avg_us, stats.wait_max_us,
+			stats.run_avg_us, stats.run_max_us);
+	}
+
+	for (i = 0; !app_wq_handler_stats_get(i, &stats); i++) {
+		LOG_INF("  %p (%s): %u runs, wait avg %u max %u us, "
+			"run avg %u max %u us", stats.handler,
+			lane_names[stats.lane], stats.runs,
+			stats.wait_avg_us, stats.wait_max_us,
+			stats.run_avg_us, stats.run_max_us);
+	}
+
+#if defined(CONFIG_APP_WQ_BULK_THREAD) && defined(CONFIG_INIT_STACKS)
+	/* Its deepest path depends on the firmware update options. */
+	STACK_ANALYZE("bulk lane", bulk_stack);
+#endif
+}
+
+static void stats_init(void)
+{
+	u32_t hz = sys_clock_hw_cycles_per_sec();
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hist_bounds); i++) {
+		hist_bounds[i] = (u64_t)APP_WQ_HIST_BOUND_US(i) * hz /
+			USEC_PER_SEC;
+	}
+}
+
+#if defined(CONFIG_SHELL)
+static void shell_hist(const struct shell *shell, const char *name,
+		       const u32_t *hist)
+{
+	char line[APP_WQ_HIST_BUCKETS * 11 + 1];
+	size_t off = 0;
+	int i;
+
+	for (i = 0; i < APP_WQ_HIST_BUCKETS; i++) {
+		off += snprintk(line + off, sizeof(line) - off, " %u",
+				hist[i]);
+	}
+
+	shell_print(shell, "    %s:%s", name, line);
+}
+
+static void shell_stats(const struct shell *shell,
+			const struct app_wq_stats *stats, const char *name)
+{
+	shell_print(shell, "%s (%s lane): %u runs", name,
+		    lane_names[stats->lane], stats->runs);
+	shell_print(shell, "    wait avg %u max %u us, run avg %u max %u us",
+		    stats->wait_avg_us, stats->wait_max_us,
+		    stats->run_avg_us, stats->run_max_us);
+	shell_hist(shell, "wait", stats->wait_hist);
+	shell_hist(shell, "run ", stats->run_hist);
+}
+
+static int cmd_wq_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct app_wq_stats stats;
+	char name[sizeof("0x12345678")];
+	int i;
+
+	shell_print(shell, "Histogram buckets (us): <16 <64 <256 <1k <4k "
+		    "<16k <64k <256k <1M more");
+
+	for (i = 0; i < APP_WQ_LANES; i++) {
+		app_wq_lane_stats_get(i, &stats);
+		shell_stats(shell, &stats, "all");
+	}
+
+	for (i = 0; !app_wq_handler_stats_get(i, &stats); i++) {
+		snprintk(name, sizeof(name), "%p", stats.handler);
+		shell_stats(shell, &stats, name);
+	}
+
+	return 0;
+}
+
+static int cmd_wq_reset(const struct shell *shell, size_t argc, char **argv)
+{
+	app_wq_stats_reset();
+	shell_print(shell, "Work queue statistics cleared");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_wq,
+	SHELL_CMD(stats, NULL, "Show work queue latency statistics",
+		  cmd_wq_stats),
+	SHELL_CMD(reset, NULL, "Clear work queue latency statistics",
+		  cmd_wq_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(wq, &sub_wq, "Application work queue commands", NULL);
+#endif /* CONFIG_SHELL */
+#else
+static void work_run(enum app_wq_lane lane, struct k_work *work)
+{
+	k_work_handler_t handler = work->handler;
+
+	/* Reset pending state so it can be resubmitted by handler */
+	if (atomic_test_and_clear_bit(work->flags, K_WORK_STATE_PENDING)) {
+		handler(work);
+	}
+}
+
+static inline void stats_init(void)
+{
+}
+#endif /* CONFIG_APP_WQ_STATS */
+
+/* Handle the count lanes from first on, most urgent first. */
+static FUNC_NORETURN void lanes_run(int first, int count)
+{
+	struct k_poll_event events[APP_WQ_LANES];
+	struct k_work *work;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		k_poll_event_init(&events[i], K_POLL_TYPE_DATA_AVAILABLE,
+				  K_POLL_MODE_NOTIFY_ONLY,
+				  &app_wq_lanes[first + i].queue);
+	}
+
 	while (1) {
-		struct k_work *work;
-		k_work_handler_t handler;
+		work = NULL;
+		for (i = 0; i < count; i++) {
+			work = k_queue_get(&app_wq_lanes[first + i].queue,
+					   K_NO_WAIT);
+			if (work) {
+				break;
+			}
+		}
 
-		work = k_queue_get(&app_work_q->queue, K_FOREVER);
 		if (!work) {
-			k_yield();
+			(void)k_poll(events, count, K_FOREVER);
+			for (i = 0; i < count; i++) {
+				events[i].state = K_POLL_STATE_NOT_READY;
+			}
 			continue;
 		}
 
-		handler = work->handler;
-
-		/* Reset pending state so it can be resubmitted by handler */
-		if (atomic_test_and_clear_bit(work->flags,
-					       K_WORK_STATE_PENDING)) {
-			handler(work);
-		}
+		work_run(first + i, work);
 
 		/* Make sure we don't hog up the CPU if the QUEUE never (or
 		 * very rarely) gets empty.
@@ -55,3 +450,37 @@ void app_wq_run(void)
 		k_yield();
 	}
 }
+
+#if defined(CONFIG_APP_WQ_BULK_THREAD)
+static void bulk_thread_main(void *p1, void *p2, void *p3)
+{
+	lanes_run(APP_WQ_BULK, 1);
+}
+#endif
+
+void app_wq_init(void)
+{
+	int i;
+
+	for (i = 0; i < APP_WQ_LANES; i++) {
+		k_queue_init(&app_wq_lanes[i].queue);
+	}
+
+	stats_init();
+}
+
+void app_wq_run(void)
+{
+#if defined(CONFIG_APP_WQ_BULK_THREAD)
+	k_thread_create(&bulk_thread, bulk_stack,
+			K_THREAD_STACK_SIZEOF(bulk_stack),
+			bulk_thread_main, NULL, NULL, NULL,
+			K_PRIO_PREEMPT(CONFIG_APP_WQ_BULK_THREAD_PRIO),
+			0, K_NO_WAIT);
+
+	/* The bulk lane is the last one. */
+	lanes_run(0, APP_WQ_BULK);
+#else
+	lanes_run(0, APP_WQ_LANES);
+#endif
+}
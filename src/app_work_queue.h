@@ -11,12 +11,19 @@
  * @file
  * @brief FOTA application work queue
  *
- * This is a single work queue which can be used for sleeping tasks
- * within this application. It is primarily intended to schedule work
- * items which must run sequentially from different application-level
- * threads.
+ * The application's work is split into lanes, each a work queue of
+ * its own. Whichever thread handles a lane always takes work from
+ * the most urgent of its lanes which has any, so light output never
+ * waits behind work which merely happened to be submitted first.
  *
- * Work handlers submitted to this queue may sleep or yield.
+ * The bulk lane can get a thread of its own
+ * (CONFIG_APP_WQ_BULK_THREAD), so its handlers may sleep or take
+ * long without delaying urgent work, which runs on the thread that
+ * calls app_wq_run(). Handlers on different lanes may then run at the
+ * same time. Work items on the same lane always run sequentially.
+ *
+ * Urgent handlers must be short, and must not sleep on anything but
+ * briefly held locks.
  *
  * Work may be submitted to this queue only by threads started from
  * main().
@@ -25,9 +32,21 @@
 #include <zephyr.h>
 #include <zephyr/types.h>
 
+enum app_wq_lane {
+	/* Light output and anything else a user would notice waiting. */
+	APP_WQ_URGENT,
+	/* Everything else, like flash writes and test reporting. */
+	APP_WQ_BULK,
+
+	APP_WQ_LANES,
+};
+
+/* The lanes' work queues, which can be passed along to other APIs. */
+extern struct k_work_q app_wq_lanes[APP_WQ_LANES];
+
 /*
- * This is the work queue itself, which can be passed along to other
- * APIs which submit work.
+ * The bulk lane, where work goes unless said otherwise, which can be
+ * passed along to other APIs which submit work.
  */
 extern struct k_work_q *app_work_q;
 
@@ -45,25 +64,120 @@ void app_wq_init(void);
  * @brief Start handling work queue events in the current thread.
  *
  * Unlike k_work_q_start(), this does not create a new thread;
- * instead, it runs in the caller's.
+ * instead, it runs in the caller's, handling every lane without a
+ * thread of its own.
  *
  * @see k_work_q_start()
  */
 FUNC_NORETURN
 void app_wq_run(void);
 
+#if defined(CONFIG_APP_WQ_STATS)
+/*
+ * Wait and run times are counted in histograms of this many buckets.
+ * Bucket i counts times under APP_WQ_HIST_BOUND_US(i) microseconds,
+ * and not in an earlier bucket; the last one counts all longer times.
+ */
+#define APP_WQ_HIST_BUCKETS	10
+#define APP_WQ_HIST_BOUND_US(i)	(16U << (2 * (i)))
+
+struct app_wq_stats {
+	/* The work handler, or NULL for a whole lane. */
+	k_work_handler_t handler;
+	u8_t lane;
+	u32_t runs;
+	/* Time from submission, or expiry, to start, in microseconds. */
+	u32_t wait_avg_us;
+	u32_t wait_max_us;
+	/* Time the handler ran for, in microseconds. */
+	u32_t run_avg_us;
+	u32_t run_max_us;
+	u32_t wait_hist[APP_WQ_HIST_BUCKETS];
+	u32_t run_hist[APP_WQ_HIST_BUCKETS];
+};
+
+/* Called on submission, to time how long the work waits. */
+void app_wq_stamp(struct k_work *work, s32_t delay_ms);
+
+/**
+ * @brief Get the statistics of a lane.
+ */
+void app_wq_lane_stats_get(enum app_wq_lane lane,
+			   struct app_wq_stats *stats);
+
+/**
+ * @brief Get the statistics of a work handler.
+ *
+ * Work items with the same handler, like those of each light, are
+ * counted together. Handlers are numbered from 0 in the order they
+ * first ran.
+ *
+ * @return 0 on success, -ENOENT past the last handler.
+ */
+int app_wq_handler_stats_get(int index, struct app_wq_stats *stats);
+
+/**
+ * @brief Clear the statistics of all lanes and handlers.
+ */
+void app_wq_stats_reset(void);
+
+/**
+ * @brief Log a summary of the statistics of all lanes and handlers.
+ */
+void app_wq_stats_log(void);
+#else
+static inline void app_wq_stamp(struct k_work *work, s32_t delay_ms)
+{
+}
+
+static inline void app_wq_stats_log(void)
+{
+}
+#endif
+
+/**
+ * @brief Submit work to a lane of the application work queue.
+ * @param lane Lane to submit to
+ * @param work Work to submit
+ * @see k_work_submit_to_queue()
+ */
+static inline void app_wq_submit_to(enum app_wq_lane lane,
+				    struct k_work *work)
+{
+	app_wq_stamp(work, 0);
+	k_work_submit_to_queue(&app_wq_lanes[lane], work);
+}
+
+/**
+ * @brief Submit delayed work to a lane of the application work queue.
+ * @param lane     Lane to submit to
+ * @param work     Work to submit
+ * @param delay_ms Delay in milliseconds
+ * @return k_delayed_work_submit_to_queue() return value.
+ * @see k_delayed_work_submit_to_queue()
+ */
+static inline int app_wq_submit_delayed_to(enum app_wq_lane lane,
+					   struct k_delayed_work *work,
+					   s32_t delay_ms)
+{
+	app_wq_stamp(&work->work, delay_ms);
+	return k_delayed_work_submit_to_queue(&app_wq_lanes[lane], work,
+					      delay_ms);
+}
+
 /**
- * @brief Submit work to the application work queue thread.
+ * @brief Submit work to the bulk lane of the application work queue.
  * @param work Work to submit
  * @see k_work_submit_to_queue()
  */
 static inline void app_wq_submit(struct k_work *work)
 {
-	k_work_submit_to_queue(app_work_q, work);
+	app_wq_submit_to(APP_WQ_BULK, work);
 }
 
 /**
- * @brief Submit delayed work to the application work queue thread.
+ * @brief Submit delayed work to the bulk lane of the application work
+ * queue.
  * @param work     Work to submit
  * @param delay_ms Delay in milliseconds
  * @return k_delayed_work_submit_to_queue() return value.
@@ -72,7 +186,7 @@ static inline void app_wq_submit(struct k_work *work)
 static inline int app_wq_submit_delayed(struct k_delayed_work *work,
 					s32_t delay_ms)
 {
-	return k_delayed_work_submit_to_queue(app_work_q, work, delay_ms);
+	return app_wq_submit_delayed_to(APP_WQ_BULK, work, delay_ms);
 }
 
 #endif /* FOTA_APP_WORK_QUEUE_H__ */
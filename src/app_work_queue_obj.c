@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Vendor LwM2M object reporting work queue latency statistics.
+ *
+ * Instance N describes lane N of the application work queue, so the
+ * server can tell how long work waits to run, and which handlers make
+ * it wait. Times are in microseconds. Histograms are opaque arrays of
+ * APP_WQ_HIST_BUCKETS little-endian u32 counts; see
+ * app_work_queue.h for their buckets.
+ *
+ * The handlers resource holds a record for each handler which ran on
+ * the lane, all little endian: its address, as a u32, then its runs,
+ * average and longest wait, and average and longest run time, as u32,
+ * then its wait and run histograms, as u16 counts which stop at
+ * 65535. Addresses can be resolved with the firmware's ELF file.
+ */
+
+#define LOG_MODULE_NAME fota_app_wq_obj
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <init.h>
+#include <misc/byteorder.h>
+
+#include "app_work_queue.h"
+#include "lwm2m_object.h"
+#include "lwm2m_vendor.h"
+
+/* resource IDs */
+#define WQ_STATS_RUNS_ID		0
+#define WQ_STATS_WAIT_AVG_ID		1
+#define WQ_STATS_WAIT_MAX_ID		2
+#define WQ_STATS_RUN_AVG_ID		3
+#define WQ_STATS_RUN_MAX_ID		4
+#define WQ_STATS_WAIT_HIST_ID		5
+#define WQ_STATS_RUN_HIST_ID		6
+#define WQ_STATS_HANDLERS_ID		7
+#define WQ_STATS_RESET_ID		8
+
+#define WQ_STATS_MAX_ID			9
+
+#define HIST_LEN		(APP_WQ_HIST_BUCKETS * sizeof(u32_t))
+#define HANDLER_RECORD_LEN	(6 * sizeof(u32_t) + \
+				 2 * APP_WQ_HIST_BUCKETS * sizeof(u16_t))
+
+/* resource state variables */
+static struct app_wq_stats stats[APP_WQ_LANES];
+/* Opaque resources are assembled here when read. */
+static u8_t hist_buf[HIST_LEN];
+static u8_t handlers_buf[CONFIG_APP_WQ_STATS_HANDLERS * HANDLER_RECORD_LEN];
+
+static struct lwm2m_engine_obj wq_stats;
+static struct lwm2m_engine_obj_field fields[] = {
+	OBJ_FIELD_DATA(WQ_STATS_RUNS_ID, R, U32),
+	OBJ_FIELD_DATA(WQ_STATS_WAIT_AVG_ID, R, U32),
+	OBJ_FIELD_DATA(WQ_STATS_WAIT_MAX_ID, R, U32),
+	OBJ_FIELD_DATA(WQ_STATS_RUN_AVG_ID, R, U32),
+	OBJ_FIELD_DATA(WQ_STATS_RUN_MAX_ID, R, U32),
+	OBJ_FIELD_DATA(WQ_STATS_WAIT_HIST_ID, R, OPAQUE),
+	OBJ_FIELD_DATA(WQ_STATS_RUN_HIST_ID, R, OPAQUE),
+	OBJ_FIELD_DATA(WQ_STATS_HANDLERS_ID, R, OPAQUE),
+	OBJ_FIELD_EXECUTE(WQ_STATS_RESET_ID),
+};
+
+static struct lwm2m_engine_obj_inst inst[APP_WQ_LANES];
+static struct lwm2m_engine_res_inst res[APP_WQ_LANES][WQ_STATS_MAX_ID];
+
+/*
+ * Read callbacks aren't told which resource is read, so there is one
+ * for each; they all refresh every statistic of the lane.
+ */
+#define STATS_READ_CB(field)						\
+	static void *read_##field(u16_t obj_inst_id, size_t *data_len)	\
+	{								\
+		app_wq_lane_stats_get(obj_inst_id, &stats[obj_inst_id]); \
+		*data_len = sizeof(stats[obj_inst_id].field);		\
+		return &stats[obj_inst_id].field;			\
+	}
+
+STATS_READ_CB(runs)
+STATS_READ_CB(wait_avg_us)
+STATS_READ_CB(wait_max_us)
+STATS_READ_CB(run_avg_us)
+STATS_READ_CB(run_max_us)
+
+static void *hist_read(const u32_t *hist, size_t *data_len)
+{
+	int i;
+
+	for (i = 0; i < APP_WQ_HIST_BUCKETS; i++) {
+		sys_put_le32(hist[i], &hist_buf[i * sizeof(u32_t)]);
+	}
+
+	*data_len = sizeof(hist_buf);
+	return hist_buf;
+}
+
+static void *read_wait_hist(u16_t obj_inst_id, size_t *data_len)
+{
+	app_wq_lane_stats_get(obj_inst_id, &stats[obj_inst_id]);
+	return hist_read(stats[obj_inst_id].wait_hist, data_len);
+}
+
+static void *read_run_hist(u16_t obj_inst_id, size_t *data_len)
+{
+	app_wq_lane_stats_get(obj_inst_id, &stats[obj_inst_id]);
+	return hist_read(stats[obj_inst_id].run_hist, data_len);
+}
+
+static u8_t *put_hist16(u8_t *pos, const u32_t *hist)
+{
+	int i;
+
+	for (i = 0; i < APP_WQ_HIST_BUCKETS; i++) {
+		sys_put_le16(MIN(hist[i], 0xffff), pos);
+		pos += sizeof(u16_t);
+	}
+
+	return pos;
+}
+
+static void *read_handlers(u16_t obj_inst_id, size_t *data_len)
+{
+	struct app_wq_stats hs;
+	u8_t *pos = handlers_buf;
+	int i;
+
+	for (i = 0; !app_wq_handler_stats_get(i, &hs); i++) {
+		if (hs.lane != obj_inst_id || !hs.runs) {
+			continue;
+		}
+
+		sys_put_le32((u32_t)(uintptr_t)hs.handler, pos);
+		sys_put_le32(hs.runs, pos + 4);
+		sys_put_le32(hs.wait_avg_us, pos + 8);
+		sys_put_le32(hs.wait_max_us, pos + 12);
+		sys_put_le32(hs.run_avg_us, pos + 16);
+		sys_put_le32(hs.run_max_us, pos + 20);
+		pos = put_hist16(pos + 24, hs.wait_hist);
+		pos = put_hist16(pos, hs.run_hist);
+	}
+
+	*data_len = pos - handlers_buf;
+	return handlers_buf;
+}
+
+static int reset_cb(u16_t obj_inst_id)
+{
+	app_wq_stats_reset();
+	return 0;
+}
+
+#define INIT_STATS_RES(res_var, index_var, id_val, field, lane)	\
+	INIT_OBJ_RES(res_var, index_var, id_val, NULL,			\
+		     &stats[lane].field, sizeof(stats[lane].field),	\
+		     read_##field, NULL, NULL, NULL)
+
+static struct lwm2m_engine_obj_inst *wq_stats_create(u16_t obj_inst_id)
+{
+	struct lwm2m_engine_res_inst *r;
+	int i = 0;
+
+	if (obj_inst_id >= APP_WQ_LANES) {
+		LOG_ERR("Can not create instance - "
+			"no such lane: %u", obj_inst_id);
+		return NULL;
+	}
+
+	if (inst[obj_inst_id].obj) {
+		LOG_ERR("Can not create instance - "
+			"already existing: %u", obj_inst_id);
+		return NULL;
+	}
+
+	r = res[obj_inst_id];
+	(void)memset(r, 0, sizeof(res[0]));
+
+	/* initialize instance resource data */
+	INIT_STATS_RES(r, i, WQ_STATS_RUNS_ID, runs, obj_inst_id);
+	INIT_STATS_RES(r, i, WQ_STATS_WAIT_AVG_ID, wait_avg_us, obj_inst_id);
+	INIT_STATS_RES(r, i, WQ_STATS_WAIT_MAX_ID, wait_max_us, obj_inst_id);
+	INIT_STATS_RES(r, i, WQ_STATS_RUN_AVG_ID, run_avg_us, obj_inst_id);
+	INIT_STATS_RES(r, i, WQ_STATS_RUN_MAX_ID, run_max_us, obj_inst_id);
+	INIT_OBJ_RES(r, i, WQ_STATS_WAIT_HIST_ID, NULL, hist_buf,
+		     sizeof(hist_buf), read_wait_hist, NULL, NULL, NULL);
+	INIT_OBJ_RES(r, i, WQ_STATS_RUN_HIST_ID, NULL, hist_buf,
+		     sizeof(hist_buf), read_run_hist, NULL, NULL, NULL);
+	INIT_OBJ_RES(r, i, WQ_STATS_HANDLERS_ID, NULL, handlers_buf,
+		     sizeof(handlers_buf), read_handlers, NULL, NULL, NULL);
+	INIT_OBJ_RES_EXECUTE(r, i, WQ_STATS_RESET_ID, reset_cb);
+
+	inst[obj_inst_id].resources = r;
+	inst[obj_inst_id].resource_count = i;
+	LOG_DBG("Create work queue statistics instance: %d", obj_inst_id);
+	return &inst[obj_inst_id];
+}
+
+static int wq_stats_init(struct device *dev)
+{
+	wq_stats.obj_id = LWM2M_OBJECT_WQ_STATS_ID;
+	wq_stats.fields = fields;
+	wq_stats.field_count = ARRAY_SIZE(fields);
+	wq_stats.max_instance_count = APP_WQ_LANES;
+	wq_stats.create_cb = wq_stats_create;
+	lwm2m_register_obj(&wq_stats);
+
+	return 0;
+}
+
+SYS_INIT(wq_stats_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
@@ -30,6 +30,7 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #include "product_id.h"
 #include "light_control.h"
+#include "persist.h"
 
 #define LIGHT_FLASH_DURATION K_MSEC(200)
 
@@ -101,6 +102,9 @@ static void disconnected(struct bt_conn *conn, u8_t reason)
 	LOG_ERR("BT LE Disconnected (reason %u), rebooting!", reason);
 	light_control_flash(0xff, 0x00, 0x00, LIGHT_FLASH_DURATION);
 	set_bluetooth_led(0);
+	/* Flashing is asynchronous; keep the color up until we reboot. */
+	k_sleep(LIGHT_FLASH_DURATION);
+	persist_flush_before_reboot();
 	LOG_PANIC();
 	sys_reboot(0);
 }
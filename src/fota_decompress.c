@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_decompress
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <misc/byteorder.h>
+#include <string.h>
+
+#include "fota_decompress.h"
+
+#define HEADER_LEN		12
+#define MIN_WINDOW_BITS		4
+#define MIN_LOOKAHEAD_BITS	3
+
+#define WINDOW_MASK		(FOTA_DECOMPRESS_WINDOW_SIZE - 1)
+
+static int fail(struct fota_decompress *d, const char *what)
+{
+	LOG_ERR("Invalid compressed data at offset 0x%x: %s", d->pos, what);
+	return -EINVAL;
+}
+
+static int flush(struct fota_decompress *d)
+{
+	int ret;
+
+	if (d->head == d->flushed) {
+		return 0;
+	}
+
+	ret = d->out(d->window + d->flushed, d->head - d->flushed);
+	d->flushed = d->head;
+
+	return ret;
+}
+
+static int put(struct fota_decompress *d, u8_t c)
+{
+	int ret;
+
+	d->window[d->head++] = c;
+	d->pos++;
+
+	if (d->head == sizeof(d->window)) {
+		ret = flush(d);
+		d->head = 0U;
+		d->flushed = 0U;
+		return ret;
+	}
+
+	return 0;
+}
+
+static bool get_bits(struct fota_decompress *d, u8_t count, u16_t *value)
+{
+	if (d->bit_count < count) {
+		return false;
+	}
+
+	d->bit_count -= count;
+	*value = (d->bits >> d->bit_count) & (BIT(count) - 1);
+
+	return true;
+}
+
+static int parse_header(struct fota_decompress *d)
+{
+	const u8_t *h = d->header;
+
+	if (memcmp(h, FOTA_DECOMPRESS_MAGIC, 4)) {
+		return fail(d, "bad magic");
+	}
+
+	d->window_bits = h[4];
+	d->lookahead_bits = h[5];
+	d->size = sys_get_le32(h + 8);
+
+	if (d->window_bits < MIN_WINDOW_BITS ||
+	    d->window_bits > CONFIG_FOTA_DECOMPRESS_WINDOW_BITS ||
+	    d->lookahead_bits < MIN_LOOKAHEAD_BITS ||
+	    d->lookahead_bits >= d->window_bits) {
+		LOG_ERR("Unsupported window (%u bits) or lookahead (%u bits)",
+			d->window_bits, d->lookahead_bits);
+		return -ENOTSUP;
+	}
+
+	if (sys_get_le16(h + 6)) {
+		return fail(d, "reserved field set");
+	}
+
+	if (!d->size) {
+		return fail(d, "empty");
+	}
+
+	LOG_INF("Compressed download: %u bytes, %u byte window", d->size,
+		(unsigned int)BIT(d->window_bits));
+
+	d->state = FOTA_DECOMPRESS_TAG;
+	return 0;
+}
+
+/* Decode as much as the buffered bits allow. */
+static int decode(struct fota_decompress *d)
+{
+	u16_t value, i;
+	int ret;
+
+	for (;;) {
+		switch (d->state) {
+		case FOTA_DECOMPRESS_TAG:
+			if (!get_bits(d, 1, &value)) {
+				return 0;
+			}
+
+			d->state = value ? FOTA_DECOMPRESS_LITERAL :
+				FOTA_DECOMPRESS_DISTANCE;
+			break;
+		case FOTA_DECOMPRESS_LITERAL:
+			if (!get_bits(d, 8, &value)) {
+				return 0;
+			}
+
+			ret = put(d, value);
+			if (ret) {
+				return ret;
+			}
+
+			d->state = d->pos == d->size ?
+				FOTA_DECOMPRESS_DONE : FOTA_DECOMPRESS_TAG;
+			break;
+		case FOTA_DECOMPRESS_DISTANCE:
+			if (!get_bits(d, d->window_bits, &value)) {
+				return 0;
+			}
+
+			d->distance = value + 1;
+			if (d->distance > d->pos) {
+				return fail(d, "reference before start");
+			}
+
+			d->state = FOTA_DECOMPRESS_LENGTH;
+			break;
+		case FOTA_DECOMPRESS_LENGTH:
+			if (!get_bits(d, d->lookahead_bits, &value)) {
+				return 0;
+			}
+
+			if (value + 1 > d->size - d->pos) {
+				return fail(d, "reference past end");
+			}
+
+			for (i = 0U; i <= value; i++) {
+				ret = put(d, d->window[(d->head - d->distance) &
+						       WINDOW_MASK]);
+				if (ret) {
+					return ret;
+				}
+			}
+
+			d->state = d->pos == d->size ?
+				FOTA_DECOMPRESS_DONE : FOTA_DECOMPRESS_TAG;
+			break;
+		default:
+			return 0;
+		}
+	}
+}
+
+bool fota_decompress_is_compressed(const u8_t *data, size_t len)
+{
+	return len >= 4 && !memcmp(data, FOTA_DECOMPRESS_MAGIC, 4);
+}
+
+void fota_decompress_start(struct fota_decompress *d,
+			   fota_decompress_out_t out)
+{
+	/* The window doesn't need clearing. */
+	memset(d, 0, offsetof(struct fota_decompress, window));
+	d->out = out;
+	d->state = FOTA_DECOMPRESS_HEADER;
+}
+
+int fota_decompress_write(struct fota_decompress *d, const u8_t *data,
+			  size_t len)
+{
+	int ret = 0;
+
+	for (; len && !ret; data++, len--) {
+		switch (d->state) {
+		case FOTA_DECOMPRESS_HEADER:
+			d->header[d->header_len++] = *data;
+			if (d->header_len == HEADER_LEN) {
+				ret = parse_header(d);
+			}
+			break;
+		case FOTA_DECOMPRESS_DONE:
+			return fail(d, "data after end");
+		default:
+			d->bits = (d->bits << 8) | *data;
+			d->bit_count += 8;
+			ret = decode(d);
+			break;
+		}
+	}
+
+	return ret;
+}
+
+int fota_decompress_finish(struct fota_decompress *d)
+{
+	if (d->state != FOTA_DECOMPRESS_DONE) {
+		return fail(d, "truncated");
+	}
+
+	return flush(d);
+}
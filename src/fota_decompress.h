@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_DECOMPRESS_H__
+#define FOTA_DECOMPRESS_H__
+
+/**
+ * @file
+ * @brief Streaming decompression of firmware downloads.
+ *
+ * Compressed downloads use heatshrink's LZSS encoding, with a small
+ * container header. All values are little endian:
+ *
+ *   magic          "FHS1"
+ *   window_bits    u8, log2 of the window size
+ *   lookahead_bits u8, log2 of the longest back-reference
+ *   reserved       u16, zero
+ *   size           u32, size of the decompressed data
+ *
+ * followed by a bit stream, most significant bit first, of:
+ *
+ *   1, byte (8 bits)                         a literal byte
+ *   0, distance - 1 (window_bits bits),      a copy of earlier output
+ *      length - 1 (lookahead_bits bits)
+ *
+ * until size bytes have been produced, padded to a whole byte. The
+ * window is also where output is collected, so the whole decoder
+ * takes a fixed 2^CONFIG_FOTA_DECOMPRESS_WINDOW_BITS bytes plus a
+ * few fields. Compressed downloads are made by
+ * scripts/gen_compressed_image.py.
+ */
+
+#include <zephyr/types.h>
+
+#define FOTA_DECOMPRESS_MAGIC "FHS1"
+
+#define FOTA_DECOMPRESS_WINDOW_SIZE (1 << CONFIG_FOTA_DECOMPRESS_WINDOW_BITS)
+
+/* Consumer of the decompressed data. */
+typedef int (*fota_decompress_out_t)(const u8_t *data, size_t len);
+
+enum fota_decompress_state {
+	FOTA_DECOMPRESS_HEADER,
+	FOTA_DECOMPRESS_TAG,
+	FOTA_DECOMPRESS_LITERAL,
+	FOTA_DECOMPRESS_DISTANCE,
+	FOTA_DECOMPRESS_LENGTH,
+	FOTA_DECOMPRESS_DONE,
+};
+
+struct fota_decompress {
+	fota_decompress_out_t out;
+	enum fota_decompress_state state;
+
+	/* Header being collected. */
+	u8_t header[12];
+	u8_t header_len;
+
+	u8_t window_bits;
+	u8_t lookahead_bits;
+	u32_t size;
+	/* Bytes produced so far. */
+	u32_t pos;
+
+	/* Input bits not decoded yet, in the low bit_count bits. */
+	u32_t bits;
+	u8_t bit_count;
+	u16_t distance;
+
+	/* Next byte of the window, and first one not passed to out. */
+	u16_t head;
+	u16_t flushed;
+	u8_t window[FOTA_DECOMPRESS_WINDOW_SIZE];
+};
+
+/**
+ * @brief Check whether a download is compressed.
+ *
+ * @param data Start of the download.
+ * @param len  Length of data; at least 4 bytes are needed.
+ */
+bool fota_decompress_is_compressed(const u8_t *data, size_t len);
+
+/**
+ * @brief Start decompressing a download.
+ *
+ * @param d   Decompression context.
+ * @param out Called with the decompressed data, in order, in chunks
+ *            of up to FOTA_DECOMPRESS_WINDOW_SIZE bytes.
+ */
+void fota_decompress_start(struct fota_decompress *d,
+			   fota_decompress_out_t out);
+
+/**
+ * @brief Decompress the next part of the download.
+ *
+ * @return 0 on success, negative errno if the data is malformed or
+ *         out failed.
+ */
+int fota_decompress_write(struct fota_decompress *d, const u8_t *data,
+			  size_t len);
+
+/**
+ * @brief Finish decompressing, passing any remaining data to out.
+ *
+ * @return 0 on success, negative errno if the data is incomplete.
+ */
+int fota_decompress_finish(struct fota_decompress *d);
+
+/** @brief Decompressed size, once the header has been parsed. */
+static inline u32_t fota_decompress_size(const struct fota_decompress *d)
+{
+	return d->state == FOTA_DECOMPRESS_HEADER ? 0 : d->size;
+}
+
+#endif	/* FOTA_DECOMPRESS_H__ */
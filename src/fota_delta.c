@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_delta
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <crc.h>
+#include <flash.h>
+#include <misc/byteorder.h>
+#include <string.h>
+
+#include "fota_delta.h"
+
+#define OLD_IMAGE_OFFSET	DT_FLASH_AREA_IMAGE_0_OFFSET
+#define OLD_IMAGE_MAX		DT_FLASH_AREA_IMAGE_0_SIZE
+#define NEW_IMAGE_MAX		DT_FLASH_AREA_IMAGE_1_SIZE
+
+#define HEADER_LEN		16
+#define CONTROL_LEN		12
+
+static int fail(struct fota_delta *d, const char *what)
+{
+	LOG_ERR("Invalid patch at new image offset 0x%x: %s", d->new_pos,
+		what);
+	return -EINVAL;
+}
+
+/* Make sure the old image cache holds the data at old_pos. */
+static int load_old(struct fota_delta *d)
+{
+	int ret;
+
+	if (d->old_pos >= d->old_cache_pos &&
+	    d->old_pos < d->old_cache_pos + d->old_cache_len) {
+		return 0;
+	}
+
+	d->old_cache_pos = d->old_pos;
+	d->old_cache_len = MIN(sizeof(d->old_cache), d->old_size - d->old_pos);
+	ret = flash_read(d->flash_dev, OLD_IMAGE_OFFSET + d->old_pos,
+			 d->old_cache, d->old_cache_len);
+	if (ret) {
+		LOG_ERR("Failed to read old image: %d", ret);
+		d->old_cache_len = 0U;
+	}
+
+	return ret;
+}
+
+static int flush_new(struct fota_delta *d)
+{
+	int ret;
+
+	if (!d->new_len) {
+		return 0;
+	}
+
+	ret = d->out(d->new_buf, d->new_len);
+	d->new_len = 0U;
+
+	return ret;
+}
+
+/* Check the patch was made against the image in slot 0. */
+static int check_old(struct fota_delta *d, u32_t old_crc)
+{
+	u32_t crc = 0U;
+	int ret;
+
+	for (d->old_pos = 0U; d->old_pos < d->old_size;
+	     d->old_pos += d->old_cache_len) {
+		ret = load_old(d);
+		if (ret) {
+			return ret;
+		}
+
+		crc = crc32_ieee_update(crc, d->old_cache, d->old_cache_len);
+	}
+
+	d->old_pos = 0U;
+
+	if (crc != old_crc) {
+		LOG_ERR("Patch doesn't apply to the running image");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int parse_header(struct fota_delta *d)
+{
+	const u8_t *f = d->field;
+
+	if (memcmp(f, FOTA_DELTA_MAGIC, 4)) {
+		return fail(d, "bad magic");
+	}
+
+	d->new_size = sys_get_le32(f + 4);
+	d->old_size = sys_get_le32(f + 8);
+	if (d->new_size > NEW_IMAGE_MAX || d->old_size > OLD_IMAGE_MAX) {
+		return fail(d, "image too big");
+	}
+
+	LOG_INF("Delta update: %u byte image from %u byte image",
+		d->new_size, d->old_size);
+
+	d->state = d->new_size ? FOTA_DELTA_CONTROL : FOTA_DELTA_DONE;
+
+	return check_old(d, sys_get_le32(f + 12));
+}
+
+static int parse_control(struct fota_delta *d)
+{
+	const u8_t *f = d->field;
+
+	d->diff_left = sys_get_le32(f);
+	d->extra_left = sys_get_le32(f + 4);
+	d->seek = (s32_t)sys_get_le32(f + 8);
+
+	if (d->diff_left > d->new_size - d->new_pos ||
+	    d->extra_left > d->new_size - d->new_pos - d->diff_left) {
+		return fail(d, "record past end of new image");
+	}
+
+	if (d->diff_left > d->old_size - d->old_pos) {
+		return fail(d, "diff past end of old image");
+	}
+
+	d->state = FOTA_DELTA_DIFF;
+	return 0;
+}
+
+/* Move on from a finished diff or extra run. */
+static int next_run(struct fota_delta *d)
+{
+	s64_t old_pos;
+
+	if (d->state == FOTA_DELTA_DIFF) {
+		d->state = FOTA_DELTA_EXTRA;
+	}
+
+	if (d->state == FOTA_DELTA_EXTRA && !d->extra_left) {
+		old_pos = (s64_t)d->old_pos + d->seek;
+		if (old_pos < 0 || old_pos > d->old_size) {
+			return fail(d, "seek outside old image");
+		}
+
+		d->old_pos = old_pos;
+		d->state = d->new_pos == d->new_size ?
+			FOTA_DELTA_DONE : FOTA_DELTA_CONTROL;
+	}
+
+	return 0;
+}
+
+static int apply_diff(struct fota_delta *d, const u8_t *data, size_t len)
+{
+	const u8_t *old;
+	size_t n, i;
+	int ret;
+
+	while (len) {
+		ret = load_old(d);
+		if (ret) {
+			return ret;
+		}
+
+		old = d->old_cache + (d->old_pos - d->old_cache_pos);
+		n = MIN(len, d->old_cache_pos + d->old_cache_len - d->old_pos);
+		n = MIN(n, sizeof(d->new_buf) - d->new_len);
+
+		for (i = 0; i < n; i++) {
+			d->new_buf[d->new_len++] = old[i] + data[i];
+		}
+
+		d->old_pos += n;
+		d->new_pos += n;
+		data += n;
+		len -= n;
+
+		if (d->new_len == sizeof(d->new_buf)) {
+			ret = flush_new(d);
+			if (ret) {
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int apply_extra(struct fota_delta *d, const u8_t *data, size_t len)
+{
+	size_t n;
+	int ret;
+
+	while (len) {
+		n = MIN(len, sizeof(d->new_buf) - d->new_len);
+		memcpy(d->new_buf + d->new_len, data, n);
+		d->new_len += n;
+		d->new_pos += n;
+		data += n;
+		len -= n;
+
+		if (d->new_len == sizeof(d->new_buf)) {
+			ret = flush_new(d);
+			if (ret) {
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+bool fota_delta_is_patch(const u8_t *data, size_t len)
+{
+	return len >= 4 && !memcmp(data, FOTA_DELTA_MAGIC, 4);
+}
+
+void fota_delta_start(struct fota_delta *d, struct device *flash_dev,
+		      fota_delta_out_t out)
+{
+	memset(d, 0, sizeof(*d));
+	d->flash_dev = flash_dev;
+	d->out = out;
+	d->state = FOTA_DELTA_HEADER;
+}
+
+int fota_delta_write(struct fota_delta *d, const u8_t *data, size_t len)
+{
+	size_t n;
+	int ret = 0;
+
+	while (len && !ret) {
+		switch (d->state) {
+		case FOTA_DELTA_HEADER:
+		case FOTA_DELTA_CONTROL:
+			d->field[d->field_len++] = *data++;
+			len--;
+			if (d->state == FOTA_DELTA_HEADER &&
+			    d->field_len == HEADER_LEN) {
+				d->field_len = 0U;
+				ret = parse_header(d);
+			} else if (d->state == FOTA_DELTA_CONTROL &&
+				   d->field_len == CONTROL_LEN) {
+				d->field_len = 0U;
+				ret = parse_control(d);
+				if (!ret && !d->diff_left) {
+					ret = next_run(d);
+				}
+			}
+			break;
+		case FOTA_DELTA_DIFF:
+			n = MIN(len, d->diff_left);
+			ret = apply_diff(d, data, n);
+			d->diff_left -= n;
+			data += n;
+			len -= n;
+			if (!ret && !d->diff_left) {
+				ret = next_run(d);
+			}
+			break;
+		case FOTA_DELTA_EXTRA:
+			n = MIN(len, d->extra_left);
+			ret = apply_extra(d, data, n);
+			d->extra_left -= n;
+			data += n;
+			len -= n;
+			if (!ret && !d->extra_left) {
+				ret = next_run(d);
+			}
+			break;
+		case FOTA_DELTA_DONE:
+			return fail(d, "data after end of patch");
+		}
+	}
+
+	return ret;
+}
+
+int fota_delta_finish(struct fota_delta *d)
+{
+	if (d->state != FOTA_DELTA_DONE) {
+		return fail(d, "truncated");
+	}
+
+	return flush_new(d);
+}
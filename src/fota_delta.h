@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_DELTA_H__
+#define FOTA_DELTA_H__
+
+/**
+ * @file
+ * @brief Streaming application of delta firmware updates.
+ *
+ * A delta patch describes the new image in terms of the image
+ * running from slot 0, in the style of bsdiff: a series of records,
+ * each made of a "diff" run, added bytewise to old image data, an
+ * "extra" run, copied as is, and a seek in the old image.
+ *
+ * All values are little endian. The patch starts with a header:
+ *
+ *   magic      "FDP1"
+ *   new_size   u32, size of the new image
+ *   old_size   u32, size of the old image the patch applies to
+ *   old_crc    u32, CRC-32 (IEEE) of those old_size bytes of slot 0
+ *
+ * followed by records, until new_size bytes have been produced:
+ *
+ *   diff_len   u32
+ *   extra_len  u32
+ *   seek       s32
+ *   diff       diff_len bytes: new[n++] = old[o++] + diff[i]
+ *   extra      extra_len bytes: new[n++] = extra[i]
+ *
+ * after which o += seek. Patches are made by
+ * scripts/gen_delta_patch.py.
+ */
+
+#include <zephyr/types.h>
+#include <device.h>
+
+#define FOTA_DELTA_MAGIC "FDP1"
+
+/* Consumer of the reconstructed image. */
+typedef int (*fota_delta_out_t)(const u8_t *data, size_t len);
+
+enum fota_delta_state {
+	FOTA_DELTA_HEADER,
+	FOTA_DELTA_CONTROL,
+	FOTA_DELTA_DIFF,
+	FOTA_DELTA_EXTRA,
+	FOTA_DELTA_DONE,
+};
+
+struct fota_delta {
+	struct device *flash_dev;
+	fota_delta_out_t out;
+	enum fota_delta_state state;
+
+	/* Header or control fields being collected. */
+	u8_t field[16];
+	u8_t field_len;
+
+	u32_t new_size;
+	u32_t new_pos;
+	u32_t old_size;
+	u32_t old_pos;
+	u32_t diff_left;
+	u32_t extra_left;
+	s32_t seek;
+
+	/* Cache of old image data, starting at old_cache_pos. */
+	u8_t old_cache[CONFIG_FOTA_DELTA_BUF_SIZE];
+	u32_t old_cache_pos;
+	u16_t old_cache_len;
+
+	/* New image data not yet passed to out. */
+	u8_t new_buf[CONFIG_FOTA_DELTA_BUF_SIZE];
+	u16_t new_len;
+};
+
+/**
+ * @brief Check whether a download is a delta patch.
+ *
+ * @param data Start of the download.
+ * @param len  Length of data; at least 4 bytes are needed.
+ */
+bool fota_delta_is_patch(const u8_t *data, size_t len);
+
+/**
+ * @brief Start applying a patch to the image in slot 0.
+ *
+ * @param d         Patch context.
+ * @param flash_dev Flash device holding slot 0.
+ * @param out       Called with the new image, in order, in chunks
+ *                  of up to CONFIG_FOTA_DELTA_BUF_SIZE bytes.
+ */
+void fota_delta_start(struct fota_delta *d, struct device *flash_dev,
+		      fota_delta_out_t out);
+
+/**
+ * @brief Apply the next part of the patch.
+ *
+ * @return 0 on success, negative errno if the patch is malformed,
+ *         doesn't apply to slot 0, or out failed.
+ */
+int fota_delta_write(struct fota_delta *d, const u8_t *data, size_t len);
+
+/**
+ * @brief Finish applying the patch, passing any remaining data to out.
+ *
+ * @return 0 on success, negative errno if the patch is incomplete.
+ */
+int fota_delta_finish(struct fota_delta *d);
+
+/** @brief Size of the new image, once the header has been parsed. */
+static inline u32_t fota_delta_new_size(const struct fota_delta *d)
+{
+	return d->state == FOTA_DELTA_HEADER ? 0 : d->new_size;
+}
+
+#endif	/* FOTA_DELTA_H__ */
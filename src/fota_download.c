@@ -0,0 +1,1054 @@
+/*
+ * Copyright (c) 2017 Linaro Limited
+ * Copyright (c) 2018-2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_download
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <dfu/mcuboot.h>
+#include <dfu/flash_img.h>
+#include <flash.h>
+#include <crc.h>
+#include <misc/byteorder.h>
+#include <string.h>
+
+#include "app_work_queue.h"
+#include "fota_download.h"
+#include "settings.h"
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+#include "fota_verify.h"
+#endif
+#if defined(CONFIG_FOTA_DELTA)
+#include "fota_delta.h"
+#endif
+#if defined(CONFIG_FOTA_DECOMPRESS)
+#include "fota_decompress.h"
+#endif
+
+#define FLASH_BANK1_ID DT_FLASH_AREA_IMAGE_1_ID
+#define FLASH_BANK_SIZE DT_FLASH_AREA_IMAGE_1_SIZE
+
+#define NUM_BLOCK_BUFS CONFIG_FOTA_DOWNLOAD_BUFFERS
+
+#define SECTOR_SIZE DT_FLASH_ERASE_BLOCK_SIZE
+/* Program unit, double words if the flash doesn't say. */
+#if defined(DT_FLASH_WRITE_BLOCK_SIZE)
+#define WRITE_BLOCK_SIZE DT_FLASH_WRITE_BLOCK_SIZE
+#else
+#define WRITE_BLOCK_SIZE 8
+#endif
+#define ERASE_AHEAD_BYTES (CONFIG_FOTA_ERASE_AHEAD_SECTORS * SECTOR_SIZE)
+
+/*
+ * Erase the slot as the download goes, instead of all at once when
+ * it starts: either just before each sector is written, or ahead of
+ * the writer, in the background.
+ */
+#if defined(CONFIG_FOTA_ERASE_PROGRESSIVELY) || \
+	CONFIG_FOTA_ERASE_AHEAD_SECTORS > 0
+#define ERASE_INCREMENTAL 1
+#endif
+
+/*
+ * Resuming needs the slot to be erased incrementally, so that the
+ * data written before the restart isn't erased when the download
+ * starts again.
+ */
+#if defined(CONFIG_FOTA_DOWNLOAD_RESUME) && defined(ERASE_INCREMENTAL)
+#define DOWNLOAD_RESUME 1
+#define CHECKPOINT_BYTES (CONFIG_FOTA_DOWNLOAD_CHECKPOINT_SECTORS * SECTOR_SIZE)
+#endif
+
+struct block_buf {
+	/* Aligned so it can be written to flash as is. */
+	u8_t data[CONFIG_LWM2M_COAP_BLOCK_SIZE] __aligned(8);
+	u32_t total_size;
+	/* First block only: where the download comes from. */
+	u32_t source_id;
+	u16_t len;
+	/* First block of a download: the slot must be prepared. */
+	bool first;
+	bool last;
+};
+
+enum dl_time {
+	DL_TIME_ERASE,
+	DL_TIME_PROGRAM,
+	DL_TIME_NETWORK_WAIT,
+	DL_TIME_FLASH_WAIT,
+	DL_TIME_COUNT,
+};
+
+/*
+ * Statistics of the last or current download. Both sides add to the
+ * times, in hardware cycles; the 64-bit sums are only accessed with
+ * interrupts locked.
+ */
+struct dl_stats {
+	u64_t cycles[DL_TIME_COUNT];
+	u32_t bytes;
+	u32_t blocks;
+	u32_t retransmits;
+	/* Uptime when the download started, and ended if it has. */
+	s64_t start_ms;
+	s64_t end_ms;
+	/* Cycle count when the receive side was done with a block. */
+	u32_t idle_since;
+};
+
+/*
+ * The receive side runs in the LwM2M engine's thread, and the writer
+ * on the application work queue. They only share the ring of block
+ * buffers, handed back and forth through the free and filled
+ * semaphores, and the error code.
+ */
+struct fota_download {
+	struct device *flash_dev;
+
+	/* Receive side. */
+	u32_t bytes_received;
+	/* CRC-32 of the package URI of the next download, if any. */
+	u32_t source_id;
+	u8_t percent_received;
+	u8_t head;
+	/* Set if the buffer at head is taken from the free ones. */
+	bool reserved;
+
+	/*
+	 * Writer side. The DFU context's buffer collects data until a
+	 * whole buffer can be written; see img_write().
+	 */
+	struct flash_img_context dfu_ctx __aligned(8);
+	/* Size of the download, and of the image written to the slot. */
+	u32_t total_size;
+	u32_t image_size;
+	/*
+	 * Set once the payload, which is the download once decompressed,
+	 * has started. It is either a patch or the image itself.
+	 */
+	bool payload_started;
+#if defined(CONFIG_FOTA_DECOMPRESS)
+	bool compressed;
+	struct fota_decompress lz;
+#endif
+#if defined(CONFIG_FOTA_DELTA)
+	/* Set if the download is a patch against the image in slot 0. */
+	bool delta;
+	struct fota_delta patch;
+#endif
+#if defined(ERASE_INCREMENTAL)
+	/* Size of the erased area at the start of the slot. */
+	u32_t erased;
+	/* Sectors the writer had to erase itself, for tuning. */
+	u32_t erase_stalls;
+#endif
+#if defined(DOWNLOAD_RESUME)
+	/* Only images downloaded as they are can be resumed. */
+	bool resumable;
+	/* Image offset of the next block to write. */
+	u32_t write_pos;
+	/*
+	 * Data before this offset was written before a restart: it is
+	 * compared with the received data instead of being written.
+	 */
+	u32_t resume_offset;
+	/* Offset in the last checkpoint saved. */
+	u32_t checkpoint_offset;
+	/* Identifies the image in checkpoints; see resume_write(). */
+	u32_t image_id;
+#endif
+	u8_t tail;
+	struct k_work write_work;
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+	struct fota_verify verify;
+	/* Set once a complete download has been verified. */
+	bool verified;
+#endif
+
+#if CONFIG_FOTA_ERASE_AHEAD_SECTORS > 0
+	/*
+	 * Erase-ahead: the writer sets the target, and the erase work
+	 * item, which also runs on the application work queue, erases
+	 * up to it a sector at a time, while no blocks are queued.
+	 */
+	atomic_t erase_target;
+	struct k_work erase_work;
+#endif
+
+	struct k_sem free;
+	struct k_sem filled;
+	/* First error from the writer, reset when a download starts. */
+	atomic_t error;
+
+	struct dl_stats stats;
+
+	struct block_buf bufs[NUM_BLOCK_BUFS];
+};
+
+static struct fota_download dl;
+
+/* Account the time since start, a k_cycle_get_32() value. */
+static void stats_add(enum dl_time time, u32_t start)
+{
+	u32_t cycles = k_cycle_get_32() - start;
+	unsigned int key;
+
+	key = irq_lock();
+	dl.stats.cycles[time] += cycles;
+	irq_unlock(key);
+}
+
+static void stats_start(void)
+{
+	unsigned int key;
+
+	key = irq_lock();
+	memset(&dl.stats, 0, sizeof(dl.stats));
+	dl.stats.start_ms = k_uptime_get();
+	irq_unlock(key);
+}
+
+static void stats_end(void)
+{
+	struct fota_download_stats stats;
+
+	if (!dl.stats.start_ms || dl.stats.end_ms) {
+		return;
+	}
+
+	dl.stats.end_ms = k_uptime_get();
+
+	fota_download_stats_get(&stats);
+	LOG_INF("%u bytes in %u ms (%u bytes/s): erase %u ms, program %u ms,"
+		" network wait %u ms, flash wait %u ms", stats.bytes,
+		stats.elapsed_ms, stats.bytes_per_sec, stats.erase_ms,
+		stats.program_ms, stats.network_wait_ms, stats.flash_wait_ms);
+}
+
+static inline bool is_delta(void)
+{
+#if defined(CONFIG_FOTA_DELTA)
+	return dl.delta;
+#else
+	return false;
+#endif
+}
+
+static inline bool is_compressed(void)
+{
+#if defined(CONFIG_FOTA_DECOMPRESS)
+	return dl.compressed;
+#else
+	return false;
+#endif
+}
+
+#if defined(DOWNLOAD_RESUME)
+static void checkpoint_save(u32_t total_size, u32_t offset)
+{
+	struct fota_download_checkpoint cp = {
+		.total_size = total_size,
+		.offset = offset,
+		.image_id = dl.image_id,
+	};
+	int ret;
+
+	ret = fota_download_checkpoint_save(&cp);
+	if (ret) {
+		/* Not fatal: we just can't resume from here. */
+		LOG_WRN("Failed to save download checkpoint: %d", ret);
+		return;
+	}
+
+	dl.checkpoint_offset = offset;
+}
+
+/*
+ * Identify an image for checkpoints, by its size, where it comes
+ * from, and its first block, which holds the MCUboot header with the
+ * image's version and size. The image's hash is in its trailer, too
+ * late to tell.
+ */
+static u32_t image_id(const struct block_buf *buf)
+{
+	u8_t le[8];
+	u32_t crc;
+
+	sys_put_le32(buf->total_size, le);
+	sys_put_le32(buf->source_id, le + 4);
+	crc = crc32_ieee_update(0, le, sizeof(le));
+
+	return crc32_ieee_update(crc, buf->data, buf->len);
+}
+
+/*
+ * If a checkpoint was saved for the same image, pick up from there:
+ * the slot is already written up to its offset, and erased no further
+ * than the sector after it. A checkpoint for another image, as told
+ * by image_id(), is dropped, and the slot written from scratch.
+ */
+static bool resume_write(u32_t total_size)
+{
+	struct fota_download_checkpoint cp;
+
+	dl.write_pos = 0U;
+	dl.resume_offset = 0U;
+	dl.checkpoint_offset = 0U;
+
+	if (fota_download_checkpoint_read(&cp) || !cp.offset) {
+		return false;
+	}
+
+	if (cp.total_size != total_size || cp.image_id != dl.image_id ||
+	    cp.offset >= total_size) {
+		LOG_INF("Download checkpoint is for another image, "
+			"starting over");
+		fota_download_checkpoint_clear();
+		return false;
+	}
+
+	LOG_INF("Download firmware resuming at offset 0x%x", cp.offset);
+	dl.dfu_ctx.bytes_written = cp.offset;
+	dl.erased = cp.offset;
+	dl.erase_stalls = 0U;
+	dl.resume_offset = cp.offset;
+	dl.checkpoint_offset = cp.offset;
+
+	return true;
+}
+
+/*
+ * Compare the part of the data which was written before the restart
+ * with flash. Returns the number of bytes of data it covered.
+ */
+static int resume_verify(const u8_t *data, size_t data_len)
+{
+	u8_t chunk[32];
+	u32_t len, off, n;
+	int ret;
+
+	if (dl.write_pos >= dl.resume_offset) {
+		return 0;
+	}
+
+	len = MIN(data_len, dl.resume_offset - dl.write_pos);
+	for (off = 0U; off < len; off += n) {
+		n = MIN(sizeof(chunk), len - off);
+		ret = flash_read(dl.flash_dev, DT_FLASH_AREA_IMAGE_1_OFFSET +
+				 dl.write_pos + off, chunk, n);
+		if (ret) {
+			LOG_ERR("Failed to read flash: %d", ret);
+			return ret;
+		}
+
+		/*
+		 * The data before this offset is gone, so the slot can't
+		 * be rewritten from here. Fail this download; the writer
+		 * drops the checkpoint, so the next attempt starts over.
+		 */
+		if (memcmp(chunk, data + off, n)) {
+			LOG_ERR("Resumed download doesn't match flash at "
+				"offset 0x%x", dl.write_pos + off);
+			return -EIO;
+		}
+	}
+
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+	/* It is still part of the image to verify. */
+	ret = fota_verify_update(&dl.verify, data, len);
+	if (ret) {
+		return ret;
+	}
+#endif
+
+	return len;
+}
+#endif
+
+static int start_write(void)
+{
+	u32_t start;
+	int ret;
+
+	flash_img_init(&dl.dfu_ctx);
+
+	/* A patch's image size is known once its header is parsed. */
+	dl.image_size = 0U;
+	if (!is_delta()) {
+#if defined(CONFIG_FOTA_DECOMPRESS)
+		dl.image_size = is_compressed() ?
+			fota_decompress_size(&dl.lz) : dl.total_size;
+#else
+		dl.image_size = dl.total_size;
+#endif
+	}
+
+	if (dl.image_size > FLASH_BANK_SIZE) {
+		LOG_ERR("Image size too big (%u)", dl.image_size);
+		return -EINVAL;
+	}
+
+#if defined(DOWNLOAD_RESUME)
+	dl.resumable = !is_delta() && !is_compressed();
+	if (!dl.resumable) {
+		/*
+		 * The slot is about to be overwritten, so forget any
+		 * earlier download.
+		 */
+		fota_download_checkpoint_clear();
+		dl.write_pos = 0U;
+		dl.resume_offset = 0U;
+		dl.checkpoint_offset = 0U;
+	} else if (resume_write(dl.total_size)) {
+		return 0;
+	}
+#endif
+
+#if defined(ERASE_INCREMENTAL)
+	LOG_INF("Download firmware started, erasing progressively.");
+	dl.erased = 0U;
+	dl.erase_stalls = 0U;
+	/* reset image data */
+	start = k_cycle_get_32();
+	ret = boot_invalidate_slot1();
+	stats_add(DL_TIME_ERASE, start);
+	if (ret != 0) {
+		LOG_ERR("Failed to reset image data in bank 1");
+	}
+#else
+	LOG_INF("Download firmware started, erasing second bank");
+	start = k_cycle_get_32();
+	ret = boot_erase_img_bank(FLASH_BANK1_ID);
+	stats_add(DL_TIME_ERASE, start);
+	if (ret != 0) {
+		LOG_ERR("Failed to erase flash bank 1");
+	}
+#endif
+
+	return ret;
+}
+
+#if defined(ERASE_INCREMENTAL)
+/*
+ * Erase whole sectors until at least end bytes from the start of the
+ * slot are erased, with a single erase call. If stall is true, the
+ * writer is waiting for them. Write protection must be off.
+ */
+static int erase_until(u32_t end, bool stall)
+{
+	u32_t start, len;
+	int ret;
+
+	end = MIN(ROUND_UP(end, SECTOR_SIZE), FLASH_BANK_SIZE);
+	if (dl.erased >= end) {
+		return 0;
+	}
+
+	len = end - dl.erased;
+	LOG_DBG("Erasing 0x%x bytes at offset 0x%x", len,
+		DT_FLASH_AREA_IMAGE_1_OFFSET + dl.erased);
+	start = k_cycle_get_32();
+	ret = flash_erase(dl.flash_dev,
+			  DT_FLASH_AREA_IMAGE_1_OFFSET + dl.erased, len);
+	stats_add(DL_TIME_ERASE, start);
+	if (ret) {
+		LOG_ERR("Error %d while erasing sectors", ret);
+		return ret;
+	}
+
+	dl.erased = end;
+	if (stall) {
+		dl.erase_stalls += len / SECTOR_SIZE;
+	}
+
+	return 0;
+}
+#endif
+
+#if CONFIG_FOTA_ERASE_AHEAD_SECTORS > 0
+/*
+ * Erase one sector towards the target per run, and only while the
+ * writer waits for the network: the flash can't be programmed during
+ * an erase, so erasing with blocks queued would only delay them. The
+ * writer resubmits this after the blocks are written. Blocks which
+ * arrive during an erase still wait for it, for at most one sector.
+ */
+static void erase_ahead(struct k_work *work)
+{
+	u32_t target = atomic_get(&dl.erase_target);
+	int ret;
+
+	if (atomic_get(&dl.error) || dl.erased >= target ||
+	    k_sem_count_get(&dl.filled)) {
+		return;
+	}
+
+	flash_write_protection_set(dl.flash_dev, false);
+	ret = erase_until(dl.erased + 1, false);
+	flash_write_protection_set(dl.flash_dev, true);
+	if (ret) {
+		atomic_set(&dl.error, ret);
+		return;
+	}
+
+	if (dl.erased < target) {
+		app_wq_submit(&dl.erase_work);
+	}
+}
+
+/*
+ * Called by the writer after each write. The target follows what was
+ * written, not what was received, since a patch and the image it
+ * produces don't line up.
+ */
+static void erase_ahead_update(void)
+{
+	u32_t target = dl.dfu_ctx.bytes_written + CONFIG_IMG_BLOCK_BUF_SIZE +
+		ERASE_AHEAD_BYTES;
+
+	if (dl.image_size) {
+		target = MIN(target, dl.image_size);
+	}
+
+	atomic_set(&dl.erase_target, target);
+	app_wq_submit(&dl.erase_work);
+}
+#else
+static inline void erase_ahead_update(void)
+{
+}
+#endif
+
+BUILD_ASSERT_MSG(CONFIG_IMG_BLOCK_BUF_SIZE % WRITE_BLOCK_SIZE == 0,
+		 "IMG_BLOCK_BUF_SIZE must be a multiple of the flash write block");
+
+/* Program len bytes, a multiple of WRITE_BLOCK_SIZE, at the write position. */
+static int program(const u8_t *data, size_t len)
+{
+	int ret;
+
+	ret = flash_write(dl.flash_dev, DT_FLASH_AREA_IMAGE_1_OFFSET +
+			  dl.dfu_ctx.bytes_written, data, len);
+	if (ret) {
+		LOG_ERR("Error %d while writing flash at offset 0x%x", ret,
+			(u32_t)dl.dfu_ctx.bytes_written);
+	}
+
+	return ret;
+}
+
+/*
+ * Write combining, replacing flash_img_buffered_write(): the slot is
+ * programmed in bursts of whole CONFIG_IMG_BLOCK_BUF_SIZE buffers at
+ * buffer-aligned offsets, so the flash driver only sees aligned writes
+ * of whole program units. Data which doesn't fill a buffer waits in
+ * the DFU context's buffer. While it is empty, whole buffers' worth
+ * of data are written from where they are, with one call, if it is
+ * double-word aligned, as received blocks are. Write protection must
+ * be off.
+ */
+static int img_write(const u8_t *data, size_t len, bool flush)
+{
+	struct flash_img_context *ctx = &dl.dfu_ctx;
+	size_t n;
+	int ret;
+
+	while (len) {
+		if (!ctx->buf_bytes && len >= CONFIG_IMG_BLOCK_BUF_SIZE &&
+		    !((uintptr_t)data & (sizeof(u64_t) - 1))) {
+			n = ROUND_DOWN(len, CONFIG_IMG_BLOCK_BUF_SIZE);
+			ret = program(data, n);
+			if (ret) {
+				return ret;
+			}
+
+			ctx->bytes_written += n;
+		} else {
+			n = MIN(len, CONFIG_IMG_BLOCK_BUF_SIZE - ctx->buf_bytes);
+			memcpy(ctx->buf + ctx->buf_bytes, data, n);
+			ctx->buf_bytes += n;
+			if (ctx->buf_bytes == CONFIG_IMG_BLOCK_BUF_SIZE) {
+				ret = program(ctx->buf,
+					      CONFIG_IMG_BLOCK_BUF_SIZE);
+				if (ret) {
+					return ret;
+				}
+
+				ctx->bytes_written += CONFIG_IMG_BLOCK_BUF_SIZE;
+				ctx->buf_bytes = 0U;
+			}
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	if (flush && ctx->buf_bytes) {
+		/* Pad the last program unit as erased flash. */
+		n = ROUND_UP(ctx->buf_bytes, WRITE_BLOCK_SIZE);
+		memset(ctx->buf + ctx->buf_bytes, 0xff, n - ctx->buf_bytes);
+		ret = program(ctx->buf, n);
+		if (ret) {
+			return ret;
+		}
+
+		ctx->bytes_written += ctx->buf_bytes;
+		ctx->buf_bytes = 0U;
+	}
+
+	return 0;
+}
+
+/*
+ * Write the next part of the image to the slot; flush is set with
+ * the end of the image.
+ */
+static int write_image(const u8_t *data, size_t len, bool flush)
+{
+	u32_t start;
+	int ret;
+
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+	ret = fota_verify_update(&dl.verify, data, len);
+	if (ret) {
+		return ret;
+	}
+#endif
+
+	/*
+	 * The erase and the writes it makes room for share one write
+	 * protection window.
+	 */
+	flash_write_protection_set(dl.flash_dev, false);
+
+#if defined(ERASE_INCREMENTAL)
+	/*
+	 * Make sure everything this can cause to be written is erased,
+	 * including what's still buffered in the DFU context.
+	 */
+	ret = erase_until(dl.dfu_ctx.bytes_written + CONFIG_IMG_BLOCK_BUF_SIZE +
+			  len, true);
+	if (ret) {
+		flash_write_protection_set(dl.flash_dev, true);
+		return ret;
+	}
+#endif
+
+	start = k_cycle_get_32();
+	ret = img_write(data, len, flush);
+	stats_add(DL_TIME_PROGRAM, start);
+	flash_write_protection_set(dl.flash_dev, true);
+	if (ret < 0) {
+		LOG_ERR("Failed to write flash block");
+		return ret;
+	}
+
+	erase_ahead_update();
+
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+	if (flush) {
+		ret = fota_verify_finish(&dl.verify);
+		if (ret) {
+			return ret;
+		}
+
+		dl.verified = true;
+	}
+#endif
+
+	return 0;
+}
+
+#if defined(CONFIG_FOTA_DELTA)
+/* Output of the patch: the new image, in order. */
+static int write_patched(const u8_t *data, size_t len)
+{
+	dl.image_size = fota_delta_new_size(&dl.patch);
+
+	return write_image(data, len, false);
+}
+#endif
+
+/* Write the next part of the payload. */
+static int write_payload(const u8_t *data, size_t len)
+{
+	int ret;
+
+	if (!dl.payload_started) {
+		dl.payload_started = true;
+#if defined(CONFIG_FOTA_DELTA)
+		dl.delta = fota_delta_is_patch(data, len);
+		if (dl.delta) {
+			fota_delta_start(&dl.patch, dl.flash_dev,
+					 write_patched);
+		}
+#endif
+		ret = start_write();
+		if (ret) {
+			return ret;
+		}
+	}
+
+#if defined(CONFIG_FOTA_DELTA)
+	if (dl.delta) {
+		return fota_delta_write(&dl.patch, data, len);
+	}
+#endif
+
+#if defined(DOWNLOAD_RESUME)
+	ret = resume_verify(data, len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	dl.write_pos += len;
+	data += ret;
+	len -= ret;
+#endif
+
+	ret = write_image(data, len, false);
+	if (ret) {
+		return ret;
+	}
+
+#if defined(DOWNLOAD_RESUME)
+	if (dl.resumable && dl.dfu_ctx.bytes_written >=
+	    dl.checkpoint_offset + CHECKPOINT_BYTES) {
+		/* Everything before bytes_written is in flash. */
+		checkpoint_save(dl.total_size,
+				ROUND_DOWN(dl.dfu_ctx.bytes_written,
+					   SECTOR_SIZE));
+	}
+#endif
+
+	return 0;
+}
+
+/* The payload is complete: write the rest of the image. */
+static int finish_payload(struct block_buf *buf)
+{
+	int ret;
+
+#if defined(CONFIG_FOTA_DELTA)
+	if (dl.delta) {
+		ret = fota_delta_finish(&dl.patch);
+		if (ret) {
+			return ret;
+		}
+	}
+#endif
+
+	ret = write_image(buf->data, 0, true);
+	if (ret) {
+		return ret;
+	}
+
+#if defined(DOWNLOAD_RESUME)
+	/* Complete: nothing left to resume. */
+	fota_download_checkpoint_clear();
+#endif
+
+	return 0;
+}
+
+static int write_block(struct block_buf *buf)
+{
+	int ret;
+
+	if (buf->first) {
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+		dl.verified = false;
+		fota_verify_start(&dl.verify);
+#endif
+		dl.total_size = buf->total_size;
+		dl.payload_started = false;
+#if defined(DOWNLOAD_RESUME)
+		dl.image_id = image_id(buf);
+#endif
+#if defined(CONFIG_FOTA_DECOMPRESS)
+		dl.compressed = fota_decompress_is_compressed(buf->data,
+							      buf->len);
+		if (dl.compressed) {
+			fota_decompress_start(&dl.lz, write_payload);
+		}
+#endif
+	}
+
+#if defined(CONFIG_FOTA_DECOMPRESS)
+	if (dl.compressed) {
+		ret = fota_decompress_write(&dl.lz, buf->data, buf->len);
+		if (!ret && buf->last) {
+			ret = fota_decompress_finish(&dl.lz);
+		}
+	} else
+#endif
+	{
+		ret = write_payload(buf->data, buf->len);
+	}
+
+	if (ret || !buf->last) {
+		return ret;
+	}
+
+	return finish_payload(buf);
+}
+
+static void write_blocks(struct k_work *work)
+{
+	struct block_buf *buf;
+	int ret;
+
+	while (k_sem_take(&dl.filled, K_NO_WAIT) == 0) {
+		buf = &dl.bufs[dl.tail];
+		dl.tail = (dl.tail + 1) % NUM_BLOCK_BUFS;
+
+		/* After an error, just recycle the rest of the download. */
+		if (!atomic_get(&dl.error)) {
+			ret = write_block(buf);
+			if (ret) {
+				atomic_set(&dl.error, ret);
+#if defined(DOWNLOAD_RESUME)
+				/* Don't trust what's in the slot. */
+				fota_download_checkpoint_clear();
+#endif
+			}
+		}
+
+		k_sem_give(&dl.free);
+	}
+}
+
+/* Wait for the writer to finish with every queued block. */
+static void wait_written(void)
+{
+	int queued = NUM_BLOCK_BUFS - dl.reserved;
+	u32_t start = k_cycle_get_32();
+	int i;
+
+	for (i = 0; i < queued; i++) {
+		k_sem_take(&dl.free, K_FOREVER);
+	}
+	for (i = 0; i < queued; i++) {
+		k_sem_give(&dl.free);
+	}
+
+	stats_add(DL_TIME_FLASH_WAIT, start);
+}
+
+/* Take the buffer at head, waiting for the writer if none is free. */
+static struct block_buf *reserve_buf(void)
+{
+	u32_t start;
+
+	if (!dl.reserved) {
+		if (dl.bytes_received) {
+			/* Since the previous block. */
+			stats_add(DL_TIME_NETWORK_WAIT, dl.stats.idle_since);
+		}
+
+		/* Back-pressure: wait if every buffer is queued. */
+		start = k_cycle_get_32();
+		k_sem_take(&dl.free, K_FOREVER);
+		stats_add(DL_TIME_FLASH_WAIT, start);
+		dl.reserved = true;
+	}
+
+	return &dl.bufs[dl.head];
+}
+
+void *fota_download_get_buf(size_t *data_len)
+{
+	struct block_buf *buf;
+
+	if (dl.reserved) {
+		/*
+		 * The previous exchange never got its block queued: the
+		 * server is sending it again.
+		 */
+		dl.stats.retransmits++;
+	}
+
+	buf = reserve_buf();
+	*data_len = sizeof(buf->data);
+	return buf->data;
+}
+
+int fota_download_block(u8_t *data, u16_t data_len, bool last_block,
+			size_t total_size)
+{
+	struct block_buf *buf;
+	u8_t percent;
+	int ret = 0;
+
+	if (total_size > FLASH_BANK_SIZE) {
+		LOG_ERR("Artifact file size too big (%d)", total_size);
+		ret = -EINVAL;
+		goto cleanup;
+	}
+
+	if (!data_len) {
+		LOG_ERR("Data len is zero, nothing to write.");
+		ret = -EINVAL;
+		goto cleanup;
+	}
+
+	if (data_len > sizeof(buf->data)) {
+		LOG_ERR("Block too big (%u)", data_len);
+		ret = -EINVAL;
+		goto cleanup;
+	}
+
+	if (dl.bytes_received == 0) {
+		/* Blocks from an aborted download may still be queued. */
+		wait_written();
+		atomic_clear(&dl.error);
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+		/* Whatever was verified is about to be overwritten. */
+		dl.verified = false;
+#endif
+		stats_start();
+	}
+
+	ret = atomic_get(&dl.error);
+	if (ret) {
+		goto cleanup;
+	}
+
+	buf = reserve_buf();
+	dl.reserved = false;
+	dl.head = (dl.head + 1) % NUM_BLOCK_BUFS;
+	if (data != buf->data) {
+		memcpy(buf->data, data, data_len);
+	}
+	buf->len = data_len;
+	buf->total_size = total_size;
+	buf->source_id = dl.source_id;
+	buf->first = dl.bytes_received == 0;
+	buf->last = last_block;
+
+	k_sem_give(&dl.filled);
+	app_wq_submit(&dl.write_work);
+
+	dl.bytes_received += data_len;
+	dl.stats.bytes += data_len;
+	dl.stats.blocks++;
+
+	/* display a % downloaded, if it's different */
+	if (total_size) {
+		percent = dl.bytes_received * 100 / total_size;
+	} else {
+		/* Total size is empty when there is only one block */
+		percent = 100;
+	}
+
+	if (percent > dl.percent_received) {
+		dl.percent_received = percent;
+		LOG_INF("%d%%", dl.percent_received);
+	}
+
+	if (!last_block) {
+		/* Keep going */
+		dl.stats.idle_since = k_cycle_get_32();
+		return 0;
+	}
+
+	wait_written();
+	ret = atomic_get(&dl.error);
+	if (ret) {
+		goto cleanup;
+	}
+
+#if defined(ERASE_INCREMENTAL)
+	LOG_DBG("%u sectors erased while the writer waited",
+		dl.erase_stalls);
+#endif
+
+	if (total_size && (dl.bytes_received != total_size)) {
+		LOG_ERR("Early last block, downloaded %d, expecting %d",
+			dl.bytes_received, total_size);
+		ret = -EIO;
+	}
+
+cleanup:
+	stats_end();
+	dl.bytes_received = 0;
+	dl.percent_received = 0;
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+	if (ret) {
+		dl.verified = false;
+	}
+#endif
+
+	return ret;
+}
+
+void fota_download_stats_get(struct fota_download_stats *stats)
+{
+	u32_t hz = sys_clock_hw_cycles_per_sec();
+	u64_t cycles[DL_TIME_COUNT];
+	s64_t start_ms, end_ms;
+	unsigned int key;
+
+	key = irq_lock();
+	memcpy(cycles, dl.stats.cycles, sizeof(cycles));
+	stats->bytes = dl.stats.bytes;
+	stats->blocks = dl.stats.blocks;
+	stats->retransmits = dl.stats.retransmits;
+	start_ms = dl.stats.start_ms;
+	end_ms = dl.stats.end_ms;
+	irq_unlock(key);
+
+	stats->erase_ms = cycles[DL_TIME_ERASE] * MSEC_PER_SEC / hz;
+	stats->program_ms = cycles[DL_TIME_PROGRAM] * MSEC_PER_SEC / hz;
+	stats->network_wait_ms =
+		cycles[DL_TIME_NETWORK_WAIT] * MSEC_PER_SEC / hz;
+	stats->flash_wait_ms = cycles[DL_TIME_FLASH_WAIT] * MSEC_PER_SEC / hz;
+
+	if (!start_ms) {
+		stats->elapsed_ms = 0U;
+	} else {
+		stats->elapsed_ms = (end_ms ? end_ms : k_uptime_get()) -
+			start_ms;
+	}
+
+	stats->bytes_per_sec = stats->elapsed_ms ?
+		(u64_t)stats->bytes * MSEC_PER_SEC / stats->elapsed_ms : 0;
+}
+
+void fota_download_set_source(const char *uri, size_t len)
+{
+	dl.source_id = crc32_ieee_update(0, (const u8_t *)uri, len);
+}
+
+bool fota_download_image_verified(void)
+{
+#if defined(CONFIG_FOTA_DOWNLOAD_VERIFY)
+	return dl.verified;
+#else
+	return true;
+#endif
+}
+
+int fota_download_init(struct device *flash_dev)
+{
+	dl.flash_dev = flash_dev;
+	dl.head = 0;
+	dl.tail = 0;
+	k_sem_init(&dl.free, NUM_BLOCK_BUFS, NUM_BLOCK_BUFS);
+	k_sem_init(&dl.filled, 0, NUM_BLOCK_BUFS);
+	k_work_init(&dl.write_work, write_blocks);
+#if CONFIG_FOTA_ERASE_AHEAD_SECTORS > 0
+	k_work_init(&dl.erase_work, erase_ahead);
+	atomic_clear(&dl.erase_target);
+#endif
+	atomic_clear(&dl.error);
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_DOWNLOAD_H__
+#define FOTA_DOWNLOAD_H__
+
+/**
+ * @file
+ * @brief Pipelined firmware download into the secondary image slot.
+ *
+ * Blocks received by the LwM2M engine go into a small ring of buffers,
+ * directly when the engine uses fota_download_get_buf(), and are
+ * acknowledged right away. A work item on the application work queue
+ * erases and programs flash from the ring, so the CoAP exchange only
+ * waits on flash when the ring is full.
+ */
+
+#include <zephyr/types.h>
+#include <device.h>
+
+/**
+ * @brief Initialize the firmware download pipeline.
+ *
+ * @param flash_dev Flash device holding the secondary image slot.
+ * @return 0 on success, negative errno otherwise.
+ */
+int fota_download_init(struct device *flash_dev);
+
+/**
+ * @brief Get the buffer the next firmware block should be received in.
+ *
+ * This is meant to be the LwM2M firmware pre-write callback: the block
+ * is then received straight into the ring, and isn't copied again by
+ * fota_download_block(). It blocks only if every buffer is waiting to
+ * be written. Calling it again before the block is queued returns the
+ * same buffer.
+ *
+ * @param data_len Set to the size of the buffer.
+ * @return The buffer.
+ */
+void *fota_download_get_buf(size_t *data_len);
+
+/**
+ * @brief Queue a received firmware block for writing.
+ *
+ * This is meant to be called from the LwM2M firmware write callback.
+ * It blocks only if every buffer is waiting to be written. For the
+ * last block, it waits for the whole image to be written, so the
+ * result covers the entire download.
+ *
+ * @return 0 on success, negative errno if this or an earlier block
+ *         of the same download failed. The download is then reset.
+ */
+int fota_download_block(u8_t *data, u16_t data_len, bool last_block,
+			size_t total_size);
+
+/**
+ * @brief Say where the next download comes from.
+ *
+ * A download is only resumed from a checkpoint if it comes from the
+ * same place, besides having the same size and first block. Call
+ * before its first block, from the same thread.
+ *
+ * @param uri Package URI, or empty for a pushed download.
+ * @param len Its length.
+ */
+void fota_download_set_source(const char *uri, size_t len);
+
+/** @brief Statistics of a firmware download. */
+struct fota_download_stats {
+	/** Bytes and blocks received. */
+	u32_t bytes;
+	u32_t blocks;
+	/** Blocks the server had to send again. */
+	u32_t retransmits;
+	/** Time spent erasing and programming the slot, in ms. */
+	u32_t erase_ms;
+	u32_t program_ms;
+	/**
+	 * Time spent waiting for the next block from the network, and
+	 * for the writer to make room for it, in ms.
+	 */
+	u32_t network_wait_ms;
+	u32_t flash_wait_ms;
+	/** Time since the download started, until it ended, in ms. */
+	u32_t elapsed_ms;
+	/** Effective throughput, in bytes per second. */
+	u32_t bytes_per_sec;
+};
+
+/**
+ * @brief Get the statistics of the last or current download.
+ *
+ * Erase and program times are measured by the writer, with the
+ * hardware cycle counter; together with the waits, they show whether
+ * a download is limited by the network or by flash.
+ */
+void fota_download_stats_get(struct fota_download_stats *stats);
+
+/**
+ * @brief Check whether the downloaded image passed verification.
+ *
+ * @return true if the last download completed and its SHA-256
+ *         matched the image's, or if verification is disabled.
+ */
+bool fota_download_image_verified(void);
+
+#endif	/* FOTA_DOWNLOAD_H__ */
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Vendor LwM2M object reporting firmware download statistics.
+ *
+ * Its single instance describes the last or current download, so the
+ * server can tell whether slow updates are limited by the network or
+ * by flash. Times are in milliseconds.
+ */
+
+#define LOG_MODULE_NAME fota_download_obj
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <init.h>
+
+#include "fota_download.h"
+#include "lwm2m_object.h"
+#include "lwm2m_vendor.h"
+
+/* resource IDs */
+#define FOTA_STATS_BYTES_ID		0
+#define FOTA_STATS_BLOCKS_ID		1
+#define FOTA_STATS_RETRANSMITS_ID	2
+#define FOTA_STATS_ERASE_TIME_ID	3
+#define FOTA_STATS_PROGRAM_TIME_ID	4
+#define FOTA_STATS_NETWORK_WAIT_ID	5
+#define FOTA_STATS_FLASH_WAIT_ID	6
+#define FOTA_STATS_ELAPSED_TIME_ID	7
+#define FOTA_STATS_THROUGHPUT_ID	8
+
+#define FOTA_STATS_MAX_ID		9
+
+/* resource state variables */
+static struct fota_download_stats stats;
+
+static struct lwm2m_engine_obj fota_stats;
+static struct lwm2m_engine_obj_field fields[] = {
+	OBJ_FIELD_DATA(FOTA_STATS_BYTES_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_BLOCKS_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_RETRANSMITS_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_ERASE_TIME_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_PROGRAM_TIME_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_NETWORK_WAIT_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_FLASH_WAIT_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_ELAPSED_TIME_ID, R, U32),
+	OBJ_FIELD_DATA(FOTA_STATS_THROUGHPUT_ID, R, U32),
+};
+
+static struct lwm2m_engine_obj_inst inst;
+static struct lwm2m_engine_res_inst res[FOTA_STATS_MAX_ID];
+
+/*
+ * Read callbacks aren't told which resource is read, so there is one
+ * for each; they all refresh every statistic.
+ */
+#define STATS_READ_CB(field)						\
+	static void *read_##field(u16_t obj_inst_id, size_t *data_len)	\
+	{								\
+		fota_download_stats_get(&stats);			\
+		*data_len = sizeof(stats.field);			\
+		return &stats.field;					\
+	}
+
+STATS_READ_CB(bytes)
+STATS_READ_CB(blocks)
+STATS_READ_CB(retransmits)
+STATS_READ_CB(erase_ms)
+STATS_READ_CB(program_ms)
+STATS_READ_CB(network_wait_ms)
+STATS_READ_CB(flash_wait_ms)
+STATS_READ_CB(elapsed_ms)
+STATS_READ_CB(bytes_per_sec)
+
+#define INIT_STATS_RES(res_var, index_var, id_val, field)		\
+	INIT_OBJ_RES(res_var, index_var, id_val, NULL, &stats.field,	\
+		     sizeof(stats.field), read_##field, NULL, NULL, NULL)
+
+static struct lwm2m_engine_obj_inst *fota_stats_create(u16_t obj_inst_id)
+{
+	int i = 0;
+
+	if (inst.obj) {
+		LOG_ERR("Can not create instance - "
+			"already existing: %u", obj_inst_id);
+		return NULL;
+	}
+
+	(void)memset(res, 0, sizeof(res[0]) * ARRAY_SIZE(res));
+
+	/* initialize instance resource data */
+	INIT_STATS_RES(res, i, FOTA_STATS_BYTES_ID, bytes);
+	INIT_STATS_RES(res, i, FOTA_STATS_BLOCKS_ID, blocks);
+	INIT_STATS_RES(res, i, FOTA_STATS_RETRANSMITS_ID, retransmits);
+	INIT_STATS_RES(res, i, FOTA_STATS_ERASE_TIME_ID, erase_ms);
+	INIT_STATS_RES(res, i, FOTA_STATS_PROGRAM_TIME_ID, program_ms);
+	INIT_STATS_RES(res, i, FOTA_STATS_NETWORK_WAIT_ID, network_wait_ms);
+	INIT_STATS_RES(res, i, FOTA_STATS_FLASH_WAIT_ID, flash_wait_ms);
+	INIT_STATS_RES(res, i, FOTA_STATS_ELAPSED_TIME_ID, elapsed_ms);
+	INIT_STATS_RES(res, i, FOTA_STATS_THROUGHPUT_ID, bytes_per_sec);
+
+	inst.resources = res;
+	inst.resource_count = i;
+	LOG_DBG("Create firmware download statistics instance: %d",
+		obj_inst_id);
+	return &inst;
+}
+
+static int fota_stats_init(struct device *dev)
+{
+	fota_stats.obj_id = LWM2M_OBJECT_FOTA_STATS_ID;
+	fota_stats.fields = fields;
+	fota_stats.field_count = ARRAY_SIZE(fields);
+	fota_stats.max_instance_count = 1U;
+	fota_stats.create_cb = fota_stats_create;
+	lwm2m_register_obj(&fota_stats);
+
+	return 0;
+}
+
+SYS_INIT(fota_stats_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
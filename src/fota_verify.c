@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_verify
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <misc/byteorder.h>
+#include <string.h>
+
+#include "fota_verify.h"
+
+/* MCUboot image format, see bootutil/image.h. */
+#define IMAGE_MAGIC			0x96f3b83d
+#define IMAGE_HEADER_PARSE_LEN		16
+#define IMAGE_HEADER_HDR_SIZE_OFF	8
+#define IMAGE_HEADER_IMG_SIZE_OFF	12
+
+#define IMAGE_TLV_INFO_MAGIC		0x6907
+#define IMAGE_TLV_PROT_INFO_MAGIC	0x6908
+#define IMAGE_TLV_INFO_LEN		4
+#define IMAGE_TLV_HEADER_LEN		4
+#define IMAGE_TLV_SHA256		0x10
+
+static int fail(struct fota_verify *v, int error, const char *what)
+{
+	LOG_ERR("Invalid image at offset 0x%x: %s", v->offset, what);
+	v->error = error;
+	return error;
+}
+
+static void hash(struct fota_verify *v, const u8_t *data, size_t len)
+{
+	mbedtls_sha256_update_ret(&v->sha, data, len);
+}
+
+/* Collect bytes into v->field; returns true once it holds len bytes. */
+static bool collect(struct fota_verify *v, u8_t byte, u8_t len)
+{
+	v->field[v->field_len++] = byte;
+	if (v->field_len < len) {
+		return false;
+	}
+
+	v->field_len = 0U;
+	return true;
+}
+
+static int parse_header(struct fota_verify *v)
+{
+	u16_t hdr_size;
+	u32_t img_size;
+
+	if (sys_get_le32(v->field) != IMAGE_MAGIC) {
+		return fail(v, -EINVAL, "bad magic");
+	}
+
+	hdr_size = sys_get_le16(v->field + IMAGE_HEADER_HDR_SIZE_OFF);
+	img_size = sys_get_le32(v->field + IMAGE_HEADER_IMG_SIZE_OFF);
+	if (hdr_size < IMAGE_HEADER_PARSE_LEN) {
+		return fail(v, -EINVAL, "header too short");
+	}
+
+	v->hashed_end = hdr_size + img_size;
+	v->state = FOTA_VERIFY_BODY;
+	return 0;
+}
+
+/*
+ * A protected TLV area is covered by the hash, so it is hashed like
+ * the body; the unprotected area holds the digest.
+ */
+static int parse_tlv_info(struct fota_verify *v)
+{
+	u16_t magic = sys_get_le16(v->field);
+	u16_t tot_len = sys_get_le16(v->field + 2);
+
+	if (tot_len < IMAGE_TLV_INFO_LEN) {
+		return fail(v, -EINVAL, "bad TLV area length");
+	}
+
+	if (magic == IMAGE_TLV_PROT_INFO_MAGIC &&
+	    v->offset == v->hashed_end + IMAGE_TLV_INFO_LEN) {
+		hash(v, v->field, IMAGE_TLV_INFO_LEN);
+		v->hashed_end += tot_len;
+		v->state = FOTA_VERIFY_BODY;
+		return 0;
+	}
+
+	if (magic != IMAGE_TLV_INFO_MAGIC) {
+		return fail(v, -EINVAL, "bad TLV magic");
+	}
+
+	v->tlv_end = v->offset - IMAGE_TLV_INFO_LEN + tot_len;
+	v->state = v->offset < v->tlv_end ?
+		FOTA_VERIFY_TLV_HEADER : FOTA_VERIFY_DONE;
+	return 0;
+}
+
+static int parse_tlv_header(struct fota_verify *v)
+{
+	u8_t type = v->field[0];
+	u16_t len = sys_get_le16(v->field + 2);
+
+	v->value_left = len;
+	v->value_is_digest = type == IMAGE_TLV_SHA256 &&
+		len == FOTA_VERIFY_DIGEST_LEN;
+	v->state = len ? FOTA_VERIFY_TLV_VALUE : FOTA_VERIFY_TLV_HEADER;
+	return 0;
+}
+
+static int parse_byte(struct fota_verify *v, u8_t byte)
+{
+	int ret = 0;
+
+	switch (v->state) {
+	case FOTA_VERIFY_HEADER:
+		hash(v, &byte, 1);
+		if (collect(v, byte, IMAGE_HEADER_PARSE_LEN)) {
+			ret = parse_header(v);
+		}
+		break;
+	case FOTA_VERIFY_TLV_INFO:
+		if (collect(v, byte, IMAGE_TLV_INFO_LEN)) {
+			ret = parse_tlv_info(v);
+		}
+		break;
+	case FOTA_VERIFY_TLV_HEADER:
+		if (collect(v, byte, IMAGE_TLV_HEADER_LEN)) {
+			ret = parse_tlv_header(v);
+		}
+		break;
+	case FOTA_VERIFY_TLV_VALUE:
+		if (v->value_is_digest) {
+			v->expected[FOTA_VERIFY_DIGEST_LEN - v->value_left] =
+				byte;
+			if (v->value_left == 1) {
+				v->expected_len = FOTA_VERIFY_DIGEST_LEN;
+			}
+		}
+		if (--v->value_left == 0) {
+			v->state = FOTA_VERIFY_TLV_HEADER;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (v->state == FOTA_VERIFY_TLV_HEADER && v->offset >= v->tlv_end) {
+		v->state = FOTA_VERIFY_DONE;
+	}
+
+	return ret;
+}
+
+void fota_verify_start(struct fota_verify *v)
+{
+	memset(v, 0, sizeof(*v));
+	mbedtls_sha256_init(&v->sha);
+	mbedtls_sha256_starts_ret(&v->sha, 0);
+	v->state = FOTA_VERIFY_HEADER;
+}
+
+int fota_verify_update(struct fota_verify *v, const u8_t *data, size_t len)
+{
+	size_t n;
+	int ret;
+
+	while (len && !v->error) {
+		if (v->state == FOTA_VERIFY_BODY) {
+			/* Hash the body in bulk. */
+			n = MIN(len, v->hashed_end - v->offset);
+			hash(v, data, n);
+			v->offset += n;
+			data += n;
+			len -= n;
+			if (v->offset == v->hashed_end) {
+				v->state = FOTA_VERIFY_TLV_INFO;
+			}
+			continue;
+		}
+
+		if (v->state == FOTA_VERIFY_DONE) {
+			/* Padding after the TLVs. */
+			break;
+		}
+
+		v->offset++;
+		ret = parse_byte(v, *data++);
+		len--;
+		if (ret) {
+			return ret;
+		}
+	}
+
+	return v->error;
+}
+
+int fota_verify_finish(struct fota_verify *v)
+{
+	u8_t digest[FOTA_VERIFY_DIGEST_LEN];
+	int ret;
+
+	ret = mbedtls_sha256_finish_ret(&v->sha, digest);
+	mbedtls_sha256_free(&v->sha);
+	if (ret) {
+		LOG_ERR("SHA-256 failed: %d", ret);
+		return -EIO;
+	}
+
+	if (v->error) {
+		return v->error;
+	}
+
+	if (v->expected_len != FOTA_VERIFY_DIGEST_LEN) {
+		LOG_ERR("Image has no SHA-256 TLV");
+		return -EINVAL;
+	}
+
+	if (memcmp(digest, v->expected, sizeof(digest))) {
+		LOG_ERR("Image SHA-256 mismatch");
+		return -EFAULT;
+	}
+
+	LOG_INF("Image SHA-256 verified");
+	return 0;
+}
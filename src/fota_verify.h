@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_VERIFY_H__
+#define FOTA_VERIFY_H__
+
+/**
+ * @file
+ * @brief Streaming verification of MCUboot images.
+ *
+ * The SHA-256 of the image header and body is computed as the image
+ * is downloaded, and compared against the SHA-256 TLV MCUboot itself
+ * checks, which follows the body. A corrupted download is rejected
+ * before the update is requested, without reading the slot back.
+ */
+
+#include <zephyr/types.h>
+#include <mbedtls/sha256.h>
+
+#define FOTA_VERIFY_DIGEST_LEN 32
+
+enum fota_verify_state {
+	FOTA_VERIFY_HEADER,
+	FOTA_VERIFY_BODY,
+	FOTA_VERIFY_TLV_INFO,
+	FOTA_VERIFY_TLV_HEADER,
+	FOTA_VERIFY_TLV_VALUE,
+	FOTA_VERIFY_DONE,
+};
+
+struct fota_verify {
+	mbedtls_sha256_context sha;
+	enum fota_verify_state state;
+	/* Image offset of the next byte. */
+	u32_t offset;
+	/* End of the hashed area, once known. */
+	u32_t hashed_end;
+	/* End of the current TLV area, once known. */
+	u32_t tlv_end;
+	/* Header, TLV info or TLV header being collected. */
+	u8_t field[16];
+	u8_t field_len;
+	/* Bytes left in the current TLV value. */
+	u16_t value_left;
+	bool value_is_digest;
+	u8_t expected[FOTA_VERIFY_DIGEST_LEN];
+	u8_t expected_len;
+	int error;
+};
+
+/** @brief Start verifying a new image. */
+void fota_verify_start(struct fota_verify *v);
+
+/**
+ * @brief Feed the next part of the image.
+ *
+ * @return 0 on success, negative errno if the image is malformed.
+ */
+int fota_verify_update(struct fota_verify *v, const u8_t *data, size_t len);
+
+/**
+ * @brief Check the digest of the whole image.
+ *
+ * @return 0 if it matches, -EFAULT if it doesn't, another negative
+ *         errno if the image is malformed or has no SHA-256 TLV.
+ */
+int fota_verify_finish(struct fota_verify *v);
+
+#endif	/* FOTA_VERIFY_H__ */
@@ -12,17 +12,31 @@
 LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #include <zephyr.h>
+#include <string.h>
+#include <misc/byteorder.h>
 #include <net/lwm2m.h>
 
 #include "light_control_priv.h"
+#include "app_work_queue.h"
+#include "persist.h"
 
-/*
- * Singleton light controller in use.
- *
- * TODO: support multiple instances.
- */
-static struct ipso_light_ctl *ilc;
-static K_SEM_DEFINE(ilc_sem, 1, 1);
+/* Registered light controllers, indexed by object instance ID. */
+static struct ipso_light_ctl *ilcs[CONFIG_APP_LIGHT_INSTANCES_MAX];
+static u16_t ilc_count;
+
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+#define FRAME_PERIOD_MS (MSEC_PER_SEC / CONFIG_APP_LIGHT_TRANSITION_FPS)
+#endif
+
+static struct ipso_light_ctl *ilc_get(u16_t obj_inst_id)
+{
+	if (obj_inst_id >= ilc_count) {
+		LOG_ERR("No light control instance %u", obj_inst_id);
+		return NULL;
+	}
+
+	return ilcs[obj_inst_id];
+}
 
 static u8_t char_to_nibble(char c)
 {
@@ -71,24 +85,512 @@ int light_control_parse_rgb(char *color, u16_t color_len, u8_t rgb[3])
 	return 0;
 }
 
+/* Resource paths relative to the instance, indexed by enum ilc_rsrc_id. */
+static const struct {
+	const char *obj;
+	const char *res;
+} ilc_rsrc_ids[ILC_RSRC_COUNT] = {
+	[ILC_RSRC_ONOFF] = { "3311", IPSO_LIGHT_CTL_ONOFF },
+	[ILC_RSRC_DIMMER] = { "3311", IPSO_LIGHT_CTL_DIMMER },
+	[ILC_RSRC_ON_TIME] = { "3311", IPSO_LIGHT_CTL_ON_TIME },
+	[ILC_RSRC_SNS_UNIT] = { "3311", IPSO_LIGHT_CTL_SNS_UNIT },
+	[ILC_RSRC_COLOR] = { "3311", IPSO_LIGHT_CTL_COLOR },
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+	[ILC_RSRC_TRANSITION_TIME] = { LWM2M_OBJECT_LIGHT_EXT,
+				       LIGHT_EXT_TRANSITION_TIME },
+#endif
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+	[ILC_RSRC_PIXELS] = { LWM2M_OBJECT_LIGHT_EXT, LIGHT_EXT_PIXELS },
+#endif
+};
+
+/*
+ * Format each resource path and look up its storage in the engine,
+ * once, so the ilc_get_* and ilc_set_* helpers don't have to.
+ *
+ * This must be called after the object instances have been created.
+ */
+static int resolve_resources(struct ipso_light_ctl *ilc)
+{
+	struct ilc_rsrc *rsrc;
+	u8_t flags;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < ILC_RSRC_COUNT; i++) {
+		rsrc = &ilc->rsrc[i];
+
+		snprintk(rsrc->path, sizeof(rsrc->path), "%s/%u/%s",
+			 ilc_rsrc_ids[i].obj, ilc->inst_id,
+			 ilc_rsrc_ids[i].res);
+
+		ret = lwm2m_engine_get_res_data(rsrc->path, &rsrc->data,
+						&rsrc->data_len, &flags);
+		if (ret < 0) {
+			LOG_ERR("Can't resolve %s: %d", rsrc->path, ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Must be called with ilc->lock held. */
+static int set_frame(struct ipso_light_ctl *ilc, const struct ilc_frame *frame)
+{
+	int ret;
+
+	ret = ilc->set_frame(ilc, frame);
+	if (ret) {
+		LOG_ERR("Failed to update light %u: %d", ilc->inst_id, ret);
+		return ret;
+	}
+
+	ilc->cur_frame = *frame;
+	return 0;
+}
+
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+static u8_t interpolate(u8_t from, u8_t to, u16_t step, u16_t steps)
+{
+	return from + ((int)to - (int)from) * step / steps;
+}
+
+static void transition_frame(struct k_work *work)
+{
+	struct ipso_light_ctl *ilc =
+		CONTAINER_OF(work, struct ipso_light_ctl,
+			     transition.frame_work);
+	struct ilc_transition *transition = &ilc->transition;
+	struct ilc_frame frame;
+	u32_t start;
+	size_t i;
+
+	k_sem_take(&ilc->lock, K_FOREVER);
+
+	/* Lost a race with transition_start() or transition_stop(). */
+	if (!transition->active) {
+		goto out;
+	}
+
+	transition->step++;
+	for (i = 0; i < ARRAY_SIZE(frame.rgb); i++) {
+		frame.rgb[i] = interpolate(transition->from.rgb[i],
+					   transition->to.rgb[i],
+					   transition->step,
+					   transition->steps);
+	}
+	frame.dimmer = interpolate(transition->from.dimmer,
+				   transition->to.dimmer,
+				   transition->step, transition->steps);
+
+	start = k_cycle_get_32();
+	(void)set_frame(ilc, &frame);
+	transition->frame_cycles += k_cycle_get_32() - start;
+
+	if (transition->step == transition->steps) {
+		k_timer_stop(&transition->timer);
+		transition->active = false;
+		LOG_DBG("Light %u transition done, %u cycles/frame "
+			"over %u frames", ilc->inst_id,
+			transition->frame_cycles / transition->steps,
+			transition->steps);
+	}
+
+out:
+	k_sem_give(&ilc->lock);
+}
+
+static void transition_timer_expired(struct k_timer *timer)
+{
+	struct ipso_light_ctl *ilc =
+		CONTAINER_OF(timer, struct ipso_light_ctl, transition.timer);
+
+	app_wq_submit_to(APP_WQ_URGENT, &ilc->transition.frame_work);
+}
+
+/* Must be called with ilc->lock held. */
+static void transition_stop(struct ipso_light_ctl *ilc)
+{
+	if (ilc->transition.active) {
+		k_timer_stop(&ilc->transition.timer);
+		ilc->transition.active = false;
+	}
+}
+
+/*
+ * Start a transition from the frame currently displayed to the
+ * target, or jump straight to the target if no transition time is
+ * configured. Must be called with ilc->lock held.
+ */
+static int transition_start(struct ipso_light_ctl *ilc,
+			    const struct ilc_frame *target)
+{
+	struct ilc_transition *transition = &ilc->transition;
+	u32_t transition_time = 0;
+	u32_t steps;
+
+	(void)ilc_get_transition_time(ilc, &transition_time);
+	steps = transition_time / FRAME_PERIOD_MS;
+
+	transition_stop(ilc);
+
+	if (steps <= 1 ||
+	    !memcmp(&ilc->cur_frame, target, sizeof(*target))) {
+		return set_frame(ilc, target);
+	}
+
+	transition->from = ilc->cur_frame;
+	transition->to = *target;
+	transition->step = 0;
+	transition->steps = MIN(steps, UINT16_MAX);
+	transition->frame_cycles = 0;
+	transition->active = true;
+	k_timer_start(&transition->timer, FRAME_PERIOD_MS, FRAME_PERIOD_MS);
+
+	return 0;
+}
+
+static bool transition_active(struct ipso_light_ctl *ilc)
+{
+	return ilc->transition.active;
+}
+
+static void transition_init(struct ipso_light_ctl *ilc)
+{
+	k_work_init(&ilc->transition.frame_work, transition_frame);
+	k_timer_init(&ilc->transition.timer, transition_timer_expired, NULL);
+}
+#else
+static inline int transition_start(struct ipso_light_ctl *ilc,
+				   const struct ilc_frame *target)
+{
+	return set_frame(ilc, target);
+}
+
+static inline void transition_stop(struct ipso_light_ctl *ilc)
+{
+}
+
+static inline bool transition_active(struct ipso_light_ctl *ilc)
+{
+	return false;
+}
+
+static inline void transition_init(struct ipso_light_ctl *ilc)
+{
+}
+#endif	/* CONFIG_APP_LIGHT_TRANSITION */
+
+/*
+ * Compute the frame for the light's current on/off, dimmer and color
+ * state. Must be called with ilc->lock held.
+ */
+static int get_target(struct ipso_light_ctl *ilc, struct ilc_frame *target)
+{
+	bool on;
+	int ret;
+
+	ret = ilc_get_onoff(ilc, &on);
+	if (ret) {
+		LOG_ERR("Failed to get onoff: %d", ret);
+		return ret;
+	}
+
+	ret = ilc_get_dimmer(ilc, &target->dimmer);
+	if (ret) {
+		LOG_ERR("Failed to get dimmer: %d", ret);
+		return ret;
+	}
+
+	if (!on) {
+		target->dimmer = 0U;
+	} else if (target->dimmer > 100) {
+		target->dimmer = 100U;
+	}
+
+	memcpy(target->rgb, ilc->color_rgb, sizeof(target->rgb));
+
+	return 0;
+}
+
+/*
+ * Bring the light to its current on/off, dimmer and color state.
+ * Must be called with ilc->lock held.
+ */
+static int update_light(struct ipso_light_ctl *ilc)
+{
+	struct ilc_frame target;
+	int ret;
+
+	ret = get_target(ilc, &target);
+	if (ret) {
+		return ret;
+	}
+
+	return transition_start(ilc, &target);
+}
+
+/*
+ * Bring the light back to its current state, unless a transition is
+ * running, in which case its next frame takes care of it. Either
+ * way, any writes which arrived during the flash window take
+ * precedence over the state from before the flash.
+ */
+static void flash_restore(struct k_work *work)
+{
+	struct ipso_light_ctl *ilc =
+		CONTAINER_OF(work, struct ipso_light_ctl,
+			     flash_restore_work.work);
+	int ret = 0;
+
+	k_sem_take(&ilc->lock, K_FOREVER);
+	if (!transition_active(ilc)) {
+		ret = update_light(ilc);
+	}
+	k_sem_give(&ilc->lock);
+
+	if (ret) {
+		LOG_ERR("Failed to restore light after flash: %d", ret);
+	}
+}
+
+/*
+ * Resource writes only mark the light as needing an update; this
+ * applies them all at once, so a composite write of on/off, dimmer
+ * and color results in a single backend update.
+ */
+static void update_flush(struct k_work *work)
+{
+	struct ipso_light_ctl *ilc =
+		CONTAINER_OF(work, struct ipso_light_ctl, update_work.work);
+	int ret = 0;
+
+	k_sem_take(&ilc->lock, K_FOREVER);
+	if (ilc->update_pending) {
+		ilc->update_pending = false;
+		ret = update_light(ilc);
+	}
+	k_sem_give(&ilc->lock);
+
+	if (ret) {
+		LOG_ERR("Failed to update light %u: %d", ilc->inst_id, ret);
+	}
+}
+
+/* Set while a light's restored state replaces its defaults. */
+static bool restoring;
+
+#if defined(CONFIG_LWM2M_PERSIST_SETTINGS)
+#define STATE_VERSION 1
+
+/*
+ * Saved state of a light. It is restored before the LwM2M objects
+ * are set up, so the light can come back as it was straight away,
+ * without showing its defaults first.
+ */
+struct ilc_state {
+	u8_t on;
+	u8_t dimmer;
+	u8_t rgb[3];
+	/* Little endian. */
+	u8_t transition_time[4];
+} __packed;
+
+/* Saved state of all lights, as one part of the persisted state. */
+struct ilc_state_record {
+	u8_t version;
+	struct ilc_state light[CONFIG_APP_LIGHT_INSTANCES_MAX];
+} __packed;
+
+/* The most instances must fit, besides the other parts. */
+BUILD_ASSERT_MSG(PERSIST_RECORD_OVERHEAD + sizeof(struct ilc_state_record) <=
+		 CONFIG_APP_PERSIST_RECORD_SIZE,
+		 "CONFIG_APP_PERSIST_RECORD_SIZE too small for "
+		 "CONFIG_APP_LIGHT_INSTANCES_MAX lights");
+
+static struct ilc_state_record state;
+
+/* Called before the state is saved, to bring the record up to date. */
+static void state_refresh(void)
+{
+	struct ipso_light_ctl *ilc;
+	struct ilc_state *s;
+	u32_t transition_time = 0U;
+	bool on = false;
+	u16_t i;
+
+	state.version = STATE_VERSION;
+	for (i = 0U; i < ilc_count; i++) {
+		ilc = ilcs[i];
+		s = &state.light[i];
+
+		k_sem_take(&ilc->lock, K_FOREVER);
+		(void)ilc_get_onoff(ilc, &on);
+		s->on = on;
+		(void)ilc_get_dimmer(ilc, &s->dimmer);
+		memcpy(s->rgb, ilc->color_rgb, sizeof(s->rgb));
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+		(void)ilc_get_transition_time(ilc, &transition_time);
+#endif
+		sys_put_le32(transition_time, s->transition_time);
+		k_sem_give(&ilc->lock);
+	}
+}
+
+/*
+ * Show the restored state, straight through the backend. Called
+ * once the backend is set up, before the defaults are written.
+ */
+static void state_show(struct ipso_light_ctl *ilc)
+{
+	const struct ilc_state *s = &state.light[ilc->inst_id];
+	struct ilc_frame frame;
+
+	restoring = state.version == STATE_VERSION;
+	if (!restoring) {
+		return;
+	}
+
+	memcpy(frame.rgb, s->rgb, sizeof(frame.rgb));
+	frame.dimmer = s->on ? MIN(s->dimmer, 100) : 0U;
+
+	k_sem_take(&ilc->lock, K_FOREVER);
+	memcpy(ilc->color_rgb, s->rgb, sizeof(ilc->color_rgb));
+	(void)set_frame(ilc, &frame);
+	k_sem_give(&ilc->lock);
+
+	LOG_INF("Light %u state restored %u ms after boot", ilc->inst_id,
+		k_uptime_get_32());
+}
+
+/*
+ * Write the restored state over the defaults in the engine. The
+ * update this schedules finds the frame already shown.
+ */
+static int state_restore(struct ipso_light_ctl *ilc)
+{
+	const struct ilc_state *s = &state.light[ilc->inst_id];
+	char color[sizeof("#rrggbb")];
+	int ret;
+
+	if (!restoring) {
+		return 0;
+	}
+
+	snprintk(color, sizeof(color), "#%02X%02X%02X",
+		 s->rgb[0], s->rgb[1], s->rgb[2]);
+
+	ret = ilc_set_dimmer(ilc, s->dimmer);
+	if (ret < 0) {
+		goto out;
+	}
+
+	ret = ilc_set_color(ilc, color);
+	if (ret < 0) {
+		goto out;
+	}
+
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+	ret = ilc_set_transition_time(ilc,
+				      sys_get_le32(s->transition_time));
+	if (ret < 0) {
+		goto out;
+	}
+#endif
+
+	ret = ilc_set_onoff(ilc, s->on);
+
+out:
+	restoring = false;
+	return ret < 0 ? ret : 0;
+}
+
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+/* The transition time has no callback of its own to touch the state. */
+static int transition_time_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
+			      bool last_block, size_t total_size)
+{
+	persist_touch();
+	return 0;
+}
+#endif
+
+/*
+ * Persist the lights' state, as a single part. Must be called
+ * before the settings are loaded, and before init_light_control(),
+ * which applies the restored state.
+ */
+int light_control_persist(void)
+{
+	return persist_add_part("light", &state,
+				offsetof(struct ilc_state_record, light) +
+				ilc_count * sizeof(struct ilc_state),
+				state_refresh);
+}
+#else
+static inline void state_show(struct ipso_light_ctl *ilc)
+{
+}
+
+static inline int state_restore(struct ipso_light_ctl *ilc)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Schedule an update for the end of the coalescing window, which
+ * starts at the first write after the previous update: later writes
+ * don't push it back. While the restored state is written over the
+ * defaults, the update is always deferred, so the defaults don't
+ * show. Must be called with ilc->lock held.
+ */
+static int update_schedule(struct ipso_light_ctl *ilc)
+{
+	if (!CONFIG_APP_LIGHT_COALESCE_MS && !restoring) {
+		return update_light(ilc);
+	}
+
+	if (!ilc->update_pending) {
+		ilc->update_pending = true;
+		app_wq_submit_delayed_to(APP_WQ_URGENT, &ilc->update_work,
+					 CONFIG_APP_LIGHT_COALESCE_MS);
+	}
+
+	return 0;
+}
+
 int light_control_register(struct ipso_light_ctl *light_control)
 {
-	if (ilc) {
+	if (ilc_count >= ARRAY_SIZE(ilcs)) {
 		return -ENOMEM;
-	} else {
-		ilc = light_control;
-		return 0;
 	}
+
+	light_control->inst_id = ilc_count;
+	k_sem_init(&light_control->lock, 1, 1);
+	k_delayed_work_init(&light_control->flash_restore_work,
+			    flash_restore);
+	k_delayed_work_init(&light_control->update_work, update_flush);
+	transition_init(light_control);
+
+	ilcs[ilc_count++] = light_control;
+	return 0;
 }
 
 /* TODO: Move to a pre write hook that can handle ret codes once available */
 static int on_off_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
 		     bool last_block, size_t total_size)
 {
+	struct ipso_light_ctl *ilc = ilc_get(obj_inst_id);
 	bool on;
 	int ret = 0;
 
-	k_sem_take(&ilc_sem, K_FOREVER);
+	if (!ilc) {
+		return -ENOENT;
+	}
+
+	k_sem_take(&ilc->lock, K_FOREVER);
 
 	if (data_len != 1) {
 		LOG_ERR("Length of on_off callback data is incorrect! (%u)",
@@ -97,8 +599,9 @@ static int on_off_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
 	}
 
 	on = *data;
+	persist_touch();
 
-	ret = ilc->on_off_cb(ilc, on);
+	ret = update_schedule(ilc);
 	if (ret) {
 		goto out;
 	}
@@ -108,7 +611,7 @@ static int on_off_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
 	}
 
 out:
-	k_sem_give(&ilc_sem);
+	k_sem_give(&ilc->lock);
 	return ret;
 }
 
@@ -116,20 +619,30 @@ out:
 static int dimmer_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
 		     bool last_block, size_t total_size)
 {
+	struct ipso_light_ctl *ilc = ilc_get(obj_inst_id);
 	u8_t dimmer = *data;
 	int ret;
 
-	k_sem_take(&ilc_sem, K_FOREVER);
+	if (!ilc) {
+		return -ENOENT;
+	}
 
 	if (dimmer > 100) {
 		LOG_ERR("Invalid dimmer value %u, forcing it to 100",
 			dimmer);
-		dimmer = 100;
+		/*
+		 * Through the engine, so observers see the value used.
+		 * This comes back here, so not with the lock held.
+		 */
+		return ilc_set_dimmer(ilc, 100);
 	}
 
-	ret = ilc->dimmer_cb(ilc, dimmer);
+	k_sem_take(&ilc->lock, K_FOREVER);
+
+	persist_touch();
+	ret = update_schedule(ilc);
 
-	k_sem_give(&ilc_sem);
+	k_sem_give(&ilc->lock);
 	return ret;
 }
 
@@ -137,91 +650,233 @@ static int dimmer_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
 static int color_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
 		    bool last_block, size_t total_size)
 {
+	struct ipso_light_ctl *ilc = ilc_get(obj_inst_id);
+	char *color = (char *)data;
 	int ret;
 
-	k_sem_take(&ilc_sem, K_FOREVER);
-	ret = ilc->color_cb(ilc, (char *)data, data_len);
-	k_sem_give(&ilc_sem);
+	if (!ilc) {
+		return -ENOENT;
+	}
 
+	k_sem_take(&ilc->lock, K_FOREVER);
+
+	ret = light_control_parse_rgb(color, strlen(color), ilc->color_rgb);
+	if (ret) {
+		goto out;
+	}
+
+	LOG_DBG("Light %u RGB color updated to #%02x%02x%02x", ilc->inst_id,
+		ilc->color_rgb[0], ilc->color_rgb[1], ilc->color_rgb[2]);
+
+	persist_touch();
+	ret = update_schedule(ilc);
+
+out:
+	k_sem_give(&ilc->lock);
 	return ret;
 }
 
-int init_light_control(void)
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+/*
+ * Pixel data is a big-endian 16-bit index of the first pixel to set,
+ * followed by an RGB triplet for each pixel from there on.
+ */
+static int pixels_cb(u16_t obj_inst_id, u8_t *data, u16_t data_len,
+		     bool last_block, size_t total_size)
 {
+	struct ipso_light_ctl *ilc = ilc_get(obj_inst_id);
+	struct ilc_frame target;
 	int ret;
 
 	if (!ilc) {
-		ret = -ENODEV;
-		goto fail;
+		return -ENOENT;
+	}
+
+	if (data_len < 2 || (data_len - 2) % 3) {
+		LOG_ERR("Invalid pixel data length %u", data_len);
+		return -EINVAL;
 	}
 
-	/* Only one instance (ID 0) is supported. */
-	ret = lwm2m_engine_create_obj_inst("3311/0");
+	k_sem_take(&ilc->lock, K_FOREVER);
+
+	/* Per-pixel colors apply at the current dimmer level. */
+	transition_stop(ilc);
+
+	/*
+	 * Apply writes from earlier in the same message first, without
+	 * a transition, or a new color would override these pixels.
+	 */
+	if (ilc->update_pending) {
+		ilc->update_pending = false;
+		k_delayed_work_cancel(&ilc->update_work);
+
+		ret = get_target(ilc, &target);
+		if (!ret) {
+			ret = set_frame(ilc, &target);
+		}
+		if (ret) {
+			goto out;
+		}
+	}
+
+	ret = ilc->set_pixels(ilc, sys_get_be16(data), data + 2,
+			      (data_len - 2) / 3);
+
+out:
+
+	k_sem_give(&ilc->lock);
+	return ret;
+}
+#endif
+
+static int init_instance(struct ipso_light_ctl *ilc)
+{
+	char path[sizeof("3311/65535")];
+	int ret;
+
+	snprintk(path, sizeof(path), "3311/%u", ilc->inst_id);
+	ret = lwm2m_engine_create_obj_inst(path);
+	if (ret < 0) {
+		return ret;
+	}
+
+#if defined(CONFIG_APP_LIGHT_EXT_OBJ)
+	snprintk(path, sizeof(path), LWM2M_OBJECT_LIGHT_EXT "/%u",
+		 ilc->inst_id);
+	ret = lwm2m_engine_create_obj_inst(path);
 	if (ret < 0) {
-		goto fail;
+		return ret;
+	}
+#endif
+
+	ret = resolve_resources(ilc);
+	if (ret < 0) {
+		return ret;
 	}
 
-	ilc->inst_id = 0;
 	ret = ilc->pre_init(ilc);
 	if (ret < 0) {
-		goto fail;
+		return ret;
+	}
+
+	state_show(ilc);
+
+	ret = lwm2m_engine_register_post_write_callback(
+		ilc->rsrc[ILC_RSRC_ONOFF].path, on_off_cb);
+	if (ret < 0) {
+		return ret;
 	}
 
-	ret = lwm2m_engine_register_post_write_callback("3311/0/5850",
-							on_off_cb);
+	ret = lwm2m_engine_register_post_write_callback(
+		ilc->rsrc[ILC_RSRC_DIMMER].path, dimmer_cb);
 	if (ret < 0) {
-		goto fail;
+		return ret;
 	}
 
-	ret = lwm2m_engine_register_post_write_callback("3311/0/5851",
-							dimmer_cb);
+	ret = lwm2m_engine_register_post_write_callback(
+		ilc->rsrc[ILC_RSRC_COLOR].path, color_cb);
 	if (ret < 0) {
-		goto fail;
+		return ret;
 	}
 
-	ret = lwm2m_engine_register_post_write_callback("3311/0/5706",
-							color_cb);
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+	if (ilc->set_pixels) {
+		ret = lwm2m_engine_register_post_write_callback(
+			ilc->rsrc[ILC_RSRC_PIXELS].path, pixels_cb);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+#endif
+
+#if defined(CONFIG_LWM2M_PERSIST_SETTINGS) && \
+	defined(CONFIG_APP_LIGHT_TRANSITION)
+	ret = lwm2m_engine_register_post_write_callback(
+		ilc->rsrc[ILC_RSRC_TRANSITION_TIME].path, transition_time_cb);
 	if (ret < 0) {
-		goto fail;
+		return ret;
 	}
+#endif
 
 	ret = ilc->post_init(ilc);
 	if (ret < 0) {
-		goto fail;
+		return ret;
 	}
 
+	return state_restore(ilc);
+}
+
+int init_light_control(void)
+{
+	u16_t i;
+	int ret;
+
+	if (!ilc_count) {
+		return -ENODEV;
+	}
+
+	for (i = 0; i < ilc_count; i++) {
+		ret = init_instance(ilcs[i]);
+		if (ret < 0) {
+			LOG_ERR("Failed to initialize light %u: %d", i, ret);
+			return ret;
+		}
+	}
+
+	LOG_INF("%u light control instance(s)", ilc_count);
 	return 0;
+}
+
+static int flash_instance(struct ipso_light_ctl *ilc,
+			  u8_t r, u8_t g, u8_t b, s32_t duration)
+{
+	int ret;
 
-fail:
+	k_sem_take(&ilc->lock, K_FOREVER);
+
+	/* Don't let a transition frame overwrite the flash. */
+	transition_stop(ilc);
+
+	ret = ilc->flash(ilc, r, g, b);
+
+	/*
+	 * Restore even on error, in case the backend got partway.
+	 * Resubmitting while a restore is pending just pushes it back.
+	 */
+	app_wq_submit_delayed_to(APP_WQ_URGENT, &ilc->flash_restore_work,
+				 duration);
+
+	k_sem_give(&ilc->lock);
 	return ret;
 }
 
 int light_control_flash(u8_t r, u8_t g, u8_t b, s32_t duration)
 {
-	int ret;
+	bool supported = false;
+	int ret = 0;
+	u16_t i;
 
-	k_sem_take(&ilc_sem, K_FOREVER);
-	if (!ilc) {
+	if (!ilc_count) {
 		LOG_ERR("no light registered but flash called");
-		ret = -ENODEV;
-	} else if (!ilc->flash) {
+		return -ENODEV;
+	}
+
+	for (i = 0; i < ilc_count; i++) {
+		if (!ilcs[i]->flash) {
+			continue;
+		}
+
+		supported = true;
+		ret = flash_instance(ilcs[i], r, g, b, duration);
+		if (ret) {
+			break;
+		}
+	}
+
+	if (!supported) {
 		LOG_WRN("light control object doesn't support flashing");
-		ret = -EINVAL;
-	} else {
-		ret = ilc->flash(ilc, r, g, b, duration);
+		return -ENOTSUP;
 	}
-	k_sem_give(&ilc_sem);
-	return ret;
-}
 
-#if defined(CONFIG_LWM2M_PERSIST_SETTINGS)
-void light_control_persist(void)
-{
-	/* save on/off state */
-	lwm2m_engine_set_persist("3311/0/5850");
-	/* save dimmer state */
-	lwm2m_engine_set_persist("3311/0/5851");
-	/* saver color */
-	lwm2m_engine_set_persist("3311/0/5706");
+	return ret;
 }
-#endif
@@ -9,7 +9,7 @@
 #define FOTA_LIGHT_CONTROL_H__
 
 int init_light_control(void);
-void light_control_persist(void);
+int light_control_persist(void);
 int light_control_flash(u8_t r, u8_t g, u8_t b, s32_t duration);
 
 #endif	/* FOTA_LIGHT_CONTROL_H__ */
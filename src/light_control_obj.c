@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Vendor LwM2M object extending IPSO light control.
+ *
+ * This holds per-light settings which the IPSO light control object
+ * (3311) has no resources for. Instance N applies to 3311 instance N.
+ */
+
+#define LOG_MODULE_NAME fota_light_obj
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <init.h>
+
+#include "lwm2m_object.h"
+#include "lwm2m_vendor.h"
+
+/* resource IDs */
+#define LIGHT_EXT_TRANSITION_TIME_ID	0
+#define LIGHT_EXT_PIXELS_ID		1
+
+#define LIGHT_EXT_MAX_ID		2
+
+#define MAX_INSTANCE_COUNT		CONFIG_APP_LIGHT_INSTANCES_MAX
+
+/* resource state variables */
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+static u32_t transition_time[MAX_INSTANCE_COUNT];
+#endif
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+static u8_t pixels[MAX_INSTANCE_COUNT][CONFIG_APP_LIGHT_PIXELS_MAX_LEN];
+#endif
+
+static struct lwm2m_engine_obj light_ext;
+static struct lwm2m_engine_obj_field fields[] = {
+	OBJ_FIELD_DATA(LIGHT_EXT_TRANSITION_TIME_ID, RW, U32),
+	OBJ_FIELD_DATA(LIGHT_EXT_PIXELS_ID, W, OPAQUE),
+};
+
+static struct lwm2m_engine_obj_inst inst[MAX_INSTANCE_COUNT];
+static struct lwm2m_engine_res_inst res[MAX_INSTANCE_COUNT][LIGHT_EXT_MAX_ID];
+
+static struct lwm2m_engine_obj_inst *light_ext_create(u16_t obj_inst_id)
+{
+	int index, avail = -1, i = 0;
+
+	/* Check that there is no other instance with this ID */
+	for (index = 0; index < MAX_INSTANCE_COUNT; index++) {
+		if (inst[index].obj && inst[index].obj_inst_id == obj_inst_id) {
+			LOG_ERR("Can not create instance - "
+				"already existing: %u", obj_inst_id);
+			return NULL;
+		}
+
+		if (avail < 0 && !inst[index].obj) {
+			avail = index;
+		}
+	}
+
+	if (avail < 0) {
+		LOG_ERR("Can not create instance - no more room: %u",
+			obj_inst_id);
+		return NULL;
+	}
+
+	(void)memset(res[avail], 0,
+		     sizeof(res[avail][0]) * ARRAY_SIZE(res[avail]));
+
+	/* initialize instance resource data */
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+	transition_time[avail] = CONFIG_APP_LIGHT_TRANSITION_TIME;
+	INIT_OBJ_RES_DATA(res[avail], i, LIGHT_EXT_TRANSITION_TIME_ID,
+			  &transition_time[avail],
+			  sizeof(*transition_time));
+#else
+	INIT_OBJ_RES_DUMMY(res[avail], i, LIGHT_EXT_TRANSITION_TIME_ID);
+#endif
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+	INIT_OBJ_RES_DATA(res[avail], i, LIGHT_EXT_PIXELS_ID,
+			  pixels[avail], sizeof(pixels[avail]));
+#else
+	INIT_OBJ_RES_DUMMY(res[avail], i, LIGHT_EXT_PIXELS_ID);
+#endif
+
+	inst[avail].resources = res[avail];
+	inst[avail].resource_count = i;
+	LOG_DBG("Create light control extension instance: %d", obj_inst_id);
+	return &inst[avail];
+}
+
+static int light_ext_init(struct device *dev)
+{
+	light_ext.obj_id = LWM2M_OBJECT_LIGHT_EXT_ID;
+	light_ext.fields = fields;
+	light_ext.field_count = ARRAY_SIZE(fields);
+	light_ext.max_instance_count = MAX_INSTANCE_COUNT;
+	light_ext.create_cb = light_ext_create;
+	lwm2m_register_obj(&light_ext);
+
+	return 0;
+}
+
+SYS_INIT(light_ext_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
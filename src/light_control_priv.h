@@ -7,9 +7,12 @@
 #ifndef __FOTA_LIGHT_CONTROL_PRIV_H__
 #define __FOTA_LIGHT_CONTROL_PRIV_H__
 
+#include <zephyr.h>
 #include <zephyr/types.h>
 #include <net/lwm2m.h>
 
+#include "lwm2m_vendor.h"
+
 #define IPSO_LIGHT_CTL_ONOFF     "5850"
 #define IPSO_LIGHT_CTL_DIMMER    "5851"
 #define IPSO_LIGHT_CTL_ON_TIME   "5852"
@@ -18,6 +21,64 @@
 #define IPSO_LIGHT_CTL_COLOR     "5706"
 #define IPSO_LIGHT_CTL_SNS_UNIT  "5701"
 
+/* Resources in the vendor light control extension object. */
+#define LIGHT_EXT_TRANSITION_TIME "0"
+#define LIGHT_EXT_PIXELS          "1"
+
+/* Resources accessed through the ilc_get_* and ilc_set_* helpers. */
+enum ilc_rsrc_id {
+	ILC_RSRC_ONOFF,
+	ILC_RSRC_DIMMER,
+	ILC_RSRC_ON_TIME,
+	ILC_RSRC_SNS_UNIT,
+	ILC_RSRC_COLOR,
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+	ILC_RSRC_TRANSITION_TIME,
+#endif
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+	ILC_RSRC_PIXELS,
+#endif
+
+	ILC_RSRC_COUNT,
+};
+
+/**
+ * Pre-resolved handle for a light control object resource.
+ *
+ * The path is formatted once, so setters don't need to snprintk()
+ * on every call, and the data pointer refers directly to the LwM2M
+ * engine's storage for the resource, so getters don't need to go
+ * through the engine's path parser at all.
+ */
+struct ilc_rsrc {
+	/* <obj_id> + "/" + <obj_inst_id> + "/" + <resource_id> + NUL */
+	char path[5 + 1 + 5 + 1 + 4 + 1];
+	void *data;
+	u16_t data_len;
+};
+
+/** A frame of light output: a color, scaled by a dimmer level. */
+struct ilc_frame {
+	u8_t rgb[3];
+	/** Dimmer level, from 0 (off) to 100 (full brightness). */
+	u8_t dimmer;
+};
+
+/* A transition between two frames, see light_control.c. */
+struct ilc_transition {
+	struct ilc_frame from;
+	struct ilc_frame to;
+	u16_t step;
+	u16_t steps;
+	bool active;
+
+	struct k_timer timer;
+	struct k_work frame_work;
+
+	/* For measuring the cost of rendering a frame. */
+	u32_t frame_cycles;
+};
+
 /**
  * Backend abstraction for an LWM2M-based IPSO light control object.
  *
@@ -47,31 +108,66 @@ struct ipso_light_ctl {
 	int (*post_init)(struct ipso_light_ctl *);
 
 	/**
-	 * This is invoked as part of the LWM2M callback installed for
-	 * when the ON/OFF resource is written.
+	 * Render a frame.
+	 *
+	 * This is invoked with the light's current on/off, dimmer and
+	 * color state whenever one of them is written, and with each
+	 * intermediate frame while a transition between two states is
+	 * in progress. It must not sleep, as it may be called at the
+	 * transition frame rate.
+	 */
+	int (*set_frame)(struct ipso_light_ctl *, const struct ilc_frame *);
+
+	/**
+	 * Set the colors of a range of pixels, if supported.
+	 *
+	 * The colors are undimmed 8-bit RGB triplets, and replace the
+	 * frame's color for those pixels until the next color change.
+	 * The backend applies the current dimmer level and updates the
+	 * output.
 	 */
-	int (*on_off_cb)(struct ipso_light_ctl *, bool on);
-	/** This is invoked when dimmer resource is written. */
-	int (*dimmer_cb)(struct ipso_light_ctl *, u8_t dimmer);
-	/** This is invoked when color resource is written. */
-	int (*color_cb)(struct ipso_light_ctl *, char *color, u16_t color_len);
+	int (*set_pixels)(struct ipso_light_ctl *, u16_t start,
+			  const u8_t *rgb, u16_t count);
 
-	/** System hook for flashing an RGB color, if supported. */
-	int (*flash)(struct ipso_light_ctl *, u8_t r, u8_t g, u8_t b,
-		     s32_t duration);
+	/**
+	 * System hook for flashing an RGB color, if supported.
+	 *
+	 * This must show the color and return without sleeping. The
+	 * light is restored by the generic code, by replaying the
+	 * current frame through set_frame once the flash duration has
+	 * elapsed.
+	 */
+	int (*flash)(struct ipso_light_ctl *, u8_t r, u8_t g, u8_t b);
 
 	/**
-	 * Buffer for resource paths.
+	 * Resource handles, resolved once by init_light_control().
 	 *
-	 * "3311" + "/" + <obj_inst_id> + "/" + <resource_id> + NUL
+	 * Indexed by enum ilc_rsrc_id.
 	 */
-	char path_buf[4 + 1 + 4 + 1 + 4 + 1];
+	struct ilc_rsrc rsrc[ILC_RSRC_COUNT];
 
 	/** Cached instance ID */
 	u16_t inst_id;
 
 	/** Private instance data. */
 	void *data;
+
+	/*
+	 * State private to light_control.c, which serializes access to
+	 * it and to the backend callbacks with the per-instance lock.
+	 */
+	struct k_sem lock;
+	/* Last color written, and the frame currently being displayed. */
+	u8_t color_rgb[3];
+	struct ilc_frame cur_frame;
+	/* Restores the light after light_control_flash(). */
+	struct k_delayed_work flash_restore_work;
+	/* Applies resource writes received during the coalescing window. */
+	struct k_delayed_work update_work;
+	bool update_pending;
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+	struct ilc_transition transition;
+#endif
 };
 
 /*
@@ -79,58 +175,83 @@ struct ipso_light_ctl {
  * resources.
  */
 
-static inline char* _ilc_rsrc(struct ipso_light_ctl *ilc, const char *resource)
-{
-	snprintk(ilc->path_buf, sizeof(ilc->path_buf), "3311/%u/%s",
-		 ilc->inst_id, resource);
-	return ilc->path_buf;
-}
-
 static inline int ilc_get_onoff(struct ipso_light_ctl *ilc, bool *on)
 {
-	char *path = _ilc_rsrc(ilc, IPSO_LIGHT_CTL_ONOFF);
-	return lwm2m_engine_get_bool(path, on);
+	struct ilc_rsrc *rsrc = &ilc->rsrc[ILC_RSRC_ONOFF];
+
+	if (!rsrc->data) {
+		return -ENOENT;
+	}
+
+	*on = *(bool *)rsrc->data;
+	return 0;
 }
 
 static inline int ilc_set_onoff(struct ipso_light_ctl *ilc, bool on)
 {
-	char *path = _ilc_rsrc(ilc, IPSO_LIGHT_CTL_ONOFF);
-	return lwm2m_engine_set_bool(path, on);
+	return lwm2m_engine_set_bool(ilc->rsrc[ILC_RSRC_ONOFF].path, on);
 }
 
 static inline int ilc_get_dimmer(struct ipso_light_ctl *ilc, u8_t *dimmer)
 {
-	char *path = _ilc_rsrc(ilc, IPSO_LIGHT_CTL_DIMMER);
-	return lwm2m_engine_get_u8(path, dimmer);
+	struct ilc_rsrc *rsrc = &ilc->rsrc[ILC_RSRC_DIMMER];
+
+	if (!rsrc->data) {
+		return -ENOENT;
+	}
+
+	*dimmer = *(u8_t *)rsrc->data;
+	return 0;
 }
 
 static inline int ilc_set_dimmer(struct ipso_light_ctl *ilc, u8_t dimmer)
 {
-	char *path = _ilc_rsrc(ilc, IPSO_LIGHT_CTL_DIMMER);
-	return lwm2m_engine_set_u8(path, dimmer);
+	return lwm2m_engine_set_u8(ilc->rsrc[ILC_RSRC_DIMMER].path, dimmer);
+}
+
+#if defined(CONFIG_APP_LIGHT_TRANSITION)
+static inline int ilc_get_transition_time(struct ipso_light_ctl *ilc,
+					  u32_t *transition_time)
+{
+	struct ilc_rsrc *rsrc = &ilc->rsrc[ILC_RSRC_TRANSITION_TIME];
+
+	if (!rsrc->data) {
+		return -ENOENT;
+	}
+
+	*transition_time = *(u32_t *)rsrc->data;
+	return 0;
+}
+
+static inline int ilc_set_transition_time(struct ipso_light_ctl *ilc,
+					  u32_t transition_time)
+{
+	return lwm2m_engine_set_u32(ilc->rsrc[ILC_RSRC_TRANSITION_TIME].path,
+				    transition_time);
 }
+#endif
 
 static inline int ilc_set_on_time(struct ipso_light_ctl *ilc, s32_t on_time)
 {
-	char *path = _ilc_rsrc(ilc, IPSO_LIGHT_CTL_ON_TIME);
-	return lwm2m_engine_set_s32(path, on_time);
+	return lwm2m_engine_set_s32(ilc->rsrc[ILC_RSRC_ON_TIME].path,
+				    on_time);
 }
 
 static inline int ilc_set_sensor_units(struct ipso_light_ctl *ilc, char *units)
 {
-	char *path = _ilc_rsrc(ilc, IPSO_LIGHT_CTL_SNS_UNIT);
-	return lwm2m_engine_set_string(path, units);
+	return lwm2m_engine_set_string(ilc->rsrc[ILC_RSRC_SNS_UNIT].path,
+				       units);
 }
 
 static inline int ilc_set_color(struct ipso_light_ctl *ilc, char *color)
 {
-	char *path = _ilc_rsrc(ilc, IPSO_LIGHT_CTL_COLOR);
-	return lwm2m_engine_set_string(path, color);
+	return lwm2m_engine_set_string(ilc->rsrc[ILC_RSRC_COLOR].path, color);
 }
 
 /**
- * Install a backend object. This *must* be invoked by exactly one
- * backend during system initialization at a pre-application priority.
+ * Install a backend object. Each one becomes an instance of the IPSO
+ * light control object, numbered in registration order. This must
+ * be invoked during system initialization, before main() runs.
  */
 int light_control_register(struct ipso_light_ctl *light_control);
 
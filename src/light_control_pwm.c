@@ -9,6 +9,7 @@
  * @brief Light control routines for PWMing individual color channels.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #define LOG_MODULE_NAME fota_light_pwm
@@ -22,6 +23,7 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include <init.h>
 
 #include "light_control_priv.h"
+#include "light_dimming.h"
 
 /* Color Unit used by the IPSO object */
 #define COLOR_UNIT	"hex"
@@ -33,141 +35,240 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 /* Is the light initially on? */
 #define ON_INITIAL              false
 
-/* 100 is more than enough for it to be flicker free */
-#define PWM_PERIOD (USEC_PER_SEC / 100)
+/*
+ * Color calibration coefficients are configured in thousandths, and
+ * applied in fixed point with CAL_SHIFT fractional bits.
+ */
+#define CAL_SHIFT		12
+#define CAL_PERMILLE_MAX	2000
 
-/* Private data type for struct ipso_light_ctl. */
-struct pwm_data {
-	u8_t color_rgb[3];
-/* Support for up to 4 PWM devices */
+/* Most fractional bits in the factors scaling levels to pulse widths. */
+#define SCALE_SHIFT_MAX		16
+
+enum pwm_chan {
+	PWM_CHAN_RED,
+	PWM_CHAN_GREEN,
+	PWM_CHAN_BLUE,
+	PWM_CHAN_WHITE,
+
+	PWM_CHAN_COUNT
+};
+
+/* Static configuration of a color channel. */
+struct pwm_chan_cfg {
+	const char *name;
+	/* NULL if the channel isn't enabled. */
+	const char *dev_name;
+	u32_t pin;
+};
+
+static const struct pwm_chan_cfg pwm_chan_cfg[PWM_CHAN_COUNT] = {
 #if defined(CONFIG_APP_PWM_RED)
-	struct device *red;
+	[PWM_CHAN_RED] = {
+		.name = "red",
+		.dev_name = CONFIG_APP_PWM_RED_DEV,
+		.pin = CONFIG_APP_PWM_RED_PIN,
+	},
 #endif
 #if defined(CONFIG_APP_PWM_GREEN)
-	struct device *green;
+	[PWM_CHAN_GREEN] = {
+		.name = "green",
+		.dev_name = CONFIG_APP_PWM_GREEN_DEV,
+		.pin = CONFIG_APP_PWM_GREEN_PIN,
+	},
 #endif
 #if defined(CONFIG_APP_PWM_BLUE)
-	struct device *blue;
+	[PWM_CHAN_BLUE] = {
+		.name = "blue",
+		.dev_name = CONFIG_APP_PWM_BLUE_DEV,
+		.pin = CONFIG_APP_PWM_BLUE_PIN,
+	},
 #endif
 #if defined(CONFIG_APP_PWM_WHITE)
-	struct device *white;
-	u8_t white_current;
+	[PWM_CHAN_WHITE] = {
+		.name = "white",
+		.dev_name = CONFIG_APP_PWM_WHITE_DEV,
+		.pin = CONFIG_APP_PWM_WHITE_PIN,
+	},
 #endif
 };
 
-static u32_t scale_pulse(u8_t level, u8_t ceiling)
+/* Private data type for struct ipso_light_ctl. */
+struct pwm_data {
+	/* NULL for channels which aren't enabled. */
+	struct device *dev[PWM_CHAN_COUNT];
+	/* PWM period of each channel, in cycles of its PWM clock. */
+	u32_t period[PWM_CHAN_COUNT];
+	/*
+	 * Pulse width per output level, in fixed point with
+	 * scale_shift[] fractional bits: period / LIGHT_DIM_MAX.
+	 */
+	u32_t scale[PWM_CHAN_COUNT];
+	u8_t scale_shift[PWM_CHAN_COUNT];
+	/*
+	 * Calibration, in fixed point: the red, green and blue outputs
+	 * are cal[out][in] times the red, green and blue inputs, with
+	 * the white balance gains folded in. White only has a gain.
+	 */
+	s32_t cal[3][3];
+	s32_t white_gain;
+	/*
+	 * Shadow of the pulse last programmed on each channel, valid
+	 * if the channel's bit is set in pulse_valid. Writes which
+	 * wouldn't change the pulse are skipped.
+	 */
+	u32_t pulse[PWM_CHAN_COUNT];
+	u8_t pulse_valid;
+};
+
+/*
+ * Pulse width in cycles for a channel output level, rounded. This
+ * runs for every channel of every frame, so it takes one 32-bit
+ * multiply, and no 64-bit division.
+ */
+static u32_t scale_pulse(struct pwm_data *data, enum pwm_chan chan,
+			 u16_t level)
 {
-	if (level && ceiling) {
-		/* Scale level based on ceiling and return period */
-		return PWM_PERIOD / 255 * level * ceiling / 255;
-	}
+	u8_t shift = data->scale_shift[chan];
+	u32_t pulse;
 
-	return 0;
+	pulse = (level * data->scale[chan] + (BIT(shift) >> 1)) >> shift;
+
+	return MIN(pulse, data->period[chan]);
 }
 
-static int write_pwm_pin(struct device *pwm_dev, u32_t pwm_pin,
-			 u8_t level, u8_t ceiling)
+/*
+ * Set up scale_pulse() for a channel, with as many fractional bits
+ * as keep its products within 32 bits. At least LIGHT_DIM_BITS of
+ * them, which periods up to 2^20 cycles allow, make full scale give
+ * exactly the period.
+ */
+static void scale_init(struct pwm_data *data, enum pwm_chan chan)
 {
-	u32_t pulse = scale_pulse(level, ceiling);
+	u64_t period = data->period[chan];
+	u8_t shift = SCALE_SHIFT_MAX;
 
-	LOG_DBG("Set PWM %d: level %d, ceiling %d, pulse %u",
-		pwm_pin, level, ceiling, pulse);
+	while (shift && (period << shift) > UINT32_MAX - UINT16_MAX) {
+		shift--;
+	}
 
-	return pwm_pin_set_usec(pwm_dev, pwm_pin, PWM_PERIOD, pulse);
+	data->scale_shift[chan] = shift;
+	data->scale[chan] = ((period << shift) + LIGHT_DIM_MAX / 2) /
+		LIGHT_DIM_MAX;
 }
 
-static int light_control_pwm_set_color(struct ipso_light_ctl *ilc, u8_t rgb[3])
+static int write_pwm_chan(struct pwm_data *data, enum pwm_chan chan,
+			  u32_t pulse)
 {
-	struct pwm_data *data = ilc->data;
-	int ret = 0;
-
-#if defined(CONFIG_APP_PWM_WHITE)
-	u8_t white = 0;
+	const struct pwm_chan_cfg *cfg = &pwm_chan_cfg[chan];
+	int ret;
 
-	/* If a dedicated PWM is used for white, zero RGB */
-	if (rgb[0] == rgb[1] && rgb[1] == rgb[2]) {
-		white = rgb[0];
-		rgb[0] = rgb[1] = rgb[2] = 0;
+	if (data->pulse_valid & BIT(chan) && data->pulse[chan] == pulse) {
+		return 0;
 	}
 
-	/*
-	 * If switching from white->color we first need to disable white to
-	 * avoid consuming 4 PWM pins (required for nRF5 devices).
-	 */
-	if (!white && data->white_current) {
-		data->white_current = 0;
-		ret = write_pwm_pin(data->white, CONFIG_APP_PWM_WHITE_PIN,
-				    0, 0);
-		if (ret) {
-			LOG_ERR("Failed to update white PWM");
-			return ret;
-		}
-	}
-#endif
+	LOG_DBG("Set PWM %s (pin %u): pulse %u/%u cycles", cfg->name,
+		cfg->pin, pulse, data->period[chan]);
 
-#if defined(CONFIG_APP_PWM_RED)
-	ret = write_pwm_pin(data->red, CONFIG_APP_PWM_RED_PIN,
-			    rgb[0], CONFIG_APP_PWM_RED_PIN_CEILING);
+	ret = pwm_pin_set_cycles(data->dev[chan], cfg->pin,
+				 data->period[chan], pulse);
 	if (ret) {
-		LOG_ERR("Failed to update red PWM");
+		/* The pin state is unknown; rewrite it next time. */
+		data->pulse_valid &= ~BIT(chan);
+		LOG_ERR("Failed to update %s PWM: %d", cfg->name, ret);
 		return ret;
 	}
-#endif
 
-#if defined(CONFIG_APP_PWM_GREEN)
-	ret = write_pwm_pin(data->green, CONFIG_APP_PWM_GREEN_PIN,
-			    rgb[1], CONFIG_APP_PWM_GREEN_PIN_CEILING);
-	if (ret) {
-		LOG_ERR("Failed to update green PWM");
-		return ret;
+	data->pulse[chan] = pulse;
+	data->pulse_valid |= BIT(chan);
+	return 0;
+}
+
+/*
+ * Program every enabled channel whose pulse changed. Channels being
+ * turned off are written first: with nRF5 software PWM, that frees
+ * their pin before a channel being turned on needs one, so switching
+ * between white and color never needs all four at once.
+ */
+static int apply_pwm_pulses(struct pwm_data *data,
+			    const u32_t pulse[PWM_CHAN_COUNT])
+{
+	bool turning_off;
+	int pass, chan, ret;
+
+	for (pass = 0; pass < 2; pass++) {
+		turning_off = pass == 0;
+
+		for (chan = 0; chan < PWM_CHAN_COUNT; chan++) {
+			if (!data->dev[chan] ||
+			    turning_off != (pulse[chan] == 0)) {
+				continue;
+			}
+
+			ret = write_pwm_chan(data, chan, pulse[chan]);
+			if (ret) {
+				return ret;
+			}
+		}
 	}
-#endif
 
-#if defined(CONFIG_APP_PWM_BLUE)
-	ret = write_pwm_pin(data->blue, CONFIG_APP_PWM_BLUE_PIN,
-			    rgb[2], CONFIG_APP_PWM_BLUE_PIN_CEILING);
-	if (ret) {
-		LOG_ERR("Failed to update blue PWM");
-		return ret;
+	return 0;
+}
+
+static u16_t clamp_level(s32_t level)
+{
+	if (level < 0) {
+		return 0;
 	}
-#endif
 
-#if defined(CONFIG_APP_PWM_WHITE)
-	if (white != data->white_current) {
-		data->white_current = white;
-		ret = write_pwm_pin(data->white, CONFIG_APP_PWM_WHITE_PIN,
-				    white, CONFIG_APP_PWM_WHITE_PIN_CEILING);
-		if (ret) {
-			LOG_ERR("Failed to update white PWM");
-			return ret;
+	return MIN(level, LIGHT_DIM_MAX);
+}
+
+/* Set the color from dimmed channel levels, 0 to LIGHT_DIM_MAX. */
+static int light_control_pwm_set_color(struct ipso_light_ctl *ilc,
+				       const u16_t rgb[3])
+{
+	struct pwm_data *data = ilc->data;
+	u16_t level[PWM_CHAN_COUNT] = { 0 };
+	u32_t pulse[PWM_CHAN_COUNT];
+	s32_t sum;
+	int out, in, chan;
+
+	if (data->dev[PWM_CHAN_WHITE] && rgb[0] == rgb[1] && rgb[1] == rgb[2]) {
+		/* If a dedicated PWM is used for white, zero RGB */
+		level[PWM_CHAN_WHITE] = clamp_level(
+			(rgb[0] * data->white_gain) >> CAL_SHIFT);
+	} else {
+		for (out = 0; out < 3; out++) {
+			sum = 0;
+			for (in = 0; in < 3; in++) {
+				sum += rgb[in] * data->cal[out][in];
+			}
+			level[out] = clamp_level(sum >> CAL_SHIFT);
 		}
 	}
-#endif
 
-	return ret;
+	for (chan = 0; chan < PWM_CHAN_COUNT; chan++) {
+		pulse[chan] = scale_pulse(data, chan, level[chan]);
+	}
+
+	return apply_pwm_pulses(data, pulse);
 }
 
-static int light_control_pwm_update(struct ipso_light_ctl *ilc, u8_t dimmer)
+static int light_control_pwm_set_frame(struct ipso_light_ctl *ilc,
+				       const struct ilc_frame *frame)
 {
-	struct pwm_data *data = ilc->data;
-	u8_t rgb[3];
+	u8_t dimmer = frame->dimmer;
+	u16_t rgb[3];
 	int ret, i;
 
-	memcpy(&rgb, data->color_rgb, 3);
-
 	if (dimmer > 100) {
 		dimmer = 100;
 	}
 
-	/*
-	 * Update individual color values based on dimmer.
-	 *
-	 * This is just a direct map between dimmer and PWM, but not the best
-	 * way to control the light brightness, as the human eye perceives
-	 * it differently, but good enough for now as it is a simple method.
-	 */
+	/* Update individual color values based on dimmer. */
 	for (i = 0; i < 3; i++) {
-		rgb[i] = rgb[i] * dimmer / 100;
+		rgb[i] = light_dim_wide(frame->rgb[i], dimmer);
 	}
 
 	ret = light_control_pwm_set_color(ilc, rgb);
@@ -179,163 +280,155 @@ static int light_control_pwm_update(struct ipso_light_ctl *ilc, u8_t dimmer)
 	return ret;
 }
 
-int light_control_pwm_pre_init(struct ipso_light_ctl *ilc)
+/* Parse a comma-separated list of exactly count values in thousandths. */
+static int parse_permille(const char *name, const char *str,
+			  s32_t *values, size_t count, s32_t min, s32_t max)
 {
-	struct pwm_data *data = ilc->data;
+	const char *pos = str;
+	char *end;
+	size_t i;
+	long v;
+
+	for (i = 0; i < count; i++) {
+		v = strtol(pos, &end, 10);
+		if (end == pos || v < min || v > max) {
+			goto fail;
+		}
 
-#if defined(CONFIG_APP_PWM_WHITE)
-	data->white = device_get_binding(CONFIG_APP_PWM_WHITE_DEV);
-	if (!data->white) {
-		LOG_ERR("Failed to get PWM device used for white");
-		return -ENODEV;
-	}
-#endif
-#if defined(CONFIG_APP_PWM_RED)
-	data->red = device_get_binding(CONFIG_APP_PWM_RED_DEV);
-	if (!data->red) {
-		LOG_ERR("Failed to get PWM device used for red");
-		return -ENODEV;
-	}
-#endif
-#if defined(CONFIG_APP_PWM_GREEN)
-	data->green = device_get_binding(CONFIG_APP_PWM_GREEN_DEV);
-	if (!data->green) {
-		LOG_ERR("Failed to get PWM device used for green");
-		return -ENODEV;
-	}
-#endif
-#if defined(CONFIG_APP_PWM_BLUE)
-	data->blue = device_get_binding(CONFIG_APP_PWM_BLUE_DEV);
-	if (!data->blue) {
-		LOG_ERR("Failed to get PWM device used for blue");
-		return -ENODEV;
-	}
-#endif
+		/* Negative values can't be shifted left: multiply. */
+		values[i] = v * (1 << CAL_SHIFT) / 1000;
 
-	/* Initial color: white */
-	memset(data->color_rgb, 0xFF, sizeof(data->color_rgb));
+		while (*end == ' ') {
+			end++;
+		}
+		if (*end != (i == count - 1 ? '\0' : ',')) {
+			goto fail;
+		}
+		pos = end + 1;
+	}
 
 	return 0;
+
+fail:
+	LOG_ERR("Invalid %s \"%s\": need %u values from %d to %d",
+		name, str, (unsigned int)count, min, max);
+	return -EINVAL;
 }
 
-int light_control_pwm_post_init(struct ipso_light_ctl *ilc)
+/*
+ * Combine the color correction matrix and the white balance gains
+ * into the calibration used for each frame.
+ */
+static int load_calibration(struct pwm_data *data)
 {
-	int ret;
-
-	ret = ilc_set_dimmer(ilc, DIMMER_INITIAL);
-	if (ret < 0) {
-		return ret;
-	}
+	s32_t matrix[3 * 3];
+	s32_t gain[PWM_CHAN_COUNT];
+	int out, in, ret;
 
-	ret = ilc_set_sensor_units(ilc, COLOR_UNIT);
-	if (ret < 0) {
+	ret = parse_permille("color matrix", CONFIG_APP_PWM_COLOR_MATRIX,
+			     matrix, ARRAY_SIZE(matrix),
+			     -CAL_PERMILLE_MAX, CAL_PERMILLE_MAX);
+	if (ret) {
 		return ret;
 	}
 
-	ret = ilc_set_color(ilc, COLOR_WHITE);
-	if (ret < 0) {
+	ret = parse_permille("white balance", CONFIG_APP_PWM_WHITE_BALANCE,
+			     gain, ARRAY_SIZE(gain), 0, 1000);
+	if (ret) {
 		return ret;
 	}
 
-	/* Set initial light state based on ON_INITIAL */
-	if (ON_INITIAL) {
-		ilc_set_onoff(ilc, true);
+	for (out = 0; out < 3; out++) {
+		for (in = 0; in < 3; in++) {
+			data->cal[out][in] =
+				(matrix[out * 3 + in] * gain[out]) >> CAL_SHIFT;
+		}
 	}
+	data->white_gain = gain[PWM_CHAN_WHITE];
 
 	return 0;
 }
 
-static int light_control_pwm_on_off_cb(struct ipso_light_ctl *ilc, bool on)
+int light_control_pwm_pre_init(struct ipso_light_ctl *ilc)
 {
-	int ret = 0;
-	u8_t dimmer = 0;
-
-	if (on) {
-		ret = ilc_get_dimmer(ilc, &dimmer);
-		if (ret) {
-			goto fail;
+	struct pwm_data *data = ilc->data;
+	const struct pwm_chan_cfg *cfg;
+	u64_t cycles_per_sec;
+	int chan, ret;
+
+	for (chan = 0; chan < PWM_CHAN_COUNT; chan++) {
+		cfg = &pwm_chan_cfg[chan];
+		if (!cfg->dev_name) {
+			continue;
 		}
-	}
 
-	ret = light_control_pwm_update(ilc, dimmer);
-	if (ret) {
-		goto fail;
-	}
-
-	return 0;
+		data->dev[chan] = device_get_binding(cfg->dev_name);
+		if (!data->dev[chan]) {
+			LOG_ERR("Failed to get PWM device used for %s",
+				cfg->name);
+			return -ENODEV;
+		}
 
-fail:
-	LOG_ERR("Failed to update light state");
-	return ret;
-}
+		ret = pwm_get_cycles_per_sec(data->dev[chan], cfg->pin,
+					     &cycles_per_sec);
+		if (ret) {
+			LOG_ERR("Failed to get %s PWM clock rate: %d",
+				cfg->name, ret);
+			return ret;
+		}
 
-static int light_control_pwm_dimmer_cb(struct ipso_light_ctl *ilc, u8_t dimmer)
-{
-	int ret = 0;
-	bool on;
+		data->period[chan] = cycles_per_sec / CONFIG_APP_PWM_FREQUENCY;
+		if (!data->period[chan]) {
+			LOG_ERR("%s PWM clock too slow for %u Hz", cfg->name,
+				CONFIG_APP_PWM_FREQUENCY);
+			return -EINVAL;
+		}
 
-	/* Update PWM output if light is 'on' */
-	ret = ilc_get_onoff(ilc, &on);
-	if (ret) {
-		LOG_ERR("Failed to get onoff");
-		return ret;
-	}
+		if (data->period[chan] < LIGHT_DIM_MAX) {
+			LOG_WRN("%s PWM period is %u cycles; resolution "
+				"is lower than %u bits", cfg->name,
+				data->period[chan], LIGHT_DIM_BITS);
+		}
 
-	if (!on) {
-		return 0;
+		scale_init(data, chan);
 	}
 
-	ret = light_control_pwm_update(ilc, dimmer);
+	ret = load_calibration(data);
 	if (ret) {
-		LOG_ERR("Failed to update dimmer");
 		return ret;
 	}
 
+	/* Nothing programmed yet: the first frame writes every channel. */
+	data->pulse_valid = 0U;
+
 	return 0;
 }
 
-static int light_control_pwm_color_cb(struct ipso_light_ctl *ilc,
-				      char *color, u16_t color_len)
+int light_control_pwm_post_init(struct ipso_light_ctl *ilc)
 {
-	struct pwm_data *data = ilc->data;
-	u8_t color_rgb[3];
-	u8_t dimmer;
-	bool on;
 	int ret;
 
-	ret = light_control_parse_rgb(color, strlen(color), color_rgb);
-	if (ret) {
+	ret = ilc_set_dimmer(ilc, DIMMER_INITIAL);
+	if (ret < 0) {
 		return ret;
 	}
 
-	memcpy(data->color_rgb, color_rgb, sizeof(data->color_rgb));
-	LOG_DBG("RGB color updated to #%02x%02x%02x", color_rgb[0],
-		color_rgb[1], color_rgb[2]);
-
-	/* Update PWM output if light is 'on' */
-	ret = ilc_get_onoff(ilc, &on);
-	if (ret) {
-		LOG_ERR("Failed to get onoff: %d", ret);
+	ret = ilc_set_sensor_units(ilc, COLOR_UNIT);
+	if (ret < 0) {
 		return ret;
 	}
 
-	if (!on) {
-		return 0;
-	}
-
-	ret = ilc_get_dimmer(ilc, &dimmer);
-	if (ret) {
-		LOG_ERR("Failed to get dimmer");
+	ret = ilc_set_color(ilc, COLOR_WHITE);
+	if (ret < 0) {
 		return ret;
 	}
 
-	ret = light_control_pwm_update(ilc, dimmer);
-	if (ret) {
-		LOG_ERR("Failed to update color");
-		return ret;
+	/* Set initial light state based on ON_INITIAL */
+	if (ON_INITIAL) {
+		ilc_set_onoff(ilc, true);
 	}
 
-	return ret;
+	return 0;
 }
 
 static struct pwm_data data;
@@ -343,9 +436,7 @@ static struct pwm_data data;
 static struct ipso_light_ctl ilc_pwm = {
 	.pre_init = light_control_pwm_pre_init,
 	.post_init = light_control_pwm_post_init,
-	.on_off_cb = light_control_pwm_on_off_cb,
-	.dimmer_cb = light_control_pwm_dimmer_cb,
-	.color_cb = light_control_pwm_color_cb,
+	.set_frame = light_control_pwm_set_frame,
 	.data = &data,
 };
 
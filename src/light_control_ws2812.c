@@ -5,6 +5,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #define LOG_MODULE_NAME fota_light_led
 #define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
@@ -17,6 +18,7 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include <init.h>
 
 #include "light_control_priv.h"
+#include "light_dimming.h"
 
 #define WS2812_NUM_LEDS	CONFIG_WS2812_STRIP_MAX_PIXELS
 #define WS2812_DEV_NAME	SPI_0_WORLDSEMI_WS2812_0_LABEL
@@ -32,251 +34,371 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 /* Is the light initially on? */
 #define ON_INITIAL              false
 
-struct ws2812_data {
+#define WS2812_SEGMENTS	CONFIG_APP_WS2812_SEGMENTS
+
+BUILD_ASSERT_MSG(WS2812_SEGMENTS <= WS2812_NUM_LEDS,
+		 "more WS2812 segments than pixels");
+
+/*
+ * Output stage: frames are rendered into 'frame_buf' by the LwM2M
+ * callbacks, then copied into the pending buffer. The output thread
+ * swaps the pending and transmit buffers and sends the transmit
+ * buffer to the strip, so callbacks never wait for the SPI transfer.
+ * Frames published while a transfer is in progress are coalesced
+ * into the pending buffer; only the latest one is sent.
+ */
+struct ws2812_output {
+	struct k_mutex lock;
+	struct k_sem ready;
+	struct led_rgb bufs[2][WS2812_NUM_LEDS];
+	/* Protected by lock. */
+	struct led_rgb *pending;
+	size_t pending_count;
+	/* Owned by the output thread. */
+	struct led_rgb *tx;
+	/* Set by the output thread if an update failed. */
+	atomic_t failed;
+};
+
+/*
+ * The physical strip, shared by all segments. Each segment is a
+ * separate light instance with its own lock, so rendering takes the
+ * strip lock to keep segments from clobbering each other's pixels.
+ */
+struct ws2812_strip {
 	struct device *ws2812;
-	struct led_rgb ws2812_buf[WS2812_NUM_LEDS];
-	struct led_rgb color;
+	struct k_mutex lock;
+	bool started;
+	/* Undimmed color of each pixel. */
+	struct led_rgb pixels[WS2812_NUM_LEDS];
+	/* Last rendered output, i.e. what the strip is (about to be) showing. */
+	struct led_rgb frame_buf[WS2812_NUM_LEDS];
+	bool frame_valid;
+	struct ws2812_output out;
 };
 
-static int light_control_ws2812_update(struct ipso_light_ctl *ilc, u8_t dimmer)
+/* A contiguous range of pixels controlled as one light. */
+struct ws2812_data {
+	struct ws2812_strip *strip;
+	u16_t first;
+	u16_t count;
+	/* Last frame rendered, for telling color and dimmer changes apart. */
+	struct ilc_frame frame;
+};
+
+static K_THREAD_STACK_DEFINE(ws2812_output_stack,
+			     CONFIG_APP_WS2812_OUTPUT_STACK_SIZE);
+static struct k_thread ws2812_output_thread;
+
+static bool led_rgb_eq(const struct led_rgb *a, const struct led_rgb *b)
 {
-	struct ws2812_data *data = ilc->data;
-	struct led_rgb *buf = data->ws2812_buf;
-	struct led_rgb *color = &data->color;
-	u8_t r, g, b;
-	size_t i;
+	return a->r == b->r && a->g == b->g && a->b == b->b;
+}
+
+static void ws2812_output_run(void *p1, void *p2, void *p3)
+{
+	struct ws2812_strip *strip = p1;
+	struct ws2812_output *out = &strip->out;
+	struct led_rgb *tmp;
+	size_t count;
 	int ret;
 
-	r = color->r * dimmer / 100;
-	g = color->g * dimmer / 100;
-	b = color->b * dimmer / 100;
+	while (1) {
+		k_sem_take(&out->ready, K_FOREVER);
 
-	for (i = 0; i < WS2812_NUM_LEDS; i++) {
-		buf[i].r = r;
-		buf[i].g = g;
-		buf[i].b = b;
-	}
+		k_mutex_lock(&out->lock, K_FOREVER);
+		count = out->pending_count;
+		out->pending_count = 0;
+		tmp = out->tx;
+		out->tx = out->pending;
+		out->pending = tmp;
+		k_mutex_unlock(&out->lock);
 
-	ret = led_strip_update_rgb(data->ws2812, buf, WS2812_NUM_LEDS);
+		if (!count) {
+			/* Already sent along with an earlier frame. */
+			continue;
+		}
 
-	return ret;
+		/* This may overwrite out->tx, which is fine. */
+		ret = led_strip_update_rgb(strip->ws2812, out->tx, count);
+		if (ret) {
+			LOG_ERR("Failed to update LED strip: %d", ret);
+			atomic_set(&out->failed, 1);
+		}
+	}
 }
 
-static int light_control_ws2812_pre_init(struct ipso_light_ctl *ilc)
+/*
+ * Hand the first count pixels of the rendered frame to the thread.
+ * Must be called with the strip lock held.
+ */
+static void ws2812_output_publish(struct ws2812_strip *strip, size_t count)
 {
-	struct ws2812_data *data = ilc->data;
-	struct device *spi;
+	struct ws2812_output *out = &strip->out;
 
-	/* Sanity-check the SPI configuration. */
-	spi = device_get_binding(SPI_DEV_NAME);
-	if (spi) {
-		LOG_INF("Found SPI device %s", SPI_DEV_NAME);
-	} else {
-		LOG_ERR("SPI device not found; you must choose a SPI "
-			"device and configure its name to %s",
-			SPI_DEV_NAME);
-		return -ENODEV;
-	}
+	k_mutex_lock(&out->lock, K_FOREVER);
 
-	/* Cache the actual LED strip device. */
-	data->ws2812 = device_get_binding(WS2812_DEV_NAME);
-	if (data->ws2812) {
-		LOG_INF("Found LED strip device %s", WS2812_DEV_NAME);
-	} else {
-		LOG_ERR("LED strip device %s not found", WS2812_DEV_NAME);
-		return -ENODEV;
-	}
+	/* Coalesce with a frame that hasn't been sent yet. */
+	count = MAX(count, out->pending_count);
+	memcpy(out->pending, strip->frame_buf,
+	       count * sizeof(out->pending[0]));
+	out->pending_count = count;
 
-	memset(data->ws2812_buf, 0xff, sizeof(data->ws2812_buf));
-	memset(&data->color, 0xff, sizeof(data->color));
+	k_mutex_unlock(&out->lock);
 
-	return 0;
+	k_sem_give(&out->ready);
 }
 
-static int light_control_ws2812_post_init(struct ipso_light_ctl *ilc)
+static void ws2812_output_start(struct ws2812_strip *strip)
 {
-	int ret;
+	struct ws2812_output *out = &strip->out;
+
+	k_mutex_init(&out->lock);
+	k_sem_init(&out->ready, 0, 1);
+	out->pending = out->bufs[0];
+	out->tx = out->bufs[1];
+	out->pending_count = 0;
+	atomic_set(&out->failed, 0);
+
+	k_thread_create(&ws2812_output_thread, ws2812_output_stack,
+			K_THREAD_STACK_SIZEOF(ws2812_output_stack),
+			ws2812_output_run, strip, NULL, NULL,
+			K_PRIO_PREEMPT(CONFIG_APP_WS2812_OUTPUT_THREAD_PRIO),
+			0, K_NO_WAIT);
+}
 
-	ret = ilc_set_dimmer(ilc, DIMMER_INITIAL);
-	if (ret < 0) {
-		return ret;
+/*
+ * Render a segment at a dimmer level, from the per-pixel colors, or
+ * from a single color for every pixel if fill is not NULL.
+ *
+ * Only the pixels up to the last one which changed since the previous
+ * update are sent: pixels further down the chain keep the color they
+ * already latched. If nothing changed, the strip isn't touched.
+ */
+static int light_control_ws2812_render(struct ipso_light_ctl *ilc,
+				       const struct led_rgb *fill,
+				       u8_t dimmer)
+{
+	struct ws2812_data *data = ilc->data;
+	struct ws2812_strip *strip = data->strip;
+	struct led_rgb *buf = strip->frame_buf;
+	const struct led_rgb *color;
+	struct led_rgb px;
+	size_t i, count = 0;
+
+	k_mutex_lock(&strip->lock, K_FOREVER);
+
+	/* If an update failed, we no longer know what's shown. */
+	if (atomic_clear(&strip->out.failed)) {
+		strip->frame_valid = false;
 	}
 
-	ret = ilc_set_sensor_units(ilc, COLOR_UNIT);
-	if (ret < 0) {
-		return ret;
+	/*
+	 * If the frame is invalid, the whole strip is resent, so pixels
+	 * past the failed update latch again too. Pixels outside this
+	 * segment are resent as they are, without re-rendering.
+	 */
+	if (!strip->frame_valid) {
+		count = WS2812_NUM_LEDS;
 	}
 
-	ret = ilc_set_color(ilc, COLOR_WHITE);
-	if (ret < 0) {
-		return ret;
+	for (i = data->first; i < data->first + data->count; i++) {
+		color = fill ? fill : &strip->pixels[i];
+		px.r = light_dim(color->r, dimmer);
+		px.g = light_dim(color->g, dimmer);
+		px.b = light_dim(color->b, dimmer);
+
+		if (!strip->frame_valid || !led_rgb_eq(&px, &buf[i])) {
+			buf[i] = px;
+			count = MAX(count, i + 1);
+		}
 	}
 
-	ret = ilc_set_onoff(ilc, ON_INITIAL);
-	if (ret < 0) {
-		return ret;
+	if (count) {
+		strip->frame_valid = true;
+		ws2812_output_publish(strip, count);
 	}
 
+	k_mutex_unlock(&strip->lock);
+
 	return 0;
 }
 
-static int light_control_ws2812_on_off_cb(struct ipso_light_ctl *ilc, bool on)
+static int light_control_ws2812_set_frame(struct ipso_light_ctl *ilc,
+					  const struct ilc_frame *frame)
 {
-	int ret = 0;
-	u8_t dimmer = 0;
+	struct ws2812_data *data = ilc->data;
+	struct ws2812_strip *strip = data->strip;
+	size_t i;
 
-	if (on) {
-		ret = ilc_get_dimmer(ilc, &dimmer);
-		if (ret) {
-			goto fail;
+	/*
+	 * A new color overrides any per-pixel colors; a frame which
+	 * only changes the dimmer level keeps them. Only this light
+	 * writes its segment's pixels, so the strip lock isn't needed.
+	 */
+	if (memcmp(frame->rgb, data->frame.rgb, sizeof(frame->rgb))) {
+		for (i = data->first; i < data->first + data->count; i++) {
+			strip->pixels[i].r = frame->rgb[0];
+			strip->pixels[i].g = frame->rgb[1];
+			strip->pixels[i].b = frame->rgb[2];
 		}
 	}
 
-	ret = light_control_ws2812_update(ilc, dimmer);
-	if (ret) {
-		goto fail;
+	data->frame = *frame;
+
+	return light_control_ws2812_render(ilc, NULL, frame->dimmer);
+}
+
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+/* Pixel indexes are relative to the start of the segment. */
+static int light_control_ws2812_set_pixels(struct ipso_light_ctl *ilc,
+					   u16_t start, const u8_t *rgb,
+					   u16_t count)
+{
+	struct ws2812_data *data = ilc->data;
+	struct led_rgb *px;
+	size_t i;
+
+	if (start >= data->count || count > data->count - start) {
+		LOG_ERR("Pixels %u-%u out of range (%u pixels)", start,
+			start + count - 1, data->count);
+		return -EINVAL;
 	}
 
-	return 0;
+	px = &data->strip->pixels[data->first + start];
+	for (i = 0; i < count; i++, px++, rgb += 3) {
+		px->r = rgb[0];
+		px->g = rgb[1];
+		px->b = rgb[2];
+	}
 
-fail:
-	LOG_ERR("Failed to update light state");
-	return ret;
+	return light_control_ws2812_render(ilc, NULL, data->frame.dimmer);
 }
+#endif
 
-static int light_control_ws2812_dimmer_cb(struct ipso_light_ctl *ilc,
-					  u8_t dimmer)
+/* Called from each segment's pre_init; only the first call does anything. */
+static int ws2812_strip_init(struct ws2812_strip *strip)
 {
-	int ret = 0;
-	bool on;
+	struct device *spi;
 
-	/* Update output if light is 'on' */
-	ret = ilc_get_onoff(ilc, &on);
-	if (ret) {
-		LOG_ERR("Failed to get onoff");
-		return ret;
+	if (strip->started) {
+		return 0;
 	}
 
-	if (!on) {
-		return 0;
+	/* Sanity-check the SPI configuration. */
+	spi = device_get_binding(SPI_DEV_NAME);
+	if (spi) {
+		LOG_INF("Found SPI device %s", SPI_DEV_NAME);
+	} else {
+		LOG_ERR("SPI device not found; you must choose a SPI "
+			"device and configure its name to %s",
+			SPI_DEV_NAME);
+		return -ENODEV;
 	}
 
-	ret = light_control_ws2812_update(ilc, dimmer);
-	if (ret) {
-		LOG_ERR("Failed to update dimmer");
-		return ret;
+	/* Cache the actual LED strip device. */
+	strip->ws2812 = device_get_binding(WS2812_DEV_NAME);
+	if (strip->ws2812) {
+		LOG_INF("Found LED strip device %s", WS2812_DEV_NAME);
+	} else {
+		LOG_ERR("LED strip device %s not found", WS2812_DEV_NAME);
+		return -ENODEV;
 	}
 
+	k_mutex_init(&strip->lock);
+	memset(strip->pixels, 0xff, sizeof(strip->pixels));
+	strip->frame_valid = false;
+
+	ws2812_output_start(strip);
+	strip->started = true;
+
 	return 0;
 }
 
-static int light_control_ws2812_color_cb(struct ipso_light_ctl *ilc,
-					 char *color, u16_t color_len)
+static int light_control_ws2812_pre_init(struct ipso_light_ctl *ilc)
 {
 	struct ws2812_data *data = ilc->data;
-	u8_t color_rgb[3];
-	u8_t dimmer;
-	bool on;
-	int ret;
 
-	ret = light_control_parse_rgb(color, strlen(color), color_rgb);
-	if (ret) {
-		return ret;
-	}
+	memset(&data->frame.rgb, 0xff, sizeof(data->frame.rgb));
 
-	data->color.r = color_rgb[0];
-	data->color.g = color_rgb[1];
-	data->color.b = color_rgb[2];
-	LOG_DBG("RGB color updated to #%02x%02x%02x", color_rgb[0],
-		color_rgb[1], color_rgb[2]);
+	return ws2812_strip_init(data->strip);
+}
+static int light_control_ws2812_post_init(struct ipso_light_ctl *ilc)
+{
+	int ret;
 
-	/* Update output if light is 'on' */
-	ret = ilc_get_onoff(ilc, &on);
-	if (ret) {
-		LOG_ERR("Failed to get onoff: %d", ret);
+	ret = ilc_set_dimmer(ilc, DIMMER_INITIAL);
+	if (ret < 0) {
 		return ret;
 	}
 
-	if (!on) {
-		return 0;
+	ret = ilc_set_sensor_units(ilc, COLOR_UNIT);
+	if (ret < 0) {
+		return ret;
 	}
 
-	ret = ilc_get_dimmer(ilc, &dimmer);
-	if (ret) {
-		LOG_ERR("Failed to get dimmer");
+	ret = ilc_set_color(ilc, COLOR_WHITE);
+	if (ret < 0) {
 		return ret;
 	}
 
-	ret = light_control_ws2812_update(ilc, dimmer);
-	if (ret) {
-		LOG_ERR("Failed to update color");
+	ret = ilc_set_onoff(ilc, ON_INITIAL);
+	if (ret < 0) {
 		return ret;
 	}
 
-	return ret;
+	return 0;
 }
 
 static int light_control_ws2812_flash(struct ipso_light_ctl *ilc,
-				      u8_t r, u8_t g, u8_t b, s32_t duration)
+				      u8_t r, u8_t g, u8_t b)
 {
-	struct ws2812_data *data = ilc->data;
-	struct led_rgb cache;
-	u8_t dimmer = 0;
-	bool onoff;
-	int ret;
+	struct led_rgb color = {
+		.r = r,
+		.g = g,
+		.b = b,
+	};
 
-	ret = ilc_get_onoff(ilc, &onoff);
-	if (ret) {
-		return ret;
-	}
-
-	if (onoff) {
-		ret = ilc_get_dimmer(ilc, &dimmer);
-		if (ret) {
-			return ret;
-		}
-	}
-
-	memcpy(&cache, &data->color, sizeof(struct led_rgb));
-	data->color.r = r;
-	data->color.g = g;
-	data->color.b = b;
-	ret = light_control_ws2812_update(ilc, DIMMER_INITIAL);
-	if (ret) {
-		goto fail;
-	}
-	k_sleep(duration);
-	memcpy(&data->color, &cache, sizeof(struct led_rgb));
-	ret = light_control_ws2812_update(ilc, dimmer);
-	return ret;
-
-fail:
-	memcpy(&data->color, &cache, sizeof(struct led_rgb));
-	(void)light_control_ws2812_update(ilc, dimmer);
-	return ret;
+	return light_control_ws2812_render(ilc, &color, DIMMER_INITIAL);
 }
 
-static struct ws2812_data data;
-
-static struct ipso_light_ctl ilc_ws2812 = {
-	.pre_init = light_control_ws2812_pre_init,
-	.post_init = light_control_ws2812_post_init,
-	.on_off_cb = light_control_ws2812_on_off_cb,
-	.dimmer_cb = light_control_ws2812_dimmer_cb,
-	.color_cb = light_control_ws2812_color_cb,
-	.flash = light_control_ws2812_flash,
-	.data = &data,
-};
+static struct ws2812_strip strip;
+static struct ws2812_data data[WS2812_SEGMENTS];
+static struct ipso_light_ctl ilc_ws2812[WS2812_SEGMENTS];
 
+/*
+ * Split the strip into segments of equal length, with any leftover
+ * pixels going to the last one. Each segment is a light instance.
+ */
 static int light_control_register_ws2812(struct device *dev)
 {
-	int ret = light_control_register(&ilc_ws2812);
-	if (ret) {
-		LOG_ERR("failed: %d", ret);
-	} else {
-		LOG_INF("success");
+	u16_t seg_len = WS2812_NUM_LEDS / WS2812_SEGMENTS;
+	int i, ret;
+
+	for (i = 0; i < WS2812_SEGMENTS; i++) {
+		data[i].strip = &strip;
+		data[i].first = i * seg_len;
+		data[i].count = (i == WS2812_SEGMENTS - 1) ?
+			WS2812_NUM_LEDS - data[i].first : seg_len;
+
+		ilc_ws2812[i].pre_init = light_control_ws2812_pre_init;
+		ilc_ws2812[i].post_init = light_control_ws2812_post_init;
+		ilc_ws2812[i].set_frame = light_control_ws2812_set_frame;
+		ilc_ws2812[i].flash = light_control_ws2812_flash;
+#if defined(CONFIG_APP_LIGHT_PIXELS)
+		ilc_ws2812[i].set_pixels = light_control_ws2812_set_pixels;
+#endif
+		ilc_ws2812[i].data = &data[i];
+
+		ret = light_control_register(&ilc_ws2812[i]);
+		if (ret) {
+			LOG_ERR("segment %d failed: %d", i, ret);
+			return ret;
+		}
 	}
-	return ret;
+
+	LOG_INF("success, %d segment(s)", WS2812_SEGMENTS);
+	return 0;
 }
 
 SYS_INIT(light_control_register_ws2812, APPLICATION,
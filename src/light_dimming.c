@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+
+#include "light_dimming.h"
+
+/* Generated by scripts/gen_dimming_lut.py; see CMakeLists.txt. */
+#include "light_dimming_lut.h"
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_LIGHT_DIMMING_H__
+#define FOTA_LIGHT_DIMMING_H__
+
+#include <zephyr/types.h>
+
+/**
+ * @file
+ * @brief Dimming curve shared by the light backends.
+ *
+ * The tables are generated at build time by
+ * scripts/gen_dimming_lut.py, for the curve selected by the
+ * APP_LIGHT_DIMMING_CURVE Kconfig choice.
+ */
+
+#define LIGHT_DIM_SCALE_SHIFT 8
+
+/** Resolution of the output levels in light_dim_curve[]. */
+#define LIGHT_DIM_BITS CONFIG_APP_LIGHT_DIMMING_BITS
+
+/** Highest output level returned by light_dim_wide(). */
+#define LIGHT_DIM_MAX ((1U << LIGHT_DIM_BITS) - 1)
+
+#if LIGHT_DIM_BITS > 8
+typedef u16_t light_dim_level_t;
+#else
+typedef u8_t light_dim_level_t;
+#endif
+
+/** Fixed-point scale factor for each dimmer percentage, 0 to 100. */
+extern const u16_t light_dim_scale[101];
+
+/** Output level for each relative brightness index. */
+extern const light_dim_level_t light_dim_curve[];
+
+/**
+ * @brief Scale a color channel level by a dimmer percentage, at the
+ *        full resolution of the dimming curve.
+ *
+ * @param level  Channel level, 0 to 255.
+ * @param dimmer Dimmer percentage, 0 to 100.
+ * @return Output level for the channel, 0 to LIGHT_DIM_MAX.
+ */
+static inline u16_t light_dim_wide(u8_t level, u8_t dimmer)
+{
+	return light_dim_curve[(level * light_dim_scale[dimmer]) >>
+			       LIGHT_DIM_SCALE_SHIFT];
+}
+
+/**
+ * @brief Scale a color channel level by a dimmer percentage.
+ *
+ * @param level  Channel level, 0 to 255.
+ * @param dimmer Dimmer percentage, 0 to 100.
+ * @return Output level for the channel, 0 to 255.
+ */
+static inline u8_t light_dim(u8_t level, u8_t dimmer)
+{
+	return light_dim_wide(level, dimmer) >> (LIGHT_DIM_BITS - 8);
+}
+
+#endif	/* FOTA_LIGHT_DIMMING_H__ */
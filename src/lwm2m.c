@@ -13,7 +13,6 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #include <zephyr.h>
 #include <dfu/mcuboot.h>
-#include <dfu/flash_img.h>
 #include <flash.h>
 #include <logging/log_ctrl.h>
 #include <misc/reboot.h>
@@ -35,6 +34,9 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include "bluetooth.h"
 #endif
 #include "settings.h"
+#include "fota_download.h"
+#include "lwm2m_vendor.h"
+#include "persist.h"
 
 /* Network configuration checks */
 #if defined(CONFIG_NET_IPV6)
@@ -97,11 +99,8 @@ static bool tc_logging;
 static char ep_name[LWM2M_DEVICE_ID_SIZE];
 
 static struct device *flash_dev;
-static struct flash_img_context dfu_ctx;
 static struct lwm2m_ctx client;
 
-/* storage location for firmware package */
-static u8_t firmware_buf[CONFIG_LWM2M_COAP_BLOCK_SIZE];
 /* storage location for firmware version */
 static char firmware_version[32];
 
@@ -109,6 +108,7 @@ static struct k_delayed_work reboot_work;
 static struct net_mgmt_event_callback cb;
 static struct k_work net_event_work;
 static struct k_work_q *net_event_work_q;
+static struct k_delayed_work reg_start_work;
 
 static void *firmware_read_cb(u16_t obj_inst_id, size_t *data_len)
 {
@@ -119,6 +119,9 @@ static void *firmware_read_cb(u16_t obj_inst_id, size_t *data_len)
 
 static void reboot(struct k_work *work)
 {
+	persist_flush_before_reboot();
+	app_wq_stats_log();
+
 	LOG_INF("Rebooting device");
 #ifdef CONFIG_NET_L2_BT
 	bt_network_disable();
@@ -143,6 +146,11 @@ static int firmware_update_cb(u16_t obj_inst_id)
 
 	LOG_DBG("Executing firmware update");
 
+	if (!fota_download_image_verified()) {
+		LOG_ERR("Refusing to update to an unverified image");
+		return -EFAULT;
+	}
+
 	/* Bump update counter so it can be verified on the next reboot */
 	ret = fota_update_counter_read(&update_counter);
 	if (ret) {
@@ -170,110 +178,45 @@ cleanup:
 
 static void *firmware_get_buf(u16_t obj_inst_id, size_t *data_len)
 {
-	*data_len = sizeof(firmware_buf);
-	return firmware_buf;
+	/* Blocks are received straight into the download ring. */
+	return fota_download_get_buf(data_len);
 }
 
-static int firmware_block_received_cb(u16_t obj_inst_id,
-				      u8_t *data, u16_t data_len,
-				      bool last_block, size_t total_size)
+/* Tell the download where it comes from, before its first block. */
+static void firmware_set_source(void)
 {
-#if defined(CONFIG_FOTA_ERASE_PROGRESSIVELY)
-	static int last_offset = DT_FLASH_AREA_IMAGE_1_OFFSET;
-#endif
-	static u8_t percent_downloaded;
-	static u32_t bytes_downloaded;
-	u8_t downloaded;
-	int ret = 0;
-
-	if (total_size > FLASH_BANK_SIZE) {
-		LOG_ERR("Artifact file size too big (%d)", total_size);
-		return -EINVAL;
-	}
+	char *uri;
+	u16_t uri_len;
+	u8_t uri_flags;
 
-	if (!data_len) {
-		LOG_ERR("Data len is zero, nothing to write.");
-		return -EINVAL;
+	/* Pushed downloads leave the package URI empty. */
+	if (lwm2m_engine_get_res_data("5/0/1", (void **)&uri, &uri_len,
+				      &uri_flags) < 0) {
+		uri = "";
+		uri_len = 0U;
 	}
 
-	/* Erase bank 1 before starting the write process */
-	if (bytes_downloaded == 0) {
-		flash_img_init(&dfu_ctx);
-#if defined(CONFIG_FOTA_ERASE_PROGRESSIVELY)
-		LOG_INF("Download firmware started, erasing progressively.");
-		/* reset image data */
-		ret = boot_invalidate_slot1();
-		if (ret != 0) {
-			LOG_ERR("Failed to reset image data in bank 1");
-			goto cleanup;
-		}
-#else
-		LOG_INF("Download firmware started, erasing second bank");
-		ret = boot_erase_img_bank(FLASH_BANK1_ID);
-		if (ret != 0) {
-			LOG_ERR("Failed to erase flash bank 1");
-			goto cleanup;
-		}
-#endif
-	}
-
-	bytes_downloaded += data_len;
-
-	/* display a % downloaded, if it's different */
-	if (total_size) {
-		downloaded = bytes_downloaded * 100 / total_size;
-	} else {
-		/* Total size is empty when there is only one block */
-		downloaded = 100;
-	}
-
-	if (downloaded > percent_downloaded) {
-		percent_downloaded = downloaded;
-		LOG_INF("%d%%", percent_downloaded);
-	}
-
-#if defined(CONFIG_FOTA_ERASE_PROGRESSIVELY)
-	/* Erase the sector that's going to be written to next */
-	while (last_offset <
-	       DT_FLASH_AREA_IMAGE_1_OFFSET + dfu_ctx.bytes_written +
-	       DT_FLASH_ERASE_BLOCK_SIZE) {
-		LOG_INF("Erasing sector at offset 0x%x", last_offset);
-		flash_write_protection_set(flash_dev, false);
-		ret = flash_erase(flash_dev, last_offset,
-				  DT_FLASH_ERASE_BLOCK_SIZE);
-		flash_write_protection_set(flash_dev, true);
-		last_offset += DT_FLASH_ERASE_BLOCK_SIZE;
-		if (ret) {
-			LOG_ERR("Error %d while erasing sector", ret);
-			goto cleanup;
-		}
-	}
-#endif
+	fota_download_set_source(uri, strnlen(uri, uri_len));
+}
 
-	ret = flash_img_buffered_write(&dfu_ctx, data, data_len, last_block);
-	if (ret < 0) {
-		LOG_ERR("Failed to write flash block");
-		goto cleanup;
-	}
+static int firmware_block_received_cb(u16_t obj_inst_id,
+				      u8_t *data, u16_t data_len,
+				      bool last_block, size_t total_size)
+{
+	static bool started;
+	int ret;
 
-	if (!last_block) {
-		/* Keep going */
-		return ret;
+	if (!started) {
+		firmware_set_source();
+		started = true;
 	}
 
-	if (total_size && (bytes_downloaded != total_size)) {
-		LOG_ERR("Early last block, downloaded %d, expecting %d",
-			bytes_downloaded, total_size);
-		ret = -EIO;
+	ret = fota_download_block(data, data_len, last_block, total_size);
+	if (ret || last_block) {
+		/* The download is over, or reset. */
+		started = false;
 	}
 
-cleanup:
-#if defined(CONFIG_FOTA_ERASE_PROGRESSIVELY)
-	last_offset = DT_FLASH_AREA_IMAGE_1_OFFSET;
-#endif
-	bytes_downloaded = 0;
-	percent_downloaded = 0;
-
 	return ret;
 }
 #endif
@@ -319,6 +262,10 @@ static int lwm2m_setup(void)
 	char *server_url;
 	u16_t server_url_len;
 	u8_t server_url_flags;
+#if defined(CONFIG_APP_WQ_STATS_OBJ)
+	char path[sizeof(LWM2M_OBJECT_WQ_STATS "/0")];
+	int i;
+#endif
 	int ret;
 
 	snprintk(device_serial_no, sizeof(device_serial_no), "%08x",
@@ -417,6 +364,20 @@ static int lwm2m_setup(void)
 	lwm2m_engine_set_u32("3/0/21", (int) (FLASH_BANK_SIZE / 1024));
 
 #ifdef CONFIG_LWM2M_FIRMWARE_UPDATE_OBJ_SUPPORT
+	ret = fota_download_init(flash_dev);
+	if (ret < 0) {
+		LOG_ERR("Failed to initialize firmware download (%d)", ret);
+		return ret;
+	}
+
+#if defined(CONFIG_FOTA_DOWNLOAD_STATS)
+	ret = lwm2m_engine_create_obj_inst(LWM2M_OBJECT_FOTA_STATS "/0");
+	if (ret < 0) {
+		LOG_ERR("Failed to create download statistics (%d)", ret);
+		return ret;
+	}
+#endif
+
 	/* Firmware Object callbacks */
 	/* setup data buffer for block-wise transfer */
 	lwm2m_engine_register_pre_write_callback("5/0/0", firmware_get_buf);
@@ -424,6 +385,18 @@ static int lwm2m_setup(void)
 	lwm2m_firmware_set_update_cb(firmware_update_cb);
 #endif
 
+#if defined(CONFIG_APP_WQ_STATS_OBJ)
+	for (i = 0; i < APP_WQ_LANES; i++) {
+		snprintk(path, sizeof(path), LWM2M_OBJECT_WQ_STATS "/%d", i);
+		ret = lwm2m_engine_create_obj_inst(path);
+		if (ret < 0) {
+			LOG_ERR("Failed to create work queue statistics (%d)",
+				ret);
+			return ret;
+		}
+	}
+#endif
+
 	/* Reboot work, used when executing update */
 	k_delayed_work_init(&reboot_work, reboot);
 
@@ -561,6 +534,9 @@ static int lwm2m_image_init(void)
 			return ret;
 		}
 		LOG_INF("Marked image as OK");
+
+		/* The slot is about to be reset: nothing to resume. */
+		fota_download_checkpoint_clear();
 #if defined(CONFIG_FOTA_ERASE_PROGRESSIVELY)
 		/* instead of erasing slot 1, reset image data */
 		ret = boot_invalidate_slot1();
@@ -651,6 +627,15 @@ static void lwm2m_reg_update_result(struct k_work *work)
 	tc_logging = false;
 }
 
+static void lwm2m_reg_start(struct k_work *work)
+{
+	TC_PRINT("LwM2M registration\n");
+
+	/* client.sec_obj_inst is 0 as a starting point */
+	lwm2m_rd_client_start(&client, ep_name, rd_client_event);
+	LOG_INF("setup complete.");
+}
+
 static void lwm2m_start(struct k_work *work)
 {
 	int ret;
@@ -689,13 +674,12 @@ static void lwm2m_start(struct k_work *work)
 	client.tls_tag = TLS_TAG;
 #endif /* CONFIG_LWM2M_DTLS_SUPPORT */
 
-	/* small delay to finalize networking */
-	k_sleep(K_SECONDS(2));
-	TC_PRINT("LwM2M registration\n");
-
-	/* client.sec_obj_inst is 0 as a starting point */
-	lwm2m_rd_client_start(&client, ep_name, rd_client_event);
-	LOG_INF("setup complete.");
+	/*
+	 * small delay to finalize networking, without holding up the
+	 * rest of the work queue
+	 */
+	k_delayed_work_submit_to_queue(net_event_work_q, &reg_start_work,
+				       K_SECONDS(2));
 }
 
 static void event_iface_up(struct net_mgmt_event_callback *cb,
@@ -709,6 +693,7 @@ int lwm2m_init(struct k_work_q *work_q)
 	struct net_if *iface;
 
 	k_work_init(&net_event_work, lwm2m_start);
+	k_delayed_work_init(&reg_start_work, lwm2m_reg_start);
 	net_event_work_q = work_q;
 
 	iface = net_if_get_default();
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_LWM2M_VENDOR_H__
+#define FOTA_LWM2M_VENDOR_H__
+
+/*
+ * Vendor-specific LwM2M objects implemented by this application.
+ */
+
+/*
+ * Light control extensions. Instance N holds settings for IPSO light
+ * control (3311) instance N which that object has no resources for.
+ */
+#define LWM2M_OBJECT_LIGHT_EXT_ID	26241
+#define LWM2M_OBJECT_LIGHT_EXT		"26241"
+
+/*
+ * Firmware download statistics, a single instance describing the last
+ * or current download.
+ */
+#define LWM2M_OBJECT_FOTA_STATS_ID	26242
+#define LWM2M_OBJECT_FOTA_STATS		"26242"
+
+/*
+ * Application work queue statistics. Instance N describes lane N.
+ */
+#define LWM2M_OBJECT_WQ_STATS_ID	26243
+#define LWM2M_OBJECT_WQ_STATS		"26243"
+
+#endif	/* FOTA_LWM2M_VENDOR_H__ */
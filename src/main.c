@@ -24,6 +24,7 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include "lwm2m.h"
 #include "light_control.h"
 #include "settings.h"
+#include "persist.h"
 #if defined(CONFIG_APP_ENABLE_TIMER_OBJ)
 #include "timer_control.h"
 #endif
@@ -98,30 +99,20 @@ static int init_temp_device(void)
 
 void main(void)
 {
+	__unused int ret;
+
 	app_wq_init();
 
 	LOG_INF("LWM2M Smart Light Bulb");
 
 	TC_START("Running Built in Self Test (BIST)");
 
-	TC_PRINT("Initializing LWM2M IPSO Temperature Sensor\n");
-	if (init_temp_device()) {
-		Z_TC_END_RESULT(TC_FAIL, "init_temp_device");
-		TC_END_REPORT(TC_FAIL);
-		return;
-	}
-	lwm2m_engine_create_obj_inst("3303/0");
-	lwm2m_engine_register_read_callback("3303/0/5700", temp_read_cb);
-	lwm2m_engine_set_string("3303/0/5701", "Cel");
-	Z_TC_END_RESULT(TC_PASS, "init_temp_device");
-
-	TC_PRINT("Initializing IPSO Light Control\n");
-	if (init_light_control()) {
-		Z_TC_END_RESULT(TC_FAIL, "init_light_control");
+	TC_PRINT("Initializing FOTA settings\n");
+	if (fota_settings_init()) {
+		Z_TC_END_RESULT(TC_FAIL, "fota_settings_init");
 		TC_END_REPORT(TC_FAIL);
-		return;
 	}
-	Z_TC_END_RESULT(TC_PASS, "init_light_control");
+	Z_TC_END_RESULT(TC_PASS, "fota_settings_init");
 
 #if defined(CONFIG_APP_ENABLE_TIMER_OBJ)
 	TC_PRINT("Initializing IPSO Timer Control\n");
@@ -133,22 +124,59 @@ void main(void)
 	Z_TC_END_RESULT(TC_PASS, "init_timer_control");
 #endif /* CONFIG_ENABLE_TIMER_OBJ */
 
-	TC_PRINT("Initializing FOTA settings\n");
-	if (fota_settings_init()) {
-		Z_TC_END_RESULT(TC_FAIL, "fota_settings_init");
-		TC_END_REPORT(TC_FAIL);
-	}
-	Z_TC_END_RESULT(TC_PASS, "fota_settings_init");
-
-	/* Load *all* persistent settings */
+	/*
+	 * Choose the persisted state, then load *all* persistent
+	 * settings, which restores it. This comes before the lights
+	 * are initialized, so they can come back in their saved state
+	 * straight away instead of showing their defaults first.
+	 */
 #if defined(CONFIG_LWM2M_PERSIST_SETTINGS)
-	settings_load();
-	light_control_persist();
+	/*
+	 * Without persistence, the device still works: it just comes
+	 * up in its defaults, like the first time it booted. The
+	 * update counter has its own key, "fota/counter", and is
+	 * saved either way.
+	 */
+	TC_PRINT("Initializing persistent state\n");
+	ret = persist_init();
+	if (!ret) {
+		ret = light_control_persist();
+	}
 #if defined(CONFIG_APP_ENABLE_TIMER_OBJ)
-	timer_control_persist();
+	if (!ret) {
+		ret = timer_control_persist();
+	}
 #endif
+	if (ret) {
+		LOG_ERR("Persistent state unavailable (err %d), "
+			"using the defaults", ret);
+		Z_TC_END_RESULT(TC_SKIP, "persist_init");
+	} else {
+		Z_TC_END_RESULT(TC_PASS, "persist_init");
+	}
+
+	settings_load();
 #endif
 
+	TC_PRINT("Initializing IPSO Light Control\n");
+	if (init_light_control()) {
+		Z_TC_END_RESULT(TC_FAIL, "init_light_control");
+		TC_END_REPORT(TC_FAIL);
+		return;
+	}
+	Z_TC_END_RESULT(TC_PASS, "init_light_control");
+
+	TC_PRINT("Initializing LWM2M IPSO Temperature Sensor\n");
+	if (init_temp_device()) {
+		Z_TC_END_RESULT(TC_FAIL, "init_temp_device");
+		TC_END_REPORT(TC_FAIL);
+		return;
+	}
+	lwm2m_engine_create_obj_inst("3303/0");
+	lwm2m_engine_register_read_callback("3303/0/5700", temp_read_cb);
+	lwm2m_engine_set_string("3303/0/5701", "Cel");
+	Z_TC_END_RESULT(TC_PASS, "init_temp_device");
+
 	TC_END_REPORT(TC_PASS);
 
 	if (lwm2m_init(app_work_q)) {
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_persist
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <crc.h>
+#include <misc/byteorder.h>
+#include <net/lwm2m.h>
+#include <settings/settings.h>
+#include <string.h>
+
+#include "app_work_queue.h"
+#include "persist.h"
+
+#define KEY_PREFIX	"state"
+#define KEY_NAME	"record"
+
+#define HEADER_LEN	8
+#define CRC_LEN		4
+
+BUILD_ASSERT(HEADER_LEN + CRC_LEN == PERSIST_RECORD_OVERHEAD);
+
+/* Longest resource value: a float64_value_t. */
+#define VALUE_MAX	16
+
+struct persist_part {
+	/* Resource path, or part name. */
+	char name[sizeof("65535/65535/65535")];
+	/* The resource's storage in the engine, or the block of state. */
+	u8_t *data;
+	u16_t len;
+	bool block;
+	/* Blocks only: brings the block up to date. */
+	void (*refresh)(void);
+};
+
+static struct persist_part parts[CONFIG_APP_PERSIST_PARTS_MAX];
+static u16_t part_count;
+/* Total length of the parts, and CRC-32 of their names and lengths. */
+static u16_t parts_len;
+static u32_t layout;
+
+/* The record as last assembled or read; protected by flush_lock. */
+static u8_t record[CONFIG_APP_PERSIST_RECORD_SIZE];
+/* CRC of the record in storage, if there is a valid one. */
+static u32_t saved_crc;
+static bool saved_valid;
+
+/* Serializes flushes, which can come from reboot() as well. */
+static K_SEM_DEFINE(flush_lock, 1, 1);
+static struct k_delayed_work flush_work;
+
+/* Protected by irq_lock(), as touches come from the engine's thread. */
+static bool pending;
+static u32_t first_touch;
+static struct persist_stats stats;
+
+static size_t record_len(void)
+{
+	return HEADER_LEN + parts_len + CRC_LEN;
+}
+
+/* Assemble the record from the current state, and return its CRC. */
+static u32_t record_build(void)
+{
+	struct persist_part *p;
+	u8_t *pos = record + HEADER_LEN;
+	u32_t crc;
+	u16_t i;
+
+	record[0] = PERSIST_VERSION;
+	record[1] = 0U;
+	sys_put_le16(parts_len, &record[2]);
+	sys_put_le32(layout, &record[4]);
+
+	for (i = 0U; i < part_count; i++) {
+		p = &parts[i];
+		if (p->refresh) {
+			p->refresh();
+		}
+
+		memcpy(pos, p->data, p->len);
+		pos += p->len;
+	}
+
+	crc = crc32_ieee_update(0, record, pos - record);
+	sys_put_le32(crc, pos);
+
+	return crc;
+}
+
+int persist_flush(void)
+{
+	unsigned int key;
+	u32_t crc;
+	int ret = 0;
+
+	k_sem_take(&flush_lock, K_FOREVER);
+
+	key = irq_lock();
+	pending = false;
+	irq_unlock(key);
+
+	crc = record_build();
+	if (!saved_valid || crc != saved_crc) {
+		ret = settings_save_one(KEY_PREFIX "/" KEY_NAME, record,
+					record_len());
+		if (ret) {
+			LOG_ERR("Failed to save the state: %d", ret);
+			/* Try again at the next flush. */
+			saved_valid = false;
+		} else {
+			saved_crc = crc;
+			saved_valid = true;
+			stats.writes++;
+		}
+	}
+
+	stats.flushes++;
+	LOG_DBG("%u writes for %u touches in total", stats.writes,
+		stats.touches);
+
+	k_sem_give(&flush_lock);
+
+	return ret;
+}
+
+static void flush_handler(struct k_work *work)
+{
+	(void)persist_flush();
+}
+
+/*
+ * Each touch pushes the flush back to the end of the quiet period,
+ * but not past the longest delay from the first touch since the last
+ * flush.
+ */
+void persist_touch(void)
+{
+	u32_t now = k_uptime_get_32();
+	s32_t delay = CONFIG_APP_PERSIST_QUIET_MS;
+	s32_t left;
+	unsigned int key;
+
+	key = irq_lock();
+	stats.touches++;
+	if (!pending) {
+		pending = true;
+		first_touch = now;
+	} else {
+		left = CONFIG_APP_PERSIST_MAX_DELAY * MSEC_PER_SEC -
+			(s32_t)(now - first_touch);
+		delay = MAX(0, MIN(delay, left));
+	}
+	irq_unlock(key);
+
+	app_wq_submit_delayed(&flush_work, delay);
+}
+
+static int part_add(const char *name, void *data, size_t len, bool block,
+		    void (*refresh)(void))
+{
+	struct persist_part *p;
+	u8_t len_le[2];
+
+	if (part_count >= ARRAY_SIZE(parts) ||
+	    record_len() + len > sizeof(record)) {
+		LOG_ERR("Can't persist %s: record full", name);
+		return -ENOMEM;
+	}
+
+	p = &parts[part_count];
+	if (strlen(name) >= sizeof(p->name)) {
+		LOG_ERR("Can't persist %s: name too long", name);
+		return -EINVAL;
+	}
+
+	strcpy(p->name, name);
+	p->data = data;
+	p->len = len;
+	p->block = block;
+	p->refresh = refresh;
+
+	/* Adding, moving or resizing a part changes the layout. */
+	sys_put_le16(len, len_le);
+	layout = crc32_ieee_update(layout, (const u8_t *)name,
+				   strlen(name) + 1);
+	layout = crc32_ieee_update(layout, len_le, sizeof(len_le));
+	parts_len += len;
+	part_count++;
+
+	return 0;
+}
+
+int persist_add(const char *path)
+{
+	char name[sizeof(parts[0].name)];
+	u16_t data_len;
+	u8_t flags;
+	void *data;
+	int ret;
+
+	if (strlen(path) >= sizeof(name)) {
+		LOG_ERR("Can't persist %s: name too long", path);
+		return -EINVAL;
+	}
+
+	/* The engine parses the path in place. */
+	strcpy(name, path);
+	ret = lwm2m_engine_get_res_data(name, &data, &data_len, &flags);
+	if (ret < 0) {
+		LOG_ERR("Can't resolve %s: %d", path, ret);
+		return ret;
+	}
+
+	if (!data_len || data_len > VALUE_MAX) {
+		LOG_ERR("Can't persist %s: %u byte value", path, data_len);
+		return -EINVAL;
+	}
+
+	return part_add(path, data, data_len, false, NULL);
+}
+
+int persist_add_part(const char *name, void *data, size_t len,
+		     void (*refresh)(void))
+{
+	return part_add(name, data, len, true, refresh);
+}
+
+/* Check the record just read into record[], and restore its parts. */
+static void record_restore(size_t len)
+{
+	/* The engine reads typed values in place, so they must be aligned. */
+	u8_t value[VALUE_MAX] __aligned(8);
+	struct persist_part *p;
+	u8_t *pos = record + HEADER_LEN;
+	u32_t crc;
+	u16_t i;
+	int ret;
+
+	if (len != record_len() || record[0] != PERSIST_VERSION ||
+	    sys_get_le16(&record[2]) != parts_len ||
+	    sys_get_le32(&record[4]) != layout) {
+		LOG_WRN("Saved state is from another firmware layout.  "
+			"Using the defaults.");
+		return;
+	}
+
+	crc = crc32_ieee_update(0, record, len - CRC_LEN);
+	if (crc != sys_get_le32(&record[len - CRC_LEN])) {
+		LOG_ERR("Saved state is corrupted.  Using the defaults.");
+		return;
+	}
+
+	for (i = 0U; i < part_count; i++) {
+		p = &parts[i];
+		if (p->block) {
+			memcpy(p->data, pos, p->len);
+		} else {
+			memcpy(value, pos, p->len);
+			ret = lwm2m_engine_set_opaque(p->name, (char *)value,
+						      p->len);
+			if (ret < 0) {
+				LOG_ERR("Failed to restore %s: %d", p->name,
+					ret);
+			}
+		}
+
+		pos += p->len;
+	}
+
+	saved_crc = crc;
+	saved_valid = true;
+}
+
+static int set(int argc, char **argv, void *val_ctx)
+{
+	int len;
+
+	if (argc != 1 || strcmp(argv[0], KEY_NAME)) {
+		return -ENOENT;
+	}
+
+	k_sem_take(&flush_lock, K_FOREVER);
+
+	len = settings_val_read_cb(val_ctx, record, sizeof(record));
+	if (len < 0) {
+		LOG_ERR("Unable to read the saved state.  "
+			"Using the defaults.");
+	} else {
+		record_restore(len);
+	}
+
+	k_sem_give(&flush_lock);
+
+	return 0;
+}
+
+static struct settings_handler persist_settings = {
+	.name = KEY_PREFIX,
+	.h_set = set,
+};
+
+void persist_stats_get(struct persist_stats *out)
+{
+	unsigned int key;
+
+	key = irq_lock();
+	*out = stats;
+	irq_unlock(key);
+}
+
+void persist_flush_before_reboot(void)
+{
+	struct persist_stats out;
+
+	if (persist_flush()) {
+		LOG_ERR("Failed to save persistent state");
+	}
+
+	persist_stats_get(&out);
+	LOG_INF("Persistent state: %u writes for %u changes",
+		out.writes, out.touches);
+}
+
+int persist_init(void)
+{
+	int ret;
+
+	k_delayed_work_init(&flush_work, flush_handler);
+
+	ret = settings_register(&persist_settings);
+	if (ret) {
+		LOG_ERR("settings_register failed (err %d)", ret);
+	}
+
+	return ret;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_PERSIST_H__
+#define FOTA_PERSIST_H__
+
+/**
+ * @file
+ * @brief Write-behind persistence of application state.
+ *
+ * Persisted state is made of parts: LwM2M resource values, and
+ * blocks of state which their owner applies itself. All of them are
+ * packed into a single binary record, saved in the settings storage
+ * as "state/record", so loading it is one read and saving it one
+ * append. All values are little endian:
+ *
+ *   version   u8, PERSIST_VERSION
+ *   reserved  u8, zero
+ *   len       u16, length of the parts
+ *   layout    u32, CRC-32 of the parts' names and lengths
+ *   parts     in the order they were added
+ *   crc       u32, CRC-32 of all of the above
+ *
+ * A record whose version, length, layout or CRC doesn't match is
+ * ignored, leaving the defaults in place.
+ *
+ * Changes are not saved as they are made: whoever changes persisted
+ * state calls persist_touch(), and the record is saved once changes
+ * have stopped for CONFIG_APP_PERSIST_QUIET_MS, or at the latest
+ * CONFIG_APP_PERSIST_MAX_DELAY seconds after the first of them, and
+ * only if it differs from what is in storage. A fade made of many
+ * writes costs one settings write.
+ */
+
+#include <zephyr/types.h>
+
+#define PERSIST_VERSION	1
+/* Bytes of a record which aren't parts: its header and CRC. */
+#define PERSIST_RECORD_OVERHEAD	12
+
+struct persist_stats {
+	/* Calls to persist_touch(). */
+	u32_t touches;
+	/* Flushes, and records they saved. */
+	u32_t flushes;
+	u32_t writes;
+};
+
+#if defined(CONFIG_LWM2M_PERSIST_SETTINGS)
+/**
+ * @brief Set up persistence; call before loading the settings.
+ */
+int persist_init(void);
+
+/**
+ * @brief Persist a resource.
+ *
+ * Call after the resource's default value is set, and before loading
+ * the settings, which restores the saved value with
+ * lwm2m_engine_set_opaque(), calling the resource's post-write
+ * callback. Its whole storage is saved, so strings aren't supported.
+ *
+ * @param path Resource path, like "3340/0/5521".
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+int persist_add(const char *path);
+
+/**
+ * @brief Persist a block of state in the caller's own format.
+ *
+ * The block is restored into data as it was saved, without going
+ * through the engine, so it can be applied before the LwM2M objects
+ * are set up. Call before loading the settings.
+ *
+ * @param name    Part name, which identifies it in the layout.
+ * @param data    The block of state.
+ * @param len     Its length.
+ * @param refresh If not NULL, called before each save to bring the
+ *                block up to date.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+int persist_add_part(const char *name, void *data, size_t len,
+		     void (*refresh)(void));
+
+/**
+ * @brief Note that persisted resources may have changed.
+ *
+ * Schedules a flush. Cheap enough to call from every write callback.
+ */
+void persist_touch(void);
+
+/**
+ * @brief Save the record now if it changed, as before rebooting.
+ *
+ * @return 0 on success, negative errno if it couldn't be saved.
+ */
+int persist_flush(void);
+
+void persist_stats_get(struct persist_stats *stats);
+
+/**
+ * @brief Save pending changes and log the statistics; call before
+ * any reboot, so writes in the write-behind window aren't lost.
+ */
+void persist_flush_before_reboot(void);
+#else
+static inline void persist_touch(void)
+{
+}
+
+static inline void persist_flush_before_reboot(void)
+{
+}
+#endif
+
+#endif	/* FOTA_PERSIST_H__ */
@@ -16,6 +16,7 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include "settings.h"
 
 static struct update_counter uc;
+static struct fota_download_checkpoint download_cp;
 
 int fota_update_counter_read(struct update_counter *update_counter)
 {
@@ -23,6 +24,12 @@ int fota_update_counter_read(struct update_counter *update_counter)
 	return 0;
 }
 
+/*
+ * The counter decides whether an update succeeded, so it has a key of
+ * its own, saved right away, rather than a part in the persisted state
+ * record: that record is dropped whenever its layout changes, as it
+ * does between firmware versions, and after a rollback.
+ */
 int fota_update_counter_update(update_counter_t type, u32_t new_value)
 {
 	if (type == COUNTER_UPDATE) {
@@ -34,6 +41,36 @@ int fota_update_counter_update(update_counter_t type, u32_t new_value)
 	return settings_save_one("fota/counter", &uc, sizeof(uc));
 }
 
+int fota_download_checkpoint_read(struct fota_download_checkpoint *cp)
+{
+	if (!download_cp.offset) {
+		return -ENOENT;
+	}
+
+	memcpy(cp, &download_cp, sizeof(download_cp));
+	return 0;
+}
+
+int fota_download_checkpoint_save(const struct fota_download_checkpoint *cp)
+{
+	memcpy(&download_cp, cp, sizeof(download_cp));
+
+	return settings_save_one("fota/download", &download_cp,
+				 sizeof(download_cp));
+}
+
+int fota_download_checkpoint_clear(void)
+{
+	if (!download_cp.offset) {
+		return 0;
+	}
+
+	memset(&download_cp, 0, sizeof(download_cp));
+
+	return settings_save_one("fota/download", &download_cp,
+				 sizeof(download_cp));
+}
+
 static int set(int argc, char **argv, void *val_ctx)
 {
 	int len;
@@ -52,6 +89,18 @@ static int set(int argc, char **argv, void *val_ctx)
 		return 0;
 	}
 
+	if (!strcmp(argv[0], "download")) {
+		len = settings_val_read_cb(val_ctx, &download_cp,
+					   sizeof(download_cp));
+		if (len < sizeof(download_cp)) {
+			LOG_ERR("Unable to read download checkpoint.  "
+				"Resetting.");
+			memset(&download_cp, 0, sizeof(download_cp));
+		}
+
+		return 0;
+	}
+
 	return -ENOENT;
 }
 
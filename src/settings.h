@@ -17,8 +17,23 @@ typedef enum {
 	COUNTER_UPDATE,
 } update_counter_t;
 
+/*
+ * Progress of an interrupted firmware download: the first offset
+ * bytes of an image of total_size bytes are in the secondary slot.
+ * The image is identified by image_id, a CRC-32 of its size, package
+ * URI and first block, which starts with the MCUboot image header.
+ */
+struct fota_download_checkpoint {
+	u32_t total_size;
+	u32_t offset;
+	u32_t image_id;
+};
+
 int fota_update_counter_read(struct update_counter *update_counter);
 int fota_update_counter_update(update_counter_t type, u32_t new_value);
+int fota_download_checkpoint_read(struct fota_download_checkpoint *cp);
+int fota_download_checkpoint_save(const struct fota_download_checkpoint *cp);
+int fota_download_checkpoint_clear(void);
 int fota_settings_init(void);
 
 #endif	/* FOTA_STORAGE_H__ */
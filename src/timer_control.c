@@ -14,6 +14,8 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include <gpio.h>
 #include <net/lwm2m.h>
 
+#include "persist.h"
+
 static void set_timer_gpio(bool state)
 {
 	struct device *gpio;
@@ -45,6 +47,9 @@ static int timer_digital_state_post_write_cb(u16_t obj_inst_id,
 		set_timer_gpio(false);
 	}
 
+	/* The timer's on/off state may have changed with it. */
+	persist_touch();
+
 	return 0;
 }
 
@@ -87,14 +92,58 @@ fail:
 }
 
 #ifdef CONFIG_LWM2M_PERSIST_SETTINGS
-void timer_control_persist(void)
+static int timer_persist_post_write_cb(u16_t obj_inst_id,
+				       u8_t *data, u16_t data_len,
+				       bool last_block, size_t total_size)
 {
+	persist_touch();
+	return 0;
+}
+
+/*
+ * The engine's timer object has its own callback for the on/off
+ * state, so that one is only touched through the output state
+ * callback; any flush saves it anyway, as the whole record is
+ * compared.
+ */
+int timer_control_persist(void)
+{
+	int ret;
+
 	/* Only turn on persist settings *AFTER* the defaults have been set */
 	/* save timer duration */
-	lwm2m_engine_set_persist("3340/0/5521");
+	ret = persist_add("3340/0/5521");
+	if (ret < 0) {
+		goto fail;
+	}
+
+	ret = lwm2m_engine_register_post_write_callback("3340/0/5521",
+			timer_persist_post_write_cb);
+	if (ret < 0) {
+		goto fail;
+	}
+
 	/* save min. off time */
-	lwm2m_engine_set_persist("3340/0/5525");
+	ret = persist_add("3340/0/5525");
+	if (ret < 0) {
+		goto fail;
+	}
+
+	ret = lwm2m_engine_register_post_write_callback("3340/0/5525",
+			timer_persist_post_write_cb);
+	if (ret < 0) {
+		goto fail;
+	}
+
 	/* save on/off state */
-	lwm2m_engine_set_persist("3340/0/5850");
+	ret = persist_add("3340/0/5850");
+	if (ret < 0) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	return ret;
 }
 #endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Firmware download throughput, against the simulated flash, for a
+ * few network rates. Each block arrives a fixed time after the
+ * previous one was handed over, or blocks arrive in bursts, as when
+ * the transfer stalls now and then, at the same average rate. The
+ * writer runs alongside, as on the target, with nRF52840 erase and
+ * program times.
+ *
+ * "serial" is the time the same download takes if each block is
+ * written before the next one is received, as before the writer moved
+ * to the work queue: the network time plus the flash time.
+ */
+
+#include <stdlib.h>
+
+#include <zephyr.h>
+
+#include "fota_download.h"
+#include "host.h"
+
+#define IMAGE_SIZE (256 * 1024 + 100)
+#define BLOCK_SIZE CONFIG_LWM2M_COAP_BLOCK_SIZE
+/* Blocks per burst: a sector's worth is where erase-ahead shows. */
+#define BURST_BLOCKS 16
+
+static u8_t image[IMAGE_SIZE];
+
+static u32_t rate(u64_t bytes, u64_t us)
+{
+	return us ? bytes * 1000000U / us : 0;
+}
+
+/* Download the image, with blocks arriving burst at a time. */
+static void run(u32_t block_us, u32_t burst)
+{
+	struct fota_download_stats stats;
+	u32_t off, len, blocks = 0U;
+	u64_t serial_us;
+	int ret = 0;
+
+	host_sync();
+
+	for (off = 0U; off < IMAGE_SIZE && !ret; off += len) {
+		len = MIN(BLOCK_SIZE, IMAGE_SIZE - off);
+		if (blocks % burst == 0) {
+			host_spend_us((u64_t)block_us * burst);
+		}
+		/* The writer carries on while the network is idle. */
+		host_run_work_due();
+		ret = fota_download_block(image + off, len,
+					  off + len == IMAGE_SIZE,
+					  IMAGE_SIZE);
+		blocks++;
+	}
+
+	if (ret || memcmp(host_flash_slot(), image, IMAGE_SIZE)) {
+		printf("download failed: %d\n", ret);
+		exit(EXIT_FAILURE);
+	}
+
+	fota_download_stats_get(&stats);
+	serial_us = (u64_t)blocks * block_us +
+		(u64_t)(stats.erase_ms + stats.program_ms) * USEC_PER_MSEC;
+
+	printf("%5u ms/block %7u %7u B/s  %6u %6u ms  erase %5u "
+	       "program %5u net wait %5u flash wait %5u ms\n",
+	       block_us / USEC_PER_MSEC, stats.bytes_per_sec,
+	       rate(IMAGE_SIZE, serial_us), stats.elapsed_ms,
+	       (u32_t)(serial_us / USEC_PER_MSEC), stats.erase_ms,
+	       stats.program_ms, stats.network_wait_ms,
+	       stats.flash_wait_ms);
+}
+
+int main(void)
+{
+	static const u32_t block_ms[] = { 0, 5, 10, 20, 50 };
+	size_t i;
+
+	srand(1);
+	for (i = 0; i < IMAGE_SIZE; i++) {
+		image[i] = rand();
+	}
+
+	fota_download_init(device_get_binding("flash"));
+	/* Uptime 0 would read as a download which never started. */
+	host_sleep(MSEC_PER_SEC);
+
+	printf("%u byte image, %u byte blocks, %u buffers, erase ahead %u "
+	       "sectors\n", IMAGE_SIZE, BLOCK_SIZE,
+	       CONFIG_FOTA_DOWNLOAD_BUFFERS,
+	       CONFIG_FOTA_ERASE_AHEAD_SECTORS);
+	printf("%-14s %7s %7s      %6s %6s\n", "block every", "piped", "serial",
+	       "piped", "serial");
+
+	for (i = 0; i < ARRAY_SIZE(block_ms); i++) {
+		run(block_ms[i] * USEC_PER_MSEC, 1);
+	}
+
+	printf("in bursts of %u blocks\n", BURST_BLOCKS);
+	for (i = 0; i < ARRAY_SIZE(block_ms); i++) {
+		run(block_ms[i] * USEC_PER_MSEC, BURST_BLOCKS);
+	}
+
+	return EXIT_SUCCESS;
+}
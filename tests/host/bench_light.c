@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Cost of the light control object's resource accessors, with the
+ * PWM backend: the pre-resolved handles of the ilc_get_* and
+ * ilc_set_* helpers, against formatting the path and going through
+ * the engine's path lookup on every access, as the helpers used to.
+ *
+ * The simulated engine only searches the light's own resources; the
+ * real one searches every object instance, so it costs more.
+ *
+ * Then the cost of rendering a frame, straight through the backend
+ * and as part of a transition, timer and work queue included.
+ */
+
+/* Built into this file, for its registered instances. */
+#include "light_control.c"
+
+#include "host.h"
+
+#define ITERATIONS 1000000
+#define TRANSITIONS 2000
+#define TRANSITION_MS 1000
+
+static volatile u32_t sink;
+
+/* The helpers as they were, formatting the path on each call. */
+static char path_buf[sizeof("3311/65535/65535")];
+
+static char *path_rsrc(struct ipso_light_ctl *ilc, const char *resource)
+{
+	snprintk(path_buf, sizeof(path_buf), "3311/%u/%s", ilc->inst_id,
+		 resource);
+	return path_buf;
+}
+
+static int path_get_dimmer(struct ipso_light_ctl *ilc, u8_t *dimmer)
+{
+	return lwm2m_engine_get_u8(path_rsrc(ilc, IPSO_LIGHT_CTL_DIMMER),
+				   dimmer);
+}
+
+static int path_get_onoff(struct ipso_light_ctl *ilc, bool *on)
+{
+	return lwm2m_engine_get_bool(path_rsrc(ilc, IPSO_LIGHT_CTL_ONOFF),
+				     on);
+}
+
+static int path_set_dimmer(struct ipso_light_ctl *ilc, u8_t dimmer)
+{
+	return lwm2m_engine_set_u8(path_rsrc(ilc, IPSO_LIGHT_CTL_DIMMER),
+				   dimmer);
+}
+
+static double ns_per_op(u64_t start, int ops)
+{
+	return (double)(host_wall_ns() - start) / ops;
+}
+
+static void bench_get(struct ipso_light_ctl *ilc)
+{
+	double handle_ns, path_ns;
+	u8_t dimmer;
+	bool on;
+	u64_t start;
+	int i;
+
+	start = host_wall_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		(void)ilc_get_onoff(ilc, &on);
+		(void)ilc_get_dimmer(ilc, &dimmer);
+		sink += on + dimmer;
+	}
+	handle_ns = ns_per_op(start, 2 * ITERATIONS);
+
+	start = host_wall_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		(void)path_get_onoff(ilc, &on);
+		(void)path_get_dimmer(ilc, &dimmer);
+		sink += on + dimmer;
+	}
+	path_ns = ns_per_op(start, 2 * ITERATIONS);
+
+	printf("get:  handle %7.1f ns  path %7.1f ns  (%.1fx)\n",
+	       handle_ns, path_ns, path_ns / handle_ns);
+}
+
+/*
+ * A set includes the dimmer's post-write callback, which schedules
+ * the coalesced update, as a write from the server does.
+ */
+static void bench_set(struct ipso_light_ctl *ilc)
+{
+	double handle_ns, path_ns;
+	u64_t start;
+	int i;
+
+	start = host_wall_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		(void)ilc_set_dimmer(ilc, i % 101);
+	}
+	handle_ns = ns_per_op(start, ITERATIONS);
+	host_sleep(CONFIG_APP_LIGHT_COALESCE_MS);
+
+	start = host_wall_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		(void)path_set_dimmer(ilc, i % 101);
+	}
+	path_ns = ns_per_op(start, ITERATIONS);
+	host_sleep(CONFIG_APP_LIGHT_COALESCE_MS);
+
+	printf("set:  handle %7.1f ns  path %7.1f ns  (%.1fx)\n",
+	       handle_ns, path_ns, path_ns / handle_ns);
+}
+
+static void bench_frame(struct ipso_light_ctl *ilc)
+{
+	struct ilc_frame frame = { .rgb = { 0x40, 0x80, 0xc0 } };
+	unsigned int writes = host_pwm_writes;
+	unsigned int frames = 0U;
+	double direct_ns, transition_ns;
+	u64_t start;
+	int i;
+
+	/* Changing the dimmer changes every enabled color channel. */
+	start = host_wall_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		frame.dimmer = 1 + i % 100;
+		(void)set_frame(ilc, &frame);
+	}
+	direct_ns = ns_per_op(start, ITERATIONS);
+
+	printf("frame: direct %7.1f ns  %.2f PWM writes/frame\n",
+	       direct_ns, (double)(host_pwm_writes - writes) / ITERATIONS);
+
+	(void)ilc_set_onoff(ilc, true);
+	(void)ilc_set_transition_time(ilc, TRANSITION_MS);
+	host_sleep(CONFIG_APP_LIGHT_COALESCE_MS);
+
+	start = host_wall_ns();
+	for (i = 0; i < TRANSITIONS; i++) {
+		(void)ilc_set_dimmer(ilc, i % 2 ? 100 : 0);
+		host_sleep(CONFIG_APP_LIGHT_COALESCE_MS + TRANSITION_MS);
+		frames += ilc->transition.steps;
+	}
+	transition_ns = ns_per_op(start, frames);
+
+	printf("frame: transition %7.1f ns  (%u frames)\n", transition_ns,
+	       frames);
+}
+
+int main(void)
+{
+	struct ipso_light_ctl *ilc;
+
+	if (init_light_control()) {
+		return EXIT_FAILURE;
+	}
+	ilc = ilcs[0];
+
+	bench_get(ilc);
+	bench_set(ilc);
+	bench_frame(ilc);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_H__
+#define HOST_H__
+
+/*
+ * Host test harness: control of the simulated kernel and hardware,
+ * and the checks used by the tests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <zephyr.h>
+
+enum host_ctx {
+	/* The thread calling into the application, like the engine's. */
+	HOST_CTX_MAIN,
+	/* The application work queue. */
+	HOST_CTX_WORK,
+
+	HOST_CTX_COUNT,
+};
+
+/* Run queued work until there's none left; returns how many ran. */
+int host_run_work(void);
+
+/*
+ * Run the queued work which would have started by now, in the order
+ * it was queued, as the work queue would have alongside the caller.
+ */
+int host_run_work_due(void);
+
+/*
+ * Let ms of simulated time pass in the main context, firing timers
+ * and delayed work as they come due, and running the work queued.
+ */
+void host_sleep(u32_t ms);
+
+/* Simulated time of the current context, and time spent there. */
+u64_t host_now_us(void);
+void host_spend_us(u64_t us);
+
+/* Bring every context up to the latest of their clocks. */
+void host_sync(void);
+
+/* Wall clock, for benchmarks. */
+u64_t host_wall_ns(void);
+
+/* Shared memory, which survives the simulated reboots of fork(). */
+void *host_shared_alloc(size_t size);
+
+/*
+ * Boot in a child process, which runs fn and exits, failing if any of
+ * its checks did. Returns its exit status.
+ */
+int host_reboot(void (*fn)(void));
+
+/* host_lwm2m.c: typed writes from misaligned values. */
+extern unsigned int host_lwm2m_misaligned;
+
+/* host_settings.c */
+void host_settings_shared(void);
+void host_settings_clear(void);
+extern int host_settings_register_err;
+extern unsigned int host_settings_saves;
+
+/* host_pwm.c: last pulse and period set on each pin. */
+#define HOST_PWM_PINS 32
+extern u64_t host_pwm_cycles_per_sec;
+extern u32_t host_pwm_pulse[HOST_PWM_PINS];
+extern u32_t host_pwm_period[HOST_PWM_PINS];
+extern unsigned int host_pwm_writes;
+/* If set, called on every write. */
+extern void (*host_pwm_hook)(u32_t pwm, u32_t pulse);
+
+/* host_flash.c */
+struct host_flash_stats {
+	u32_t programmed;
+	u32_t writes;
+	u32_t erased;
+	u32_t erases;
+	/* Writes to flash which wasn't erased. */
+	u32_t overwrites;
+};
+
+extern struct host_flash_stats host_flash_stats;
+
+/* Exit status of a simulated power loss. */
+#define HOST_POWER_LOSS 42
+
+void host_flash_shared(void);
+const u8_t *host_flash_slot(void);
+void host_flash_power_loss_after(u32_t bytes);
+
+extern unsigned int host_failures;
+
+/* Only the first failures are reported, as a sweep can fail a lot. */
+#define HOST_FAILURES_SHOWN 20
+
+static inline bool host_fail(void)
+{
+	return host_failures++ < HOST_FAILURES_SHOWN;
+}
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond) && host_fail()) {				\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+				__FILE__, __LINE__, #cond);		\
+		}							\
+	} while (0)
+
+#define CHECK_EQ(a, b)							\
+	do {								\
+		long long _a = (a), _b = (b);				\
+		if (_a != _b && host_fail()) {				\
+			fprintf(stderr, "%s:%d: check failed: %s == %s"	\
+				" (%lld != %lld)\n", __FILE__, __LINE__,\
+				#a, #b, _a, _b);			\
+		}							\
+	} while (0)
+
+/* Exit status for a test's main(). */
+static inline int host_result(const char *name)
+{
+	if (host_failures) {
+		printf("%s: FAIL, %u failed checks\n", name, host_failures);
+	} else {
+		printf("%s: PASS\n", name);
+	}
+
+	return host_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif	/* HOST_H__ */
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Simulated NOR flash holding the secondary image slot, with the
+ * DFU and MCUboot helpers that use it. Erasing and programming take
+ * simulated time in the calling context, at the nRF52840's datasheet
+ * maximums. The contents can be kept in shared memory, so they
+ * survive the simulated reboots of a test which forks, and power can
+ * be cut after a number of bytes have been programmed.
+ */
+
+#include <unistd.h>
+
+#include <zephyr.h>
+#include <dfu/flash_img.h>
+#include <dfu/mcuboot.h>
+#include <flash.h>
+
+#include "host.h"
+
+#define SLOT_OFFSET	DT_FLASH_AREA_IMAGE_1_OFFSET
+#define SLOT_SIZE	DT_FLASH_AREA_IMAGE_1_SIZE
+#define SECTOR_SIZE	DT_FLASH_ERASE_BLOCK_SIZE
+#define WRITE_SIZE	DT_FLASH_WRITE_BLOCK_SIZE
+
+#define ERASE_US	85000U
+#define WRITE_WORD_US	41U
+
+static u8_t local_slot[SLOT_SIZE];
+static u8_t *slot = local_slot;
+
+struct host_flash_stats host_flash_stats;
+static u32_t power_loss_after;
+
+void host_flash_shared(void)
+{
+	slot = host_shared_alloc(SLOT_SIZE);
+	memset(slot, 0xff, SLOT_SIZE);
+}
+
+const u8_t *host_flash_slot(void)
+{
+	return slot;
+}
+
+void host_flash_power_loss_after(u32_t bytes)
+{
+	power_loss_after = bytes;
+}
+
+static bool in_slot(off_t offset, size_t len)
+{
+	return offset >= SLOT_OFFSET && len <= SLOT_SIZE &&
+		offset - SLOT_OFFSET <= SLOT_SIZE - len;
+}
+
+int flash_read(struct device *dev, off_t offset, void *data, size_t len)
+{
+	if (!in_slot(offset, len)) {
+		return -EINVAL;
+	}
+
+	memcpy(data, slot + offset - SLOT_OFFSET, len);
+	return 0;
+}
+
+int flash_write(struct device *dev, off_t offset, const void *data,
+		size_t len)
+{
+	u8_t *dst = slot + offset - SLOT_OFFSET;
+	size_t i;
+
+	if (!in_slot(offset, len) || offset % WRITE_SIZE ||
+	    len % WRITE_SIZE) {
+		return -EINVAL;
+	}
+
+	/* Programming can only clear bits. */
+	for (i = 0; i < len; i++) {
+		if (dst[i] != 0xff) {
+			host_flash_stats.overwrites++;
+			return -EIO;
+		}
+	}
+
+	for (i = 0; i < len; i++) {
+		if (power_loss_after &&
+		    host_flash_stats.programmed >= power_loss_after) {
+			_exit(HOST_POWER_LOSS);
+		}
+
+		dst[i] = ((const u8_t *)data)[i];
+		host_flash_stats.programmed++;
+	}
+
+	host_flash_stats.writes++;
+	host_spend_us(len / WRITE_SIZE * WRITE_WORD_US);
+	return 0;
+}
+
+int flash_erase(struct device *dev, off_t offset, size_t size)
+{
+	if (!in_slot(offset, size) || offset % SECTOR_SIZE ||
+	    size % SECTOR_SIZE) {
+		return -EINVAL;
+	}
+
+	memset(slot + offset - SLOT_OFFSET, 0xff, size);
+	host_flash_stats.erased += size;
+	host_flash_stats.erases++;
+	host_spend_us(size / SECTOR_SIZE * ERASE_US);
+	return 0;
+}
+
+int flash_write_protection_set(struct device *dev, bool enable)
+{
+	return 0;
+}
+
+int flash_img_init(struct flash_img_context *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	return 0;
+}
+
+/* The image trailer is in the last sector. */
+int boot_invalidate_slot1(void)
+{
+	return flash_erase(NULL, SLOT_OFFSET + SLOT_SIZE - SECTOR_SIZE,
+			   SECTOR_SIZE);
+}
+
+int boot_erase_img_bank(u8_t area_id)
+{
+	return flash_erase(NULL, SLOT_OFFSET, SLOT_SIZE);
+}
@@ -0,0 +1,462 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Simulated kernel: semaphores, work, delayed work and timers, run
+ * single threaded against a clock per context. See zephyr.h.
+ */
+
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zephyr.h>
+#include <crc.h>
+#include <device.h>
+#include <logging/log.h>
+
+#include "app_work_queue.h"
+#include "host.h"
+
+unsigned int host_failures;
+
+static u64_t clock_us[HOST_CTX_COUNT];
+static enum host_ctx ctx;
+
+/* Queued work, and armed delayed work and timers. */
+static struct k_work *queue_head, **queue_tail = &queue_head;
+static struct k_delayed_work *armed_work;
+static struct k_timer *armed_timers;
+
+/* The application work queue's lanes all run in the work context. */
+struct k_work_q app_wq_lanes[APP_WQ_LANES];
+struct k_work_q *app_work_q = &app_wq_lanes[APP_WQ_BULK];
+
+void host_log(int level, const char *fmt, ...)
+{
+	static const char *const names[] = { "", "err", "wrn", "inf", "dbg" };
+	static int verbose = -1;
+	va_list ap;
+
+	if (verbose < 0) {
+		verbose = getenv("HOST_LOG") != NULL;
+	}
+
+	if (level > 2 && !verbose) {
+		return;
+	}
+
+	fprintf(stderr, "[%8.3f] <%s> ", clock_us[ctx] / 1000.0,
+		names[level]);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+u64_t host_now_us(void)
+{
+	return clock_us[ctx];
+}
+
+void host_spend_us(u64_t us)
+{
+	clock_us[ctx] += us;
+}
+
+static void catch_up(u64_t t)
+{
+	clock_us[ctx] = MAX(clock_us[ctx], t);
+}
+
+void host_sync(void)
+{
+	int i;
+
+	for (i = 0; i < HOST_CTX_COUNT; i++) {
+		clock_us[ctx] = MAX(clock_us[ctx], clock_us[i]);
+	}
+	for (i = 0; i < HOST_CTX_COUNT; i++) {
+		clock_us[i] = clock_us[ctx];
+	}
+}
+
+u64_t host_wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+void *host_shared_alloc(size_t size)
+{
+	void *mem;
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	return mem;
+}
+
+int host_reboot(void (*fn)(void))
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!pid) {
+		fn();
+		exit(host_failures ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static bool run_one(void)
+{
+	struct k_work *work = queue_head;
+	enum host_ctx prev = ctx;
+
+	if (!work) {
+		return false;
+	}
+
+	queue_head = work->next;
+	if (!queue_head) {
+		queue_tail = &queue_head;
+	}
+	work->pending = false;
+
+	ctx = HOST_CTX_WORK;
+	catch_up(work->queued_at);
+	work->handler(work);
+	ctx = prev;
+
+	return true;
+}
+
+int host_run_work(void)
+{
+	int count = 0;
+
+	while (run_one()) {
+		count++;
+	}
+
+	return count;
+}
+
+int host_run_work_due(void)
+{
+	u64_t now = clock_us[ctx];
+	int count = 0;
+
+	while (queue_head &&
+	       MAX(clock_us[HOST_CTX_WORK], queue_head->queued_at) <= now) {
+		run_one();
+		count++;
+	}
+
+	return count;
+}
+
+void k_sem_init(struct k_sem *sem, unsigned int initial_count,
+		unsigned int limit)
+{
+	if (limit > K_SEM_GIVES_MAX) {
+		fprintf(stderr, "semaphore limit %u too high\n", limit);
+		abort();
+	}
+
+	memset(sem, 0, sizeof(*sem));
+	sem->count = initial_count;
+	sem->limit = limit;
+}
+
+int k_sem_take(struct k_sem *sem, s32_t timeout)
+{
+	while (!sem->count) {
+		if (timeout == K_NO_WAIT) {
+			return -EBUSY;
+		}
+
+		/* Only queued work can give it: let it run. */
+		if (ctx == HOST_CTX_WORK || !run_one()) {
+			fprintf(stderr, "deadlock: nothing can give the "
+				"semaphore\n");
+			abort();
+		}
+	}
+
+	catch_up(sem->given_at[sem->first]);
+	sem->first = (sem->first + 1) % K_SEM_GIVES_MAX;
+	sem->count--;
+
+	return 0;
+}
+
+void k_sem_give(struct k_sem *sem)
+{
+	if (sem->count >= sem->limit) {
+		return;
+	}
+
+	sem->given_at[(sem->first + sem->count) % K_SEM_GIVES_MAX] =
+		clock_us[ctx];
+	sem->count++;
+}
+
+void k_work_init(struct k_work *work, k_work_handler_t handler)
+{
+	memset(work, 0, sizeof(*work));
+	work->handler = handler;
+}
+
+void k_work_submit_to_queue(struct k_work_q *work_q, struct k_work *work)
+{
+	if (work->pending) {
+		return;
+	}
+
+	work->pending = true;
+	work->queued_at = clock_us[ctx];
+	work->next = NULL;
+	*queue_tail = work;
+	queue_tail = &work->next;
+}
+
+static bool unqueue(struct k_work *work)
+{
+	struct k_work **pos;
+
+	for (pos = &queue_head; *pos; pos = &(*pos)->next) {
+		if (*pos == work) {
+			*pos = work->next;
+			if (!*pos) {
+				queue_tail = pos;
+			}
+			work->pending = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void k_delayed_work_init(struct k_delayed_work *work,
+			 k_work_handler_t handler)
+{
+	memset(work, 0, sizeof(*work));
+	k_work_init(&work->work, handler);
+}
+
+static bool disarm(struct k_delayed_work *work)
+{
+	struct k_delayed_work **pos;
+
+	for (pos = &armed_work; *pos; pos = &(*pos)->next) {
+		if (*pos == work) {
+			*pos = work->next;
+			work->armed = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int k_delayed_work_submit_to_queue(struct k_work_q *work_q,
+				   struct k_delayed_work *work,
+				   s32_t delay)
+{
+	(void)k_delayed_work_cancel(work);
+
+	if (delay <= 0) {
+		k_work_submit_to_queue(work_q, &work->work);
+		return 0;
+	}
+
+	work->armed = true;
+	work->due = clock_us[ctx] + (u64_t)delay * USEC_PER_MSEC;
+	work->next = armed_work;
+	armed_work = work;
+
+	return 0;
+}
+
+int k_delayed_work_cancel(struct k_delayed_work *work)
+{
+	if (disarm(work) || unqueue(&work->work)) {
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+void k_timer_init(struct k_timer *timer,
+		  void (*expiry_fn)(struct k_timer *timer),
+		  void (*stop_fn)(struct k_timer *timer))
+{
+	memset(timer, 0, sizeof(*timer));
+	timer->expiry_fn = expiry_fn;
+	timer->stop_fn = stop_fn;
+}
+
+static void timer_unlink(struct k_timer *timer)
+{
+	struct k_timer **pos;
+
+	for (pos = &armed_timers; *pos; pos = &(*pos)->next) {
+		if (*pos == timer) {
+			*pos = timer->next;
+			break;
+		}
+	}
+
+	timer->armed = false;
+}
+
+static void timer_link(struct k_timer *timer, u64_t due)
+{
+	timer->due = due;
+	timer->armed = true;
+	timer->next = armed_timers;
+	armed_timers = timer;
+}
+
+void k_timer_start(struct k_timer *timer, s32_t duration, s32_t period)
+{
+	timer_unlink(timer);
+	timer->period = period;
+	timer_link(timer, clock_us[ctx] + (u64_t)duration * USEC_PER_MSEC);
+}
+
+void k_timer_stop(struct k_timer *timer)
+{
+	bool armed = timer->armed;
+
+	timer_unlink(timer);
+	if (armed && timer->stop_fn) {
+		timer->stop_fn(timer);
+	}
+}
+
+/* Fire the first timer or delayed work due by end, if any. */
+static bool fire_next(u64_t end)
+{
+	struct k_delayed_work *work, *first_work = NULL;
+	struct k_timer *timer, *first_timer = NULL;
+
+	for (work = armed_work; work; work = work->next) {
+		if (work->due <= end &&
+		    (!first_work || work->due < first_work->due)) {
+			first_work = work;
+		}
+	}
+
+	for (timer = armed_timers; timer; timer = timer->next) {
+		if (timer->due <= end &&
+		    (!first_timer || timer->due < first_timer->due)) {
+			first_timer = timer;
+		}
+	}
+
+	if (first_timer &&
+	    (!first_work || first_timer->due <= first_work->due)) {
+		catch_up(first_timer->due);
+		timer_unlink(first_timer);
+		if (first_timer->period > 0) {
+			timer_link(first_timer, first_timer->due +
+				   (u64_t)first_timer->period *
+				   USEC_PER_MSEC);
+		}
+		first_timer->expiry_fn(first_timer);
+		return true;
+	}
+
+	if (first_work) {
+		catch_up(first_work->due);
+		disarm(first_work);
+		k_work_submit_to_queue(app_work_q, &first_work->work);
+		return true;
+	}
+
+	return false;
+}
+
+void host_sleep(u32_t ms)
+{
+	u64_t end = clock_us[ctx] + (u64_t)ms * USEC_PER_MSEC;
+
+	do {
+		host_run_work();
+	} while (fire_next(end));
+
+	catch_up(end);
+}
+
+void k_sleep(s32_t duration)
+{
+	host_sleep(duration);
+}
+
+s64_t k_uptime_get(void)
+{
+	return clock_us[ctx] / USEC_PER_MSEC;
+}
+
+u32_t k_uptime_get_32(void)
+{
+	return k_uptime_get();
+}
+
+u32_t k_cycle_get_32(void)
+{
+	return clock_us[ctx];
+}
+
+u32_t sys_clock_hw_cycles_per_sec(void)
+{
+	return 1000000U;
+}
+
+struct device *device_get_binding(const char *name)
+{
+	static struct device dev;
+
+	dev.name = name;
+	return &dev;
+}
+
+u32_t crc32_ieee_update(u32_t crc, const u8_t *data, size_t len)
+{
+	size_t i;
+	int bit;
+
+	crc = ~crc;
+	for (i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320U & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Simulated LwM2M engine, with the IPSO light control object (3311)
+ * and the light control extension object. Like the real engine, it
+ * parses the path and searches for the resource on every access, and
+ * copies typed values according to the resource's type, whatever the
+ * setter used.
+ */
+
+#include <stdlib.h>
+
+#include <zephyr.h>
+#include <net/lwm2m.h>
+
+#include "lwm2m_vendor.h"
+#include "host.h"
+
+#define STRING_SHORT	8
+#define STRING_LONG	64
+#define OPAQUE_LEN	256
+
+enum res_type {
+	RES_BOOL,
+	RES_U8,
+	RES_U32,
+	RES_S32,
+	RES_FLOAT32,
+	RES_STRING,
+	RES_OPAQUE,
+};
+
+struct res_def {
+	u16_t obj_id;
+	u16_t res_id;
+	enum res_type type;
+	u16_t len;
+};
+
+static const struct res_def res_defs[] = {
+	{ 3311, 5850, RES_BOOL, sizeof(bool) },
+	{ 3311, 5851, RES_U8, sizeof(u8_t) },
+	{ 3311, 5852, RES_S32, sizeof(s32_t) },
+	{ 3311, 5805, RES_FLOAT32, 2 * sizeof(s32_t) },
+	{ 3311, 5820, RES_FLOAT32, 2 * sizeof(s32_t) },
+	{ 3311, 5706, RES_STRING, STRING_LONG },
+	{ 3311, 5701, RES_STRING, STRING_SHORT },
+	{ LWM2M_OBJECT_LIGHT_EXT_ID, 0, RES_U32, sizeof(u32_t) },
+	{ LWM2M_OBJECT_LIGHT_EXT_ID, 1, RES_OPAQUE, OPAQUE_LEN },
+};
+
+#define INSTANCES_MAX	8
+#define RES_MAX		(ARRAY_SIZE(res_defs) * INSTANCES_MAX)
+
+struct res {
+	const struct res_def *def;
+	u16_t obj_inst_id;
+	lwm2m_engine_set_data_cb_t post_write_cb;
+	u8_t data[OPAQUE_LEN] __aligned(8);
+};
+
+static struct res resources[RES_MAX];
+static int res_count;
+
+unsigned int host_lwm2m_misaligned;
+
+static int parse_path(const char *pathstr, u16_t ids[3])
+{
+	const char *pos = pathstr;
+	char *end;
+	int count;
+
+	for (count = 0; count < 3 && *pos; count++) {
+		ids[count] = strtoul(pos, &end, 10);
+		if (end == pos || (*end && *end != '/')) {
+			return -EINVAL;
+		}
+
+		pos = *end ? end + 1 : end;
+	}
+
+	return count;
+}
+
+static struct res *res_find(const char *pathstr)
+{
+	u16_t ids[3];
+	int i;
+
+	if (parse_path(pathstr, ids) != 3) {
+		return NULL;
+	}
+
+	for (i = 0; i < res_count; i++) {
+		if (resources[i].def->obj_id == ids[0] &&
+		    resources[i].obj_inst_id == ids[1] &&
+		    resources[i].def->res_id == ids[2]) {
+			return &resources[i];
+		}
+	}
+
+	return NULL;
+}
+
+int lwm2m_engine_create_obj_inst(char *pathstr)
+{
+	u16_t ids[3];
+	size_t i;
+
+	if (parse_path(pathstr, ids) != 2) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(res_defs); i++) {
+		if (res_defs[i].obj_id != ids[0]) {
+			continue;
+		}
+
+		if (res_count >= RES_MAX) {
+			return -ENOMEM;
+		}
+
+		resources[res_count].def = &res_defs[i];
+		resources[res_count].obj_inst_id = ids[1];
+		res_count++;
+	}
+
+	return 0;
+}
+
+int lwm2m_engine_register_post_write_callback(char *pathstr,
+					      lwm2m_engine_set_data_cb_t cb)
+{
+	struct res *res = res_find(pathstr);
+
+	if (!res) {
+		return -ENOENT;
+	}
+
+	res->post_write_cb = cb;
+	return 0;
+}
+
+int lwm2m_engine_get_res_data(char *pathstr, void **data_ptr,
+			      u16_t *data_len, u8_t *data_flags)
+{
+	struct res *res = res_find(pathstr);
+
+	if (!res) {
+		return -ENOENT;
+	}
+
+	*data_ptr = res->data;
+	*data_len = res->def->len;
+	*data_flags = 0U;
+	return 0;
+}
+
+static void check_aligned(const void *value, size_t align)
+{
+	if ((uintptr_t)value & (align - 1)) {
+		host_lwm2m_misaligned++;
+	}
+}
+
+static int engine_set(char *pathstr, const void *value, u16_t len)
+{
+	struct res *res = res_find(pathstr);
+
+	if (!res) {
+		return -ENOENT;
+	}
+
+	if (len > res->def->len) {
+		return -ENOMEM;
+	}
+
+	switch (res->def->type) {
+	case RES_STRING:
+		memcpy(res->data, value, len);
+		res->data[MIN(len, res->def->len - 1)] = '\0';
+		break;
+	case RES_OPAQUE:
+		memcpy(res->data, value, len);
+		break;
+	case RES_BOOL:
+		*(bool *)res->data = *(const bool *)value;
+		break;
+	case RES_U8:
+		*(u8_t *)res->data = *(const u8_t *)value;
+		break;
+	case RES_U32:
+		check_aligned(value, sizeof(u32_t));
+		*(u32_t *)res->data = *(const u32_t *)value;
+		break;
+	case RES_S32:
+		check_aligned(value, sizeof(s32_t));
+		*(s32_t *)res->data = *(const s32_t *)value;
+		break;
+	case RES_FLOAT32:
+		check_aligned(value, sizeof(s32_t));
+		((s32_t *)res->data)[0] = ((const s32_t *)value)[0];
+		((s32_t *)res->data)[1] = ((const s32_t *)value)[1];
+		break;
+	}
+
+	if (res->post_write_cb) {
+		return res->post_write_cb(res->obj_inst_id, res->data, len,
+					  false, 0);
+	}
+
+	return 0;
+}
+
+static int engine_get(char *pathstr, void *buf, u16_t len)
+{
+	struct res *res = res_find(pathstr);
+
+	if (!res) {
+		return -ENOENT;
+	}
+
+	memcpy(buf, res->data, MIN(len, res->def->len));
+	return 0;
+}
+
+int lwm2m_engine_set_opaque(char *pathstr, char *data_ptr, u16_t data_len)
+{
+	return engine_set(pathstr, data_ptr, data_len);
+}
+
+int lwm2m_engine_set_string(char *pathstr, char *data_ptr)
+{
+	return engine_set(pathstr, data_ptr, strlen(data_ptr));
+}
+
+int lwm2m_engine_set_bool(char *pathstr, bool value)
+{
+	return engine_set(pathstr, &value, sizeof(value));
+}
+
+int lwm2m_engine_set_u8(char *pathstr, u8_t value)
+{
+	return engine_set(pathstr, &value, sizeof(value));
+}
+
+int lwm2m_engine_set_u32(char *pathstr, u32_t value)
+{
+	return engine_set(pathstr, &value, sizeof(value));
+}
+
+int lwm2m_engine_set_s32(char *pathstr, s32_t value)
+{
+	return engine_set(pathstr, &value, sizeof(value));
+}
+
+int lwm2m_engine_get_bool(char *pathstr, bool *value)
+{
+	return engine_get(pathstr, value, sizeof(*value));
+}
+
+int lwm2m_engine_get_u8(char *pathstr, u8_t *value)
+{
+	return engine_get(pathstr, value, sizeof(*value));
+}
+
+int lwm2m_engine_get_u32(char *pathstr, u32_t *value)
+{
+	return engine_get(pathstr, value, sizeof(*value));
+}
+
+int lwm2m_engine_get_s32(char *pathstr, s32_t *value)
+{
+	return engine_get(pathstr, value, sizeof(*value));
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Simulated PWM: records what each pin was last set to. */
+
+#include <zephyr.h>
+#include <pwm.h>
+
+#include "host.h"
+
+/* The nRF5 PWM peripheral's clock. */
+u64_t host_pwm_cycles_per_sec = 16000000U;
+u32_t host_pwm_pulse[HOST_PWM_PINS];
+u32_t host_pwm_period[HOST_PWM_PINS];
+unsigned int host_pwm_writes;
+void (*host_pwm_hook)(u32_t pwm, u32_t pulse);
+
+int pwm_pin_set_cycles(struct device *dev, u32_t pwm, u32_t period,
+		       u32_t pulse)
+{
+	if (pwm >= HOST_PWM_PINS || pulse > period) {
+		return -EINVAL;
+	}
+
+	host_pwm_pulse[pwm] = pulse;
+	host_pwm_period[pwm] = period;
+	host_pwm_writes++;
+	if (host_pwm_hook) {
+		host_pwm_hook(pwm, pulse);
+	}
+
+	return 0;
+}
+
+int pwm_get_cycles_per_sec(struct device *dev, u32_t pwm, u64_t *cycles)
+{
+	*cycles = host_pwm_cycles_per_sec;
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Simulated settings storage. Values can be kept in shared memory,
+ * so they survive the simulated reboots of a test which forks.
+ */
+
+#include <zephyr.h>
+#include <settings/settings.h>
+
+#include "host.h"
+
+#define ENTRIES_MAX	16
+#define NAME_MAX_LEN	32
+#define VALUE_MAX_LEN	512
+
+struct entry {
+	char name[NAME_MAX_LEN];
+	u8_t value[VALUE_MAX_LEN];
+	size_t len;
+};
+
+static struct entry local_entries[ENTRIES_MAX];
+static struct entry *entries = local_entries;
+
+#define HANDLERS_MAX	8
+static struct settings_handler *handlers[HANDLERS_MAX];
+static int handler_count;
+
+int host_settings_register_err;
+unsigned int host_settings_saves;
+
+void host_settings_shared(void)
+{
+	entries = host_shared_alloc(sizeof(local_entries));
+}
+
+void host_settings_clear(void)
+{
+	memset(entries, 0, sizeof(local_entries));
+}
+
+int settings_subsys_init(void)
+{
+	return 0;
+}
+
+int settings_register(struct settings_handler *handler)
+{
+	if (host_settings_register_err) {
+		return host_settings_register_err;
+	}
+
+	if (handler_count >= HANDLERS_MAX) {
+		return -ENOMEM;
+	}
+
+	handlers[handler_count++] = handler;
+	return 0;
+}
+
+/* Deleting a value, with a length of 0, drops its entry. */
+int settings_save_one(const char *name, void *value, size_t val_len)
+{
+	struct entry *free_entry = NULL;
+	int i;
+
+	if (strlen(name) >= NAME_MAX_LEN || val_len > VALUE_MAX_LEN) {
+		return -EINVAL;
+	}
+
+	host_settings_saves++;
+
+	for (i = 0; i < ENTRIES_MAX; i++) {
+		if (!entries[i].name[0]) {
+			free_entry = free_entry ? free_entry : &entries[i];
+		} else if (!strcmp(entries[i].name, name)) {
+			break;
+		}
+	}
+
+	if (i == ENTRIES_MAX) {
+		if (!val_len) {
+			return 0;
+		}
+		if (!free_entry) {
+			return -ENOMEM;
+		}
+		i = free_entry - entries;
+	}
+
+	if (!val_len) {
+		memset(&entries[i], 0, sizeof(entries[i]));
+		return 0;
+	}
+
+	strcpy(entries[i].name, name);
+	memcpy(entries[i].value, value, val_len);
+	entries[i].len = val_len;
+	return 0;
+}
+
+int settings_val_read_cb(void *value_ctx, void *buf, size_t len)
+{
+	struct entry *entry = value_ctx;
+
+	len = MIN(len, entry->len);
+	memcpy(buf, entry->value, len);
+	return len;
+}
+
+int settings_load(void)
+{
+	char name[NAME_MAX_LEN];
+	char *argv[4], *pos;
+	size_t prefix_len = 0;
+	int i, h, argc;
+
+	for (i = 0; i < ENTRIES_MAX; i++) {
+		if (!entries[i].name[0]) {
+			continue;
+		}
+
+		for (h = 0; h < handler_count; h++) {
+			prefix_len = strlen(handlers[h]->name);
+			if (!strncmp(entries[i].name, handlers[h]->name,
+				     prefix_len) &&
+			    entries[i].name[prefix_len] == '/') {
+				break;
+			}
+		}
+
+		if (h == handler_count) {
+			continue;
+		}
+
+		strcpy(name, entries[i].name + prefix_len + 1);
+		argc = 0;
+		for (pos = strtok(name, "/"); pos && argc < 4;
+		     pos = strtok(NULL, "/")) {
+			argv[argc++] = pos;
+		}
+
+		(void)handlers[h]->h_set(argc, argv, &entries[i]);
+	}
+
+	return 0;
+}
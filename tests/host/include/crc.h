@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_CRC_H__
+#define HOST_CRC_H__
+
+#include <zephyr/types.h>
+
+u32_t crc32_ieee_update(u32_t crc, const u8_t *data, size_t len);
+
+#endif	/* HOST_CRC_H__ */
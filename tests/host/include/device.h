@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_DEVICE_H__
+#define HOST_DEVICE_H__
+
+struct device {
+	const char *name;
+};
+
+/* Every device exists, so tests don't have to declare them. */
+struct device *device_get_binding(const char *name);
+
+#endif	/* HOST_DEVICE_H__ */
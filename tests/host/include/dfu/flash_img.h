@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_DFU_FLASH_IMG_H__
+#define HOST_DFU_FLASH_IMG_H__
+
+#include <zephyr/types.h>
+
+struct flash_img_context {
+	u8_t buf[CONFIG_IMG_BLOCK_BUF_SIZE];
+	size_t bytes_written;
+	u16_t buf_bytes;
+};
+
+int flash_img_init(struct flash_img_context *ctx);
+
+#endif	/* HOST_DFU_FLASH_IMG_H__ */
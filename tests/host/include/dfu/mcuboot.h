@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_DFU_MCUBOOT_H__
+#define HOST_DFU_MCUBOOT_H__
+
+#include <zephyr/types.h>
+
+int boot_invalidate_slot1(void);
+int boot_erase_img_bank(u8_t area_id);
+
+#endif	/* HOST_DFU_MCUBOOT_H__ */
@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_FLASH_H__
+#define HOST_FLASH_H__
+
+#include <sys/types.h>
+#include <zephyr/types.h>
+#include <device.h>
+
+int flash_read(struct device *dev, off_t offset, void *data, size_t len);
+int flash_write(struct device *dev, off_t offset, const void *data,
+		size_t len);
+int flash_erase(struct device *dev, off_t offset, size_t size);
+int flash_write_protection_set(struct device *dev, bool enable);
+
+#endif	/* HOST_FLASH_H__ */
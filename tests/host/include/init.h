@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_INIT_H__
+#define HOST_INIT_H__
+
+#include <device.h>
+
+/* Init functions run before main(), in no particular order. */
+#define SYS_INIT(fn, level, prio)					\
+	static void __attribute__((constructor)) fn##_sys_init(void)	\
+	{								\
+		(void)fn(NULL);						\
+	}
+
+#endif	/* HOST_INIT_H__ */
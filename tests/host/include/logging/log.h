@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_LOGGING_LOG_H__
+#define HOST_LOGGING_LOG_H__
+
+/*
+ * Messages go to stderr, errors and warnings always and the rest if
+ * HOST_LOG is set in the environment.
+ */
+void host_log(int level, const char *fmt, ...);
+
+#define LOG_MODULE_REGISTER(name)
+#define LOG_MODULE_DECLARE(name)
+
+#define LOG_ERR(...) host_log(1, __VA_ARGS__)
+#define LOG_WRN(...) host_log(2, __VA_ARGS__)
+#define LOG_INF(...) host_log(3, __VA_ARGS__)
+#define LOG_DBG(...) host_log(4, __VA_ARGS__)
+
+#endif	/* HOST_LOGGING_LOG_H__ */
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_MISC_BYTEORDER_H__
+#define HOST_MISC_BYTEORDER_H__
+
+#include <zephyr/types.h>
+
+static inline void sys_put_le16(u16_t val, u8_t dst[2])
+{
+	dst[0] = val;
+	dst[1] = val >> 8;
+}
+
+static inline void sys_put_le32(u32_t val, u8_t dst[4])
+{
+	sys_put_le16(val, dst);
+	sys_put_le16(val >> 16, &dst[2]);
+}
+
+static inline u16_t sys_get_le16(const u8_t src[2])
+{
+	return ((u16_t)src[1] << 8) | src[0];
+}
+
+static inline u32_t sys_get_le32(const u8_t src[4])
+{
+	return ((u32_t)sys_get_le16(&src[2]) << 16) | sys_get_le16(src);
+}
+
+static inline u16_t sys_get_be16(const u8_t src[2])
+{
+	return ((u16_t)src[0] << 8) | src[1];
+}
+
+#endif	/* HOST_MISC_BYTEORDER_H__ */
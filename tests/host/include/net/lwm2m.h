@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_NET_LWM2M_H__
+#define HOST_NET_LWM2M_H__
+
+#include <zephyr/types.h>
+
+/* The engine API used by the application; see host_lwm2m.c. */
+
+typedef int (*lwm2m_engine_set_data_cb_t)(u16_t obj_inst_id, u8_t *data,
+					  u16_t data_len, bool last_block,
+					  size_t total_size);
+
+int lwm2m_engine_create_obj_inst(char *pathstr);
+int lwm2m_engine_register_post_write_callback(char *pathstr,
+					      lwm2m_engine_set_data_cb_t cb);
+int lwm2m_engine_get_res_data(char *pathstr, void **data_ptr,
+			      u16_t *data_len, u8_t *data_flags);
+
+int lwm2m_engine_set_opaque(char *pathstr, char *data_ptr, u16_t data_len);
+int lwm2m_engine_set_string(char *pathstr, char *data_ptr);
+int lwm2m_engine_set_bool(char *pathstr, bool value);
+int lwm2m_engine_set_u8(char *pathstr, u8_t value);
+int lwm2m_engine_set_u32(char *pathstr, u32_t value);
+int lwm2m_engine_set_s32(char *pathstr, s32_t value);
+
+int lwm2m_engine_get_bool(char *pathstr, bool *value);
+int lwm2m_engine_get_u8(char *pathstr, u8_t *value);
+int lwm2m_engine_get_u32(char *pathstr, u32_t *value);
+int lwm2m_engine_get_s32(char *pathstr, s32_t *value);
+
+#endif	/* HOST_NET_LWM2M_H__ */
@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_PWM_H__
+#define HOST_PWM_H__
+
+#include <zephyr/types.h>
+#include <device.h>
+
+int pwm_pin_set_cycles(struct device *dev, u32_t pwm, u32_t period,
+		       u32_t pulse);
+int pwm_get_cycles_per_sec(struct device *dev, u32_t pwm, u64_t *cycles);
+
+#endif	/* HOST_PWM_H__ */
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_SETTINGS_SETTINGS_H__
+#define HOST_SETTINGS_SETTINGS_H__
+
+#include <zephyr/types.h>
+
+struct settings_handler {
+	char *name;
+	int (*h_set)(int argc, char **argv, void *value_ctx);
+};
+
+int settings_subsys_init(void);
+int settings_register(struct settings_handler *handler);
+int settings_load(void);
+int settings_save_one(const char *name, void *value, size_t val_len);
+int settings_val_read_cb(void *value_ctx, void *buf, size_t len);
+
+#endif	/* HOST_SETTINGS_SETTINGS_H__ */
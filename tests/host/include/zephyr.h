@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_ZEPHYR_H__
+#define HOST_ZEPHYR_H__
+
+/*
+ * Just enough of the Zephyr kernel API to run the application's
+ * sources on the host, single threaded, against a simulated clock.
+ * See host_kernel.c.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/types.h>
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define BIT(n) (1UL << (n))
+#define CONTAINER_OF(ptr, type, field) \
+	((type *)(((char *)(ptr)) - offsetof(type, field)))
+#define ROUND_UP(x, align) ((((x) + ((align) - 1)) / (align)) * (align))
+#define ROUND_DOWN(x, align) (((x) / (align)) * (align))
+
+#define MSEC_PER_SEC 1000
+#define USEC_PER_MSEC 1000
+
+#define K_NO_WAIT 0
+#define K_FOREVER (-1)
+
+#define __packed __attribute__((__packed__))
+#define __aligned(x) __attribute__((__aligned__(x)))
+#define FUNC_NORETURN __attribute__((__noreturn__))
+#define BUILD_ASSERT(cond) _Static_assert(cond, #cond)
+#define BUILD_ASSERT_MSG(cond, msg) _Static_assert(cond, msg)
+
+#define snprintk snprintf
+#define printk printf
+
+typedef long atomic_t;
+
+static inline long atomic_get(const atomic_t *target)
+{
+	return *target;
+}
+
+static inline long atomic_set(atomic_t *target, long value)
+{
+	long old = *target;
+
+	*target = value;
+	return old;
+}
+
+static inline long atomic_clear(atomic_t *target)
+{
+	return atomic_set(target, 0);
+}
+
+static inline unsigned int irq_lock(void)
+{
+	return 0;
+}
+
+static inline void irq_unlock(unsigned int key)
+{
+}
+
+/*
+ * Work runs when the test says so, or when the main context would
+ * block on a semaphore, in a context of its own: each context has
+ * its own clock, and a semaphore given in one context and taken in
+ * the other brings the taker's clock up to the time of the give. Time
+ * spent in simulated hardware thus overlaps as it would with a
+ * thread per context.
+ */
+struct k_work;
+typedef void (*k_work_handler_t)(struct k_work *work);
+
+struct k_work_q {
+	int unused;
+};
+
+struct k_work {
+	k_work_handler_t handler;
+	struct k_work *next;
+	bool pending;
+	u64_t queued_at;
+};
+
+struct k_delayed_work {
+	struct k_work work;
+	struct k_delayed_work *next;
+	bool armed;
+	u64_t due;
+};
+
+struct k_timer {
+	void (*expiry_fn)(struct k_timer *timer);
+	void (*stop_fn)(struct k_timer *timer);
+	struct k_timer *next;
+	bool armed;
+	u64_t due;
+	s32_t period;
+};
+
+/* Times of the gives not taken yet, oldest first. */
+#define K_SEM_GIVES_MAX 32
+
+struct k_sem {
+	unsigned int count;
+	unsigned int limit;
+	unsigned int first;
+	u64_t given_at[K_SEM_GIVES_MAX];
+};
+
+#define K_SEM_DEFINE(name, initial_count, count_limit)	\
+	struct k_sem name = {				\
+		.count = initial_count,			\
+		.limit = count_limit,			\
+	}
+
+void k_sem_init(struct k_sem *sem, unsigned int initial_count,
+		unsigned int limit);
+int k_sem_take(struct k_sem *sem, s32_t timeout);
+void k_sem_give(struct k_sem *sem);
+
+static inline unsigned int k_sem_count_get(struct k_sem *sem)
+{
+	return sem->count;
+}
+
+void k_work_init(struct k_work *work, k_work_handler_t handler);
+void k_work_submit_to_queue(struct k_work_q *work_q, struct k_work *work);
+
+void k_delayed_work_init(struct k_delayed_work *work,
+			 k_work_handler_t handler);
+int k_delayed_work_submit_to_queue(struct k_work_q *work_q,
+				   struct k_delayed_work *work,
+				   s32_t delay);
+int k_delayed_work_cancel(struct k_delayed_work *work);
+
+void k_timer_init(struct k_timer *timer,
+		  void (*expiry_fn)(struct k_timer *timer),
+		  void (*stop_fn)(struct k_timer *timer));
+void k_timer_start(struct k_timer *timer, s32_t duration, s32_t period);
+void k_timer_stop(struct k_timer *timer);
+
+s64_t k_uptime_get(void);
+u32_t k_uptime_get_32(void);
+/* One cycle per microsecond of simulated time. */
+u32_t k_cycle_get_32(void);
+u32_t sys_clock_hw_cycles_per_sec(void);
+
+void k_sleep(s32_t duration);
+
+#endif	/* HOST_ZEPHYR_H__ */
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Boot with persisted light state, with the PWM backend: the saved
+ * state must be what the lights show first, as soon as they are set
+ * up, and a failure to set up persistence must leave the defaults.
+ * The firmware update counter must survive changes to the persisted
+ * state's layout, as when updating or rolling back, and be saved even
+ * without persistence. Each boot is a child process, with the
+ * settings in shared memory.
+ */
+
+/* Built into this file, for its registered instances. */
+#include "light_control.c"
+
+#include <settings/settings.h>
+
+#include "persist.h"
+#include "settings.h"
+#include "host.h"
+
+#define RESTORED_COLOR	"#FF8000"
+#define RESTORED_DIMMER	40
+
+#define WRITES_MAX	64
+
+static struct {
+	u32_t uptime;
+	u32_t pin;
+	u32_t pulse;
+} writes[WRITES_MAX];
+static unsigned int write_count;
+
+/* Set to persist one more part, as a newer firmware might. */
+static bool upgraded;
+static u8_t upgrade_part[4];
+/* Set to make setting up persistence fail. */
+static bool broken;
+
+static void record_write(u32_t pin, u32_t pulse)
+{
+	if (write_count < WRITES_MAX) {
+		writes[write_count].uptime = k_uptime_get_32();
+		writes[write_count].pin = pin;
+		writes[write_count].pulse = pulse;
+		write_count++;
+	}
+}
+
+/* The start of main(): a persistence failure leaves the defaults. */
+static void boot(void)
+{
+	int ret;
+
+	CHECK_EQ(fota_settings_init(), 0);
+
+	if (broken) {
+		host_settings_register_err = -EIO;
+	}
+
+	ret = persist_init();
+	if (!ret) {
+		ret = light_control_persist();
+	}
+
+	if (!ret && upgraded) {
+		ret = persist_add_part("upgrade", upgrade_part,
+				       sizeof(upgrade_part), NULL);
+	}
+
+	if (ret) {
+		LOG_ERR("Persistent state unavailable (err %d), "
+			"using the defaults", ret);
+	}
+
+	CHECK_EQ(settings_load(), 0);
+	CHECK_EQ(init_light_control(), 0);
+}
+
+static void first_boot(void)
+{
+	struct ipso_light_ctl *ilc = ilcs[0];
+
+	boot();
+	CHECK_EQ(fota_update_counter_update(COUNTER_CURRENT, 3), 0);
+	CHECK_EQ(fota_update_counter_update(COUNTER_UPDATE, 4), 0);
+	CHECK_EQ(host_settings_saves, 2);
+
+	CHECK_EQ(ilc_set_color(ilc, RESTORED_COLOR), 0);
+	CHECK_EQ(ilc_set_dimmer(ilc, RESTORED_DIMMER), 0);
+	CHECK_EQ(ilc_set_onoff(ilc, true), 0);
+	host_sleep(CONFIG_APP_PERSIST_QUIET_MS + MSEC_PER_SEC);
+
+	CHECK_EQ(host_settings_saves, 3);
+}
+
+/* Every pin goes straight to its restored level, at once. */
+static void restoring_boot(void)
+{
+	struct ipso_light_ctl *ilc = ilcs[0];
+	unsigned int i;
+	u8_t dimmer = 0U;
+	bool on = false;
+
+	host_pwm_hook = record_write;
+	boot();
+	host_sleep(MSEC_PER_SEC);
+
+	CHECK(write_count > 0);
+	for (i = 0U; i < write_count; i++) {
+		CHECK_EQ(writes[i].uptime, 0);
+		CHECK_EQ(writes[i].pulse, host_pwm_pulse[writes[i].pin]);
+	}
+
+	/* Orange: red full, green about half, blue off. */
+	CHECK(host_pwm_pulse[CONFIG_APP_PWM_RED_PIN] >
+	      host_pwm_pulse[CONFIG_APP_PWM_GREEN_PIN]);
+	CHECK(host_pwm_pulse[CONFIG_APP_PWM_GREEN_PIN] > 0);
+	CHECK_EQ(host_pwm_pulse[CONFIG_APP_PWM_BLUE_PIN], 0);
+
+	CHECK_EQ(ilc_get_dimmer(ilc, &dimmer), 0);
+	CHECK_EQ(dimmer, RESTORED_DIMMER);
+	CHECK_EQ(ilc_get_onoff(ilc, &on), 0);
+	CHECK(on);
+	CHECK_EQ(memcmp(ilc->color_rgb, "\xff\x80\x00", 3), 0);
+
+	/* Restoring isn't a change to save. */
+	host_sleep(CONFIG_APP_PERSIST_MAX_DELAY * MSEC_PER_SEC);
+	CHECK_EQ(host_settings_saves, 0);
+}
+
+static void check_counter(u32_t current)
+{
+	struct update_counter uc;
+
+	CHECK_EQ(fota_update_counter_read(&uc), 0);
+	CHECK_EQ(uc.current, current);
+	CHECK_EQ(uc.update, 4);
+}
+
+/*
+ * Another layout drops the saved light state, and then saves its own,
+ * but the update counter is kept either way.
+ */
+static void upgraded_boot(void)
+{
+	struct ipso_light_ctl *ilc = ilcs[0];
+	u8_t dimmer = 0U;
+
+	upgraded = true;
+	boot();
+	check_counter(3);
+	CHECK_EQ(ilc_get_dimmer(ilc, &dimmer), 0);
+	CHECK_EQ(dimmer, 50);
+
+	CHECK_EQ(ilc_set_dimmer(ilc, 10), 0);
+	host_sleep(CONFIG_APP_PERSIST_QUIET_MS + MSEC_PER_SEC);
+	CHECK_EQ(host_settings_saves, 1);
+}
+
+static void rolled_back_boot(void)
+{
+	boot();
+	check_counter(3);
+}
+
+/*
+ * Without persistence, the lights still come up, in their defaults,
+ * and the update counter is still saved, as the update completes.
+ */
+static void boot_without_persistence(void)
+{
+	struct ipso_light_ctl *ilc = ilcs[0];
+	u8_t dimmer = 0U;
+	bool on = true;
+
+	broken = true;
+	boot();
+	host_sleep(MSEC_PER_SEC);
+
+	CHECK_EQ(ilc_get_dimmer(ilc, &dimmer), 0);
+	/* The PWM backend's default. */
+	CHECK_EQ(dimmer, 50);
+	CHECK_EQ(ilc_get_onoff(ilc, &on), 0);
+	CHECK(!on);
+
+	CHECK_EQ(fota_update_counter_update(COUNTER_CURRENT, 4), 0);
+	CHECK_EQ(host_settings_saves, 1);
+}
+
+static void updated_boot(void)
+{
+	boot();
+	check_counter(4);
+}
+
+int main(void)
+{
+	host_settings_shared();
+
+	CHECK_EQ(host_reboot(first_boot), 0);
+	CHECK_EQ(host_reboot(restoring_boot), 0);
+	CHECK_EQ(host_reboot(upgraded_boot), 0);
+	CHECK_EQ(host_reboot(rolled_back_boot), 0);
+	CHECK_EQ(host_reboot(boot_without_persistence), 0);
+	CHECK_EQ(host_reboot(updated_boot), 0);
+
+	return host_result("test_boot");
+}
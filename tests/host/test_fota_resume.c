@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Resuming firmware downloads across power losses. Each boot is a
+ * child process; the flash slot and the settings are shared memory,
+ * so they survive it, and power is cut by exiting in the middle of a
+ * flash write.
+ */
+
+#include <stdlib.h>
+
+#include <zephyr.h>
+#include <settings/settings.h>
+
+#include "fota_download.h"
+#include "settings.h"
+#include "host.h"
+
+#define IMAGE_SIZE (160 * 1024 + 100)
+#define BLOCK_SIZE CONFIG_LWM2M_COAP_BLOCK_SIZE
+/* Past the third checkpoint, which is at 96 KiB. */
+#define POWER_LOSS_AT (100 * 1024)
+
+#define URI_1 "coap://fw/zmp-1.bin"
+#define URI_2 "coap://fw/zmp-2.bin"
+
+static u8_t image_a[IMAGE_SIZE];
+/* Same size as A, but another image. */
+static u8_t image_b[IMAGE_SIZE];
+/* A with a change past its first block, before the checkpoint. */
+static u8_t image_c[IMAGE_SIZE];
+
+static int download(const char *uri, const u8_t *image)
+{
+	u32_t off, len;
+	int ret = 0;
+
+	fota_download_set_source(uri, strlen(uri));
+	for (off = 0U; off < IMAGE_SIZE && !ret; off += len) {
+		len = MIN(BLOCK_SIZE, IMAGE_SIZE - off);
+		host_spend_us(2 * USEC_PER_MSEC);
+		ret = fota_download_block((u8_t *)image + off, len,
+					  off + len == IMAGE_SIZE,
+					  IMAGE_SIZE);
+	}
+
+	return ret;
+}
+
+static void boot(void)
+{
+	CHECK_EQ(fota_settings_init(), 0);
+	CHECK_EQ(settings_load(), 0);
+	CHECK_EQ(fota_download_init(device_get_binding("flash")), 0);
+	host_sleep(MSEC_PER_SEC);
+}
+
+static bool checkpoint_saved(void)
+{
+	struct fota_download_checkpoint cp;
+
+	return !fota_download_checkpoint_read(&cp);
+}
+
+static void lose_power_downloading_a(void)
+{
+	boot();
+	host_flash_power_loss_after(POWER_LOSS_AT);
+	(void)download(URI_1, image_a);
+}
+
+/* The same image resumes from the checkpoint. */
+static void download_a_again(void)
+{
+	boot();
+	CHECK(checkpoint_saved());
+	CHECK_EQ(download(URI_1, image_a), 0);
+	CHECK(!memcmp(host_flash_slot(), image_a, IMAGE_SIZE));
+	CHECK(host_flash_stats.programmed < IMAGE_SIZE - 64 * 1024);
+	CHECK(!checkpoint_saved());
+}
+
+/* Another image of the same size starts over, and succeeds. */
+static void download_b(void)
+{
+	boot();
+	CHECK(checkpoint_saved());
+	CHECK_EQ(download(URI_1, image_b), 0);
+	CHECK(!memcmp(host_flash_slot(), image_b, IMAGE_SIZE));
+	CHECK(host_flash_stats.programmed >= IMAGE_SIZE);
+	CHECK_EQ(host_flash_stats.overwrites, 0);
+	CHECK(!checkpoint_saved());
+}
+
+/* A from elsewhere may be another build: it starts over. */
+static void download_a_from_elsewhere(void)
+{
+	boot();
+	CHECK(checkpoint_saved());
+	CHECK_EQ(download(URI_2, image_a), 0);
+	CHECK(!memcmp(host_flash_slot(), image_a, IMAGE_SIZE));
+	CHECK(host_flash_stats.programmed >= IMAGE_SIZE);
+	CHECK(!checkpoint_saved());
+}
+
+/*
+ * An image which can't be told apart from A by its first block fails
+ * when the difference shows, without leaving a checkpoint behind, so
+ * the server's next attempt starts over.
+ */
+static void download_c(void)
+{
+	boot();
+	CHECK(checkpoint_saved());
+	CHECK(download(URI_1, image_c) < 0);
+	CHECK(!checkpoint_saved());
+	CHECK_EQ(download(URI_1, image_c), 0);
+	CHECK(!memcmp(host_flash_slot(), image_c, IMAGE_SIZE));
+}
+
+static void expect_power_loss(void)
+{
+	CHECK_EQ(host_reboot(lose_power_downloading_a), HOST_POWER_LOSS);
+}
+
+int main(void)
+{
+	size_t i;
+
+	srand(1);
+	for (i = 0; i < IMAGE_SIZE; i++) {
+		image_a[i] = rand();
+		image_b[i] = rand();
+	}
+	memcpy(image_c, image_a, IMAGE_SIZE);
+	image_c[50 * 1024] ^= 0x01;
+
+	host_flash_shared();
+	host_settings_shared();
+
+	expect_power_loss();
+	CHECK_EQ(host_reboot(download_a_again), 0);
+
+	expect_power_loss();
+	CHECK_EQ(host_reboot(download_b), 0);
+
+	expect_power_loss();
+	CHECK_EQ(host_reboot(download_a_from_elsewhere), 0);
+
+	expect_power_loss();
+	CHECK_EQ(host_reboot(download_c), 0);
+
+	return host_result("test_fota_resume");
+}
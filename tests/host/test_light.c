@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Light control object behavior, with the PWM backend. */
+
+/* Built into this file, for its registered instances. */
+#include "light_control.c"
+
+#include "host.h"
+
+/* The PWM backend can't flash. */
+static void test_flash_unsupported(void)
+{
+	CHECK_EQ(light_control_flash(0xff, 0x00, 0x00, 100), -ENOTSUP);
+}
+
+/* An out of range dimmer level is clamped, in the engine too. */
+static void test_dimmer_clamp(void)
+{
+	struct ipso_light_ctl *ilc = ilcs[0];
+	u8_t dimmer = 0U;
+
+	CHECK_EQ(ilc_set_onoff(ilc, true), 0);
+	CHECK_EQ(ilc_set_dimmer(ilc, 150), 0);
+	host_sleep(CONFIG_APP_LIGHT_COALESCE_MS);
+
+	CHECK_EQ(ilc_get_dimmer(ilc, &dimmer), 0);
+	CHECK_EQ(dimmer, 100);
+	CHECK_EQ(ilc->cur_frame.dimmer, 100);
+}
+
+int main(void)
+{
+	CHECK_EQ(init_light_control(), 0);
+	host_sleep(CONFIG_APP_LIGHT_COALESCE_MS);
+
+	test_flash_unsupported();
+	test_dimmer_clamp();
+
+	return host_result("test_light");
+}
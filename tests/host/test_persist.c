@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Persisted state record: typed resources packed after a block of
+ * odd length land misaligned in the record, and must still reach
+ * the engine aligned when they are restored.
+ */
+
+#include <zephyr.h>
+#include <net/lwm2m.h>
+#include <settings/settings.h>
+
+#include "lwm2m_vendor.h"
+#include "persist.h"
+#include "host.h"
+
+#define TRANSITION_TIME	LWM2M_OBJECT_LIGHT_EXT "/0/0"
+#define ON_TIME		"3311/0/5852"
+
+/* Three bytes, to put whatever follows off its alignment. */
+static u8_t block[3];
+
+static void set_state(u8_t fill, u32_t transition_time, s32_t on_time)
+{
+	memset(block, fill, sizeof(block));
+	CHECK_EQ(lwm2m_engine_set_u32(TRANSITION_TIME, transition_time), 0);
+	CHECK_EQ(lwm2m_engine_set_s32(ON_TIME, on_time), 0);
+}
+
+static void test_restore_aligned(void)
+{
+	u32_t transition_time = 0U;
+	s32_t on_time = 0;
+
+	set_state(0xa5, 0x12345678, -42);
+	CHECK_EQ(persist_flush(), 0);
+	CHECK_EQ(host_settings_saves, 1);
+
+	set_state(0x00, 0, 0);
+	host_lwm2m_misaligned = 0U;
+	CHECK_EQ(settings_load(), 0);
+
+	CHECK_EQ(block[0], 0xa5);
+	CHECK_EQ(block[2], 0xa5);
+	CHECK_EQ(lwm2m_engine_get_u32(TRANSITION_TIME, &transition_time), 0);
+	CHECK_EQ(transition_time, 0x12345678);
+	CHECK_EQ(lwm2m_engine_get_s32(ON_TIME, &on_time), 0);
+	CHECK_EQ(on_time, -42);
+	CHECK_EQ(host_lwm2m_misaligned, 0);
+}
+
+int main(void)
+{
+	CHECK_EQ(lwm2m_engine_create_obj_inst("3311/0"), 0);
+	CHECK_EQ(lwm2m_engine_create_obj_inst(LWM2M_OBJECT_LIGHT_EXT "/0"),
+		 0);
+
+	CHECK_EQ(persist_init(), 0);
+	CHECK_EQ(persist_add_part("block", block, sizeof(block), NULL), 0);
+	CHECK_EQ(persist_add(TRANSITION_TIME), 0);
+	CHECK_EQ(persist_add(ON_TIME), 0);
+
+	test_restore_aligned();
+
+	return host_result("test_persist");
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The PWM backend's color calibration, checked against the same
+ * calibration computed exactly, for each channel level from 0 to 255,
+ * with the other channels at a few levels, at every dimmer level.
+ *
+ * With the identity matrix and unity gains the output level must be
+ * exact, and the pulse within a cycle of it; full scale must give the
+ * whole period.
+ * Otherwise, each fixed-point coefficient is within 4 units of
+ * 2^-CAL_SHIFT of the exact one, so each output level is within
+ * 3 * 4 + 1 levels, the last for the final shift.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <zephyr.h>
+
+#include "light_control_priv.h"
+#include "light_dimming.h"
+#include "host.h"
+
+#define LEVEL_TOLERANCE 13
+
+/* The pins of the red, green, blue and white channels. */
+static const int pins[] = {
+	CONFIG_APP_PWM_RED_PIN,
+	CONFIG_APP_PWM_GREEN_PIN,
+	CONFIG_APP_PWM_BLUE_PIN,
+#if defined(CONFIG_APP_PWM_WHITE)
+	CONFIG_APP_PWM_WHITE_PIN,
+#endif
+};
+
+static struct ipso_light_ctl *ilc;
+
+/* Registration of the backend, instead of light_control.c's. */
+int light_control_register(struct ipso_light_ctl *light_control)
+{
+	ilc = light_control;
+	return 0;
+}
+
+static double matrix[3][3];
+static double gain[4];
+
+static void parse(const char *str, double *values, int count)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		values[i] = strtol(str, &end, 10) / 1000.0;
+		str = end + 1;
+	}
+}
+
+/* Exact output level of each channel for dimmed input levels. */
+static void reference(const u16_t in[3], double out[4])
+{
+	int o, i;
+
+	out[3] = 0.0;
+
+#if defined(CONFIG_APP_PWM_WHITE)
+	if (in[0] == in[1] && in[1] == in[2]) {
+		out[0] = out[1] = out[2] = 0.0;
+		out[3] = MIN(in[0] * gain[3], LIGHT_DIM_MAX);
+		return;
+	}
+#endif
+
+	for (o = 0; o < 3; o++) {
+		out[o] = 0.0;
+		for (i = 0; i < 3; i++) {
+			out[o] += in[i] * matrix[o][i] * gain[o];
+		}
+		out[o] = MAX(0.0, MIN(out[o], LIGHT_DIM_MAX));
+	}
+}
+
+static double max_error;
+
+static void check_frame(const struct ilc_frame *frame)
+{
+	double ref[4], error;
+	u32_t period, pulse, exact_pulse;
+	u16_t in[3];
+	bool exact;
+	size_t c;
+
+	CHECK_EQ(ilc->set_frame(ilc, frame), 0);
+
+	for (c = 0; c < 3; c++) {
+		in[c] = light_dim_wide(frame->rgb[c], frame->dimmer);
+	}
+	reference(in, ref);
+
+	exact = matrix[0][0] == 1.0 && matrix[1][1] == 1.0 &&
+		matrix[2][2] == 1.0 && matrix[0][1] == 0.0 &&
+		gain[0] == 1.0 && gain[1] == 1.0 && gain[2] == 1.0 &&
+		gain[3] == 1.0;
+
+	for (c = 0; c < ARRAY_SIZE(pins); c++) {
+		period = host_pwm_period[pins[c]];
+		pulse = host_pwm_pulse[pins[c]];
+
+		CHECK(pulse <= period);
+
+		/* The pulse for the exact level, in levels. */
+		error = fabs((double)pulse * LIGHT_DIM_MAX / period - ref[c]);
+		max_error = MAX(max_error, error);
+
+		if (exact) {
+			exact_pulse = (u64_t)period * (u32_t)ref[c] /
+				LIGHT_DIM_MAX;
+			CHECK(pulse + 1 >= exact_pulse &&
+			      pulse <= exact_pulse + 1);
+			if (ref[c] == LIGHT_DIM_MAX) {
+				CHECK_EQ(pulse, period);
+			}
+		} else if (error > LEVEL_TOLERANCE +
+			   (double)LIGHT_DIM_MAX / period && host_fail()) {
+			fprintf(stderr, "#%02x%02x%02x at %u%%: channel %zu "
+				"pulse %u/%u, expected level %.1f\n",
+				frame->rgb[0], frame->rgb[1], frame->rgb[2],
+				frame->dimmer, c, pulse, period, ref[c]);
+		}
+
+		/* Nothing but black at dimmer 0. */
+		if (!frame->dimmer) {
+			CHECK_EQ(pulse, 0);
+		}
+	}
+}
+
+static void sweep(void)
+{
+	static const u8_t others[] = { 0, 1, 128, 254, 255 };
+	struct ilc_frame frame;
+	int dimmer, level, c, a, b;
+
+	for (dimmer = 0; dimmer <= 100; dimmer++) {
+		frame.dimmer = dimmer;
+		for (c = 0; c < 3; c++) {
+			for (a = 0; a < ARRAY_SIZE(others); a++) {
+				for (b = 0; b < ARRAY_SIZE(others); b++) {
+					for (level = 0; level <= 255;
+					     level++) {
+						frame.rgb[c] = level;
+						frame.rgb[(c + 1) % 3] =
+							others[a];
+						frame.rgb[(c + 2) % 3] =
+							others[b];
+						check_frame(&frame);
+					}
+				}
+			}
+		}
+	}
+}
+
+/* Each channel's output may only grow with the dimmer level. */
+static void check_monotonic(void)
+{
+	static const u8_t colors[][3] = {
+		{ 255, 255, 255 }, { 255, 0, 0 }, { 0, 255, 0 },
+		{ 0, 0, 255 }, { 200, 100, 50 }, { 1, 2, 3 },
+	};
+	struct ilc_frame frame;
+	u32_t prev[ARRAY_SIZE(pins)];
+	size_t i, c;
+	int dimmer;
+
+	for (i = 0; i < ARRAY_SIZE(colors); i++) {
+		memcpy(frame.rgb, colors[i], sizeof(frame.rgb));
+		memset(prev, 0, sizeof(prev));
+		for (dimmer = 0; dimmer <= 100; dimmer++) {
+			frame.dimmer = dimmer;
+			CHECK_EQ(ilc->set_frame(ilc, &frame), 0);
+			for (c = 0; c < ARRAY_SIZE(pins); c++) {
+				CHECK(host_pwm_pulse[pins[c]] >= prev[c]);
+				prev[c] = host_pwm_pulse[pins[c]];
+			}
+		}
+	}
+}
+
+static bool non_negative(void)
+{
+	int o, i;
+
+	for (o = 0; o < 3; o++) {
+		for (i = 0; i < 3; i++) {
+			if (matrix[o][i] < 0.0) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+int main(void)
+{
+	/*
+	 * The nRF5 PWM clock, one for the longest period with enough
+	 * fractional bits, and one slower than the dimming curve.
+	 */
+	static const u64_t clocks[] = { 16000000U, 104857600U, 125000U };
+	size_t i;
+
+	parse(CONFIG_APP_PWM_COLOR_MATRIX, &matrix[0][0], 9);
+	parse(CONFIG_APP_PWM_WHITE_BALANCE, gain, 4);
+
+	CHECK(ilc != NULL);
+	if (!ilc) {
+		return host_result("test_pwm_calibration");
+	}
+
+	for (i = 0; i < ARRAY_SIZE(clocks); i++) {
+		host_pwm_cycles_per_sec = clocks[i];
+		max_error = 0.0;
+
+		CHECK_EQ(ilc->pre_init(ilc), 0);
+		sweep();
+		CHECK_EQ(host_pwm_period[pins[0]],
+			 clocks[i] / CONFIG_APP_PWM_FREQUENCY);
+		if (non_negative()) {
+			check_monotonic();
+		}
+
+		printf("%s, %s, %llu Hz clock: max error %.2f levels\n",
+		       CONFIG_APP_PWM_COLOR_MATRIX,
+		       CONFIG_APP_PWM_WHITE_BALANCE,
+		       (unsigned long long)clocks[i], max_error);
+	}
+
+	return host_result("test_pwm_calibration");
+}
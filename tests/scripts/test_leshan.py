@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Rollouts by scripts/leshan.py against scripts/leshan_sim.py.
+
+Each test starts a simulator on a free port and runs leshan.py on it,
+then checks the exit status and the state file. Run with:
+
+    python3 tests/scripts/test_leshan.py"""
+
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import unittest
+
+SCRIPTS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                       '..', '..', 'scripts')
+URL = 'coap://fw/zmp.bin'
+DEVICES = 40
+SEGMENTS = 4
+
+
+class RolloutTest(unittest.TestCase):
+    def setUp(self):
+        tmp = tempfile.TemporaryDirectory()
+        self.addCleanup(tmp.cleanup)
+        self.state = os.path.join(tmp.name, 'state.json')
+
+    def start_sim(self, *args):
+        sim = subprocess.Popen(
+            [sys.executable, os.path.join(SCRIPTS, 'leshan_sim.py'),
+             '--port', '0', '--devices', str(DEVICES),
+             '--segments', str(SEGMENTS), '--image-size', '16384',
+             '--reboot-time', '0.2'] + list(args),
+            stdout=subprocess.PIPE, universal_newlines=True)
+        self.addCleanup(sim.stdout.close)
+        self.addCleanup(sim.wait)
+        self.addCleanup(sim.kill)
+        # "N devices in M segments on port P"
+        self.port = int(sim.stdout.readline().split()[-1])
+
+    def rollout(self, *args):
+        return subprocess.run(
+            [sys.executable, os.path.join(SCRIPTS, 'leshan.py'),
+             '-host', 'http://localhost:%d' % self.port, '-u', URL,
+             '--state', self.state, '--waves', '1,10,100',
+             '--poll-interval', '5', '--download-timeout', '60',
+             '--update-timeout', '60'] + list(args),
+            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL,
+            timeout=120).returncode
+
+    def states(self):
+        with open(self.state) as f:
+            records = json.load(f)
+        return [record['state'] for record in records.values()]
+
+    def test_rollout(self):
+        self.start_sim()
+        self.assertEqual(self.rollout(), 0)
+        self.assertEqual(self.states(), ['done'] * DEVICES)
+
+        # Devices already done for this URL are skipped.
+        mtime = os.stat(self.state).st_mtime_ns
+        self.assertEqual(self.rollout(), 0)
+        self.assertEqual(os.stat(self.state).st_mtime_ns, mtime)
+
+    def test_rollout_stops_on_failures(self):
+        # Every update fails, so the rollout stops after the first wave.
+        self.start_sim('--failure-rate', '1')
+        self.assertNotEqual(self.rollout(), 0)
+        self.assertEqual(self.states(), ['failed'])
+
+
+if __name__ == '__main__':
+    unittest.main()